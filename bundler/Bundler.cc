@@ -10,6 +10,7 @@
 #include "converter/prefab/PrefabBuilder.h"
 #include "converter/prefab/TextGltfConverter.h"
 #include "converter/script/WasmConverter.h"
+#include "core/jobs/JobQueue.h"
 #include "log/log.h"
 
 namespace mondradiko {
@@ -50,7 +51,8 @@ Bundler::Bundler(const std::filesystem::path& _manifest_path)
   }
 
   if (!std::filesystem::exists(manifest_path)) {
-    log_ftl_fmt("Manifest path %s does not exist", manifest_path.c_str());
+    log_ftl_fmt("Manifest path %s does not exist",
+                manifest_path.string().c_str());
   }
 
   source_root = manifest_path.parent_path();
@@ -75,12 +77,43 @@ Bundler::Bundler(const std::filesystem::path& _manifest_path)
       std::string compression_name = iter->second.as_string();
       if (compression_name == "LZ4") {
         compression_method = assets::LumpCompressionMethod::LZ4;
+      } else if (compression_name == "LZ4Seekable") {
+        compression_method = assets::LumpCompressionMethod::LZ4Seekable;
+      } else if (compression_name == "Zstd") {
+        compression_method = assets::LumpCompressionMethod::Zstd;
+      } else if (compression_name == "ZstdSeekable") {
+        compression_method = assets::LumpCompressionMethod::ZstdSeekable;
       } else if (compression_name != "none") {
         log_ftl_fmt("Invalid compression method %s", compression_name.c_str());
       }
     }
 
     bundle_builder->setDefaultCompressionMethod(compression_method);
+
+    auto dictionary_iter = bundle_table.find("compression_dictionary");
+    if (dictionary_iter != bundle_table.end()) {
+      bundle_builder->setTrainDictionary(dictionary_iter->second.as_boolean());
+    }
+
+    auto output_iter = bundle_table.find("output");
+    if (output_iter != bundle_table.end()) {
+      std::string output_name = output_iter->second.as_string();
+      if (output_name == "pack") {
+        bundle_builder->setPackOutput(true);
+      } else if (output_name != "directory") {
+        log_ftl_fmt("Invalid bundle output %s", output_name.c_str());
+      }
+    }
+
+    auto packing_iter = bundle_table.find("packing");
+    if (packing_iter != bundle_table.end()) {
+      std::string packing_name = packing_iter->second.as_string();
+      if (packing_name == "manifest") {
+        bundle_builder->setLocalityPacking(false);
+      } else if (packing_name != "locality") {
+        log_ftl_fmt("Invalid lump packing %s", packing_name.c_str());
+      }
+    }
   }
 }
 
@@ -90,14 +123,34 @@ Bundler::~Bundler() {
   }
 
   if (bundle_builder != nullptr) delete bundle_builder;
+  if (conversion_cache != nullptr) delete conversion_cache;
+}
+
+void Bundler::setAccessTrace(const std::filesystem::path& trace_path) {
+  if (!bundle_builder->loadAccessTrace(trace_path)) {
+    log_ftl_fmt("Failed to read access trace %s", trace_path.string().c_str());
+  }
 }
 
+thread_local Bundler::ManifestAsset* Bundler::current_conversion = nullptr;
+
 assets::AssetId Bundler::addAsset(
     ConverterInterface::AssetBuilder* fbb,
     ConverterInterface::AssetOffset asset_offset) {
   assets::AssetId asset_id;
-  bundle_builder->addAsset(&asset_id, fbb, asset_offset);
-  return asset_id;
+
+  if (current_conversion == nullptr) {
+    bundle_builder->addAsset(&asset_id, fbb, asset_offset);
+    return asset_id;
+  }
+
+  // Hold onto the asset until its conversion is committed in manifest order
+  fbb->Finish(asset_offset);
+  const uint8_t* asset_data = fbb->GetBufferPointer();
+  size_t asset_size = fbb->GetSize();
+  current_conversion->conversion.assets.emplace_back(asset_data,
+                                                     asset_data + asset_size);
+  return AssetBundleBuilder::getAssetId(asset_data, asset_size);
 }
 
 void Bundler::addConverter(std::string file_format,
@@ -106,88 +159,242 @@ void Bundler::addConverter(std::string file_format,
 }
 
 assets::AssetId Bundler::getAssetByAlias(const std::string& alias) {
-  auto iter = asset_aliases.find(alias);
-  if (iter == asset_aliases.end()) {
-    return assets::NullAsset;
+  assets::AssetId asset_id = assets::NullAsset;
+
+  // Only aliases from earlier in the manifest are visible, as if converting
+  // in order. Those conversions were queued first, so this can't deadlock.
+  auto iter = alias_indices.find(alias);
+  if (iter != alias_indices.end() &&
+      (current_conversion == nullptr ||
+       iter->second < current_conversion->manifest_index)) {
+    asset_id = manifest_assets[iter->second].converted_id.get();
   }
 
-  return iter->second;
+  // Missing aliases are recorded too, in case they're added later
+  if (current_conversion != nullptr) {
+    current_conversion->conversion.alias_lookups.push_back({alias, asset_id});
+  }
+
+  return asset_id;
 }
 
 std::filesystem::path Bundler::getAssetPath(const toml::table& asset) {
   const auto& asset_file = asset.at("file").as_string();
   auto asset_path = source_root / asset_file.str;
+  addSourceFile(asset_path);
   return asset_path;
 }
 
+void Bundler::addSourceFile(const std::filesystem::path& source_path) {
+  if (current_conversion == nullptr) return;
+
+  // Cached by path relative to the manifest, so the source tree can move
+  std::string relative_path =
+      source_path.lexically_relative(source_root).generic_string();
+
+  auto& source_files = current_conversion->conversion.source_files;
+  for (const auto& source_file : source_files) {
+    if (source_file.path == relative_path) return;
+  }
+
+  // Hashed once the conversion finishes
+  source_files.push_back({relative_path, 0});
+}
+
 void Bundler::bundle() {
-  const auto assets = toml::find<toml::array>(manifest, "assets");
-
-  for (const auto& asset_table : assets) {
-    const auto& asset = asset_table.as_table();
-
-    std::string asset_type;
-    std::string alias = "";
-    bool initial_prefab = false;
-
-    {
-      auto iter = asset.find("type");
-      if (iter != asset.end()) {
-        asset_type = iter->second.as_string().str;
-      } else {
-        auto asset_path = getAssetPath(asset);
-        asset_type = asset_path.extension().string().substr(1);
-      }
+  const auto& assets = toml::find<toml::array>(manifest, "assets");
+
+  manifest_assets.resize(assets.size());
+  for (size_t i = 0; i < assets.size(); i++) {
+    manifest_assets[i].manifest_index = i;
+    _parseManifestAsset(assets[i].as_table(), &manifest_assets[i]);
+  }
+
+  if (use_cache && conversion_cache == nullptr) {
+    conversion_cache = new ConversionCache(bundle_root / "bundler-cache");
+  }
+
+  {
+    // Converters only share thread-safe caches, so independent assets
+    // convert in parallel
+    core::JobQueue jobs;
+    log_inf_fmt("Converting %zu assets on %u threads", manifest_assets.size(),
+                jobs.getWorkerNum());
+
+    for (auto& manifest_asset : manifest_assets) {
+      ManifestAsset* to_convert = &manifest_asset;
+      auto convert = [this, to_convert]() {
+        return _convertAsset(to_convert);
+      };
+
+      manifest_asset.converted_id = jobs.submit(convert).share();
     }
 
-    {
-      auto iter = asset.find("alias");
-      if (iter != asset.end()) {
-        alias = asset.at("alias").as_string();
-      }
+    // Committing in manifest order keeps the lump layout reproducible
+    for (auto& manifest_asset : manifest_assets) {
+      _commitAsset(&manifest_asset);
     }
+  }
+
+  if (conversion_cache != nullptr) {
+    log_inf_fmt("Reused %u of %zu cached conversions",
+                cached_asset_num.load(), manifest_assets.size());
+  }
 
-    {
-      auto iter = asset.find("initial_prefab");
-      if (iter != asset.end()) {
-        if (asset.at("initial_prefab").as_boolean()) {
-          initial_prefab = true;
-        }
+  for (auto& iter : asset_aliases) {
+    bundle_builder->addBundleExport(iter.first, iter.second);
+  }
+
+  assets::AssetResult result = bundle_builder->buildBundle("registry.bin");
+  if (result != assets::AssetResult::Success) {
+    log_ftl_fmt("Failed to build asset bundle: %s",
+                assets::getAssetResultString(result));
+  }
+}
+
+void Bundler::_parseManifestAsset(const toml::table& asset,
+                                  ManifestAsset* manifest_asset) {
+  manifest_asset->table = &asset;
+
+  {
+    auto iter = asset.find("type");
+    if (iter != asset.end()) {
+      manifest_asset->type = iter->second.as_string().str;
+    } else {
+      auto asset_path = getAssetPath(asset);
+      manifest_asset->type = asset_path.extension().string().substr(1);
+    }
+  }
+
+  {
+    auto iter = asset.find("alias");
+    if (iter != asset.end()) {
+      manifest_asset->alias = asset.at("alias").as_string();
+      alias_indices.emplace(manifest_asset->alias,
+                            manifest_asset->manifest_index);
+    }
+  }
+
+  {
+    auto iter = asset.find("initial_prefab");
+    if (iter != asset.end()) {
+      if (asset.at("initial_prefab").as_boolean()) {
+        manifest_asset->initial_prefab = true;
       }
     }
+  }
 
-    {
-      log_dbg_fmt("Converting %s asset", asset_type.c_str());
+  {
+    auto iter = converters.find(manifest_asset->type);
 
-      // TODO(marceline-cramer) Converted asset caching
-      auto iter = converters.find(asset_type);
+    if (iter == converters.end()) {
+      log_ftl_fmt("Couldn't find converter for %s",
+                  manifest_asset->type.c_str());
+    }
 
-      if (iter == converters.end()) {
-        log_ftl_fmt("Couldn't find converter for %s", asset_type.c_str());
-      }
+    manifest_asset->converter = iter->second;
+  }
+}
 
-      flatbuffers::FlatBufferBuilder fbb;
-      auto asset_offset = iter->second->convert(&fbb, asset);
+assets::AssetId Bundler::_convertAsset(ManifestAsset* manifest_asset) {
+  // Every worker sets this before converting, so it's never left stale
+  current_conversion = manifest_asset;
 
-      assets::AssetId asset_id;
-      bundle_builder->addAsset(&asset_id, &fbb, asset_offset);
-      log_inf_fmt("Added %s asset: 0x%0dx", asset_type.c_str(), asset_id);
+  uint64_t cache_key = ConversionCache::getKey(
+      manifest_asset->type, manifest_asset->converter->getVersion(),
+      *manifest_asset->table);
 
-      if (alias.length() > 0) {
-        asset_aliases.emplace(alias, asset_id);
-      }
+  if (conversion_cache != nullptr &&
+      _loadCachedConversion(manifest_asset, cache_key)) {
+    log_dbg_fmt("Reusing cached %s asset", manifest_asset->type.c_str());
+    cached_asset_num++;
+  } else {
+    log_dbg_fmt("Converting %s asset", manifest_asset->type.c_str());
 
-      if (initial_prefab) {
-        bundle_builder->addInitialPrefab(asset_id);
-      }
+    // Discard anything recorded while checking the cache
+    manifest_asset->conversion = ConversionCache::Entry();
+
+    flatbuffers::FlatBufferBuilder fbb;
+    auto asset_offset =
+        manifest_asset->converter->convert(&fbb, *manifest_asset->table);
+    addAsset(&fbb, asset_offset);
+
+    if (conversion_cache != nullptr) {
+      _storeConversion(manifest_asset, cache_key);
     }
   }
 
-  for (auto& iter : asset_aliases) {
-    bundle_builder->addBundleExport(iter.first, iter.second);
+  current_conversion = nullptr;
+
+  // The asset itself is always added last, after everything it references
+  const auto& asset = manifest_asset->conversion.assets.back();
+  return AssetBundleBuilder::getAssetId(asset.data(), asset.size());
+}
+
+bool Bundler::_loadCachedConversion(ManifestAsset* manifest_asset,
+                                    uint64_t cache_key) {
+  ConversionCache::Entry cached;
+  if (!conversion_cache->load(cache_key, &cached)) return false;
+  if (cached.assets.empty()) return false;
+
+  for (const auto& source_file : cached.source_files) {
+    uint64_t hash;
+    if (!ConversionCache::hashFile(source_root / source_file.path, &hash) ||
+        hash != source_file.hash) {
+      log_dbg_fmt("Source file %s has changed", source_file.path.c_str());
+      return false;
+    }
+  }
+
+  // Waits on the aliased assets, just like converting would
+  for (const auto& alias_lookup : cached.alias_lookups) {
+    if (getAssetByAlias(alias_lookup.alias) != alias_lookup.id) {
+      log_dbg_fmt("Alias %s has changed", alias_lookup.alias.c_str());
+      return false;
+    }
+  }
+
+  manifest_asset->conversion = std::move(cached);
+  return true;
+}
+
+void Bundler::_storeConversion(ManifestAsset* manifest_asset,
+                               uint64_t cache_key) {
+  for (auto& source_file : manifest_asset->conversion.source_files) {
+    if (!ConversionCache::hashFile(source_root / source_file.path,
+                                   &source_file.hash)) {
+      // Without a hash there's no way to tell if it changed
+      log_wrn_fmt("Not caching conversion that read missing file %s",
+                  source_file.path.c_str());
+      return;
+    }
   }
 
-  bundle_builder->buildBundle("registry.bin");
+  conversion_cache->store(cache_key, manifest_asset->conversion);
+}
+
+void Bundler::_commitAsset(ManifestAsset* manifest_asset) {
+  // Rethrows any error from the conversion
+  assets::AssetId asset_id = manifest_asset->converted_id.get();
+
+  for (const auto& converted : manifest_asset->conversion.assets) {
+    assets::AssetId converted_id;
+    bundle_builder->addAsset(&converted_id, converted.data(),
+                             converted.size());
+  }
+
+  manifest_asset->conversion = ConversionCache::Entry();
+
+  log_inf_fmt("Added %s asset: 0x%0dx", manifest_asset->type.c_str(),
+              asset_id);
+
+  if (manifest_asset->alias.length() > 0) {
+    asset_aliases.emplace(manifest_asset->alias, asset_id);
+  }
+
+  if (manifest_asset->initial_prefab) {
+    bundle_builder->addInitialPrefab(asset_id);
+  }
 }
 
 }  // namespace bundler
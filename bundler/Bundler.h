@@ -3,12 +3,15 @@
 
 #pragma once
 
+#include <atomic>
 #include <filesystem>
+#include <future>
 #include <map>
 #include <string>
 
 #include "converter/AssetBundleBuilder.h"
 #include "converter/BundlerInterface.h"
+#include "converter/ConversionCache.h"
 #include "converter/ConverterInterface.h"
 #include "lib/include/toml_headers.h"
 #include "types/assets/SerializedAsset_generated.h"
@@ -27,8 +30,19 @@ class Bundler : public converter::BundlerInterface {
   void addConverter(std::string, const converter::ConverterInterface*) final;
   assets::AssetId getAssetByAlias(const std::string&) final;
   std::filesystem::path getAssetPath(const toml::table&) final;
+  void addSourceFile(const std::filesystem::path&) final;
   void bundle() final;
 
+  // Reuse unchanged conversions from previous runs (on by default)
+  void setUseCache(bool use) { use_cache = use; }
+
+  void setMaxLumpsInFlight(uint32_t max_lumps) {
+    bundle_builder->setMaxLumpsInFlight(max_lumps);
+  }
+
+  // Packs the assets a client loaded first in the order it loaded them
+  void setAccessTrace(const std::filesystem::path&);
+
  private:
   std::filesystem::path manifest_path;
   std::filesystem::path source_root;
@@ -41,6 +55,36 @@ class Bundler : public converter::BundlerInterface {
   std::map<std::string, assets::AssetId> asset_aliases;
 
   types::vector<converter::ConverterInterface*> owned_converters;
+
+  bool use_cache = true;
+  converter::ConversionCache* conversion_cache = nullptr;
+  std::atomic<uint32_t> cached_asset_num{0};
+
+  // One entry of the manifest's assets array, converted on a worker thread
+  struct ManifestAsset {
+    size_t manifest_index;
+    const toml::table* table;
+    std::string type;
+    std::string alias;
+    bool initial_prefab = false;
+    const converter::ConverterInterface* converter;
+
+    // Every asset added by the converter, and everything the converter read
+    converter::ConversionCache::Entry conversion;
+    std::shared_future<assets::AssetId> converted_id;
+  };
+
+  types::vector<ManifestAsset> manifest_assets;
+  std::map<std::string, size_t> alias_indices;
+
+  // The conversion running on this thread, if any
+  static thread_local ManifestAsset* current_conversion;
+
+  void _parseManifestAsset(const toml::table&, ManifestAsset*);
+  assets::AssetId _convertAsset(ManifestAsset*);
+  bool _loadCachedConversion(ManifestAsset*, uint64_t);
+  void _storeConversion(ManifestAsset*, uint64_t);
+  void _commitAsset(ManifestAsset*);
 };
 
 }  // namespace bundler
@@ -15,6 +15,9 @@ using namespace mondradiko;  // NOLINT using is ok because this is an entrypoint
 
 struct BundlerArgs {
   std::string manifest_file;
+  bool no_cache = false;
+  uint32_t max_lumps_in_flight = 0;
+  std::string access_trace;
 
   int parse(int, const char* const[]);
 };
@@ -28,6 +31,14 @@ int BundlerArgs::parse(int argc, const char* const argv[]) {
       ->required()
       ->check(CLI::ExistingFile);
 
+  app.add_flag("--no-cache", no_cache,
+               "Convert every asset, ignoring previous conversions");
+  app.add_option("--max-lumps-in-flight", max_lumps_in_flight,
+                 "Max lumps held in memory while compressing (0 = auto)");
+  app.add_option("--access-trace", access_trace,
+                 "Client --asset-trace output to pack lumps in load order")
+      ->check(CLI::ExistingFile);
+
   CLI11_PARSE(app, argc, argv);
   return -1;
 }
@@ -43,6 +54,9 @@ int main(int argc, char* argv[]) {
 
   try {
     bundler::Bundler bundler(args.manifest_file);
+    bundler.setUseCache(!args.no_cache);
+    bundler.setMaxLumpsInFlight(args.max_lumps_in_flight);
+    if (!args.access_trace.empty()) bundler.setAccessTrace(args.access_trace);
     bundler.bundle();
   } catch (const std::exception& e) {
     log_err_fmt("Mondradiko bundler failed with message: %s", e.what());
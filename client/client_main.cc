@@ -10,6 +10,7 @@
 #include "CLI/Config.hpp"
 #include "CLI/Formatter.hpp"
 #include "core/assets/AssetPool.h"
+#include "core/assets/AssetTrace.h"
 #include "core/cvars/CVarScope.h"
 #include "core/displays/OpenXrDisplay.h"
 #include "core/displays/SdlDisplay.h"
@@ -19,6 +20,7 @@
 #include "core/renderer/MeshPass.h"
 #include "core/renderer/OverlayPass.h"
 #include "core/renderer/Renderer.h"
+#include "core/scripting/environment/ScriptEnvironment.h"
 #include "core/scripting/environment/WorldScriptEnvironment.h"
 #include "core/ui/UserInterface.h"
 #include "core/ui/glyph/GlyphLoader.h"
@@ -45,6 +47,10 @@ struct ClientArgs {
 
   std::string config_path = "./config.toml";
 
+  std::string asset_trace_path;
+
+  bool trust_precompiled_scripts = false;
+
   int parse(int, const char* const[]);
 };
 
@@ -79,6 +85,12 @@ int ClientArgs::parse(int argc, const char* const argv[]) {
       app.add_option("-c,--config", config_path, "Path to config file", true);
   config_op->check(CLI::ExistingFile);
 
+  app.add_option("--asset-trace", asset_trace_path,
+                 "Write a Chrome trace of asset loading to this path");
+
+  app.add_flag("--trust-precompiled-scripts", trust_precompiled_scripts,
+               "Run scripts' bundled native code instead of compiling them");
+
   CLI11_PARSE(app, argc, argv);
   return -1;
 }
@@ -86,9 +98,17 @@ int ClientArgs::parse(int argc, const char* const argv[]) {
 bool g_interrupted = false;
 
 void run(const ClientArgs& args) {
+  // Enabled first so that bundle verification is traced too
+  if (!args.asset_trace_path.empty()) AssetTrace::enable();
+
+  if (args.trust_precompiled_scripts) {
+    ScriptEnvironment::trustPrecompiledScripts();
+  }
+
   Filesystem fs;
   CVarScope cvars;
 
+  Filesystem::initCVars(&cvars);
   GlyphLoader::initCVars(&cvars);
   GpuInstance::initCVars(&cvars);
   Renderer::initCVars(&cvars);
@@ -96,6 +116,7 @@ void run(const ClientArgs& args) {
   UserInterface::initCVars(&cvars);
   Display::initCVars(&cvars);
   cvars.loadConfigFromFile(&fs, args.config_path);
+  fs.setCVars(&cvars);
 
   for (auto bundle : args.bundle_paths) {
     fs.loadAssetBundle(bundle);
@@ -124,7 +145,7 @@ void run(const ClientArgs& args) {
 
   Renderer renderer(&cvars, display.get(), &gpu);
   GlyphLoader glyphs(&cvars, &renderer);
-  MeshPass mesh_pass(&renderer, &world);
+  MeshPass mesh_pass(cvars.getChild("renderer"), &renderer, &world);
   OverlayPass overlay_pass(cvars.getChild("renderer"), &glyphs, &renderer,
                            &world);
 
@@ -183,7 +204,17 @@ void run(const ClientArgs& args) {
   }
 
   renderer.destroyFrameData();
+
+  // GPU assets need to be freed while their render passes still exist
+  world.clear();
+  asset_pool.unloadAll();
+
   display->destroySession();
+
+  if (AssetTrace::isEnabled()) {
+    AssetTrace::logSummary(20);
+    AssetTrace::writeChromeTrace(args.asset_trace_path);
+  }
 }
 
 void signalHandler(int signum) {
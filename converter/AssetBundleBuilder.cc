@@ -3,99 +3,265 @@
 
 #include "converter/AssetBundleBuilder.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
 #include <cstring>
 #include <fstream>
+#include <string>
+#include <utility>
 
+#include "lib/include/json_headers.h"
 #include "log/log.h"
 #include "lz4frame.h"  // NOLINT
 #include "lz4hc.h"     // NOLINT
+#include "types/assets/BundlePack.h"
 #include "types/assets/Registry_generated.h"
 #include "types/build_config.h"
 #include "xxhash.h"  // NOLINT
+#include "zdict.h"   // NOLINT
+#include "zstd.h"    // NOLINT
 
 namespace mondradiko {
 namespace converter {
 
+const uint32_t ASSET_FILE_CHUNK_SIZE = 1024 * 1024;  // 1 MiB
+
+const char* ASSET_SPOOL_NAME = "asset_spool.tmp";
+
 // using is ok here because it'd be inconvenient not to use it
 using namespace assets;  // NOLINT
 
+// Bundles are compressed once and then downloaded by many clients
+// TODO(marceline-cramer) Custom compression level from bundle manifest
+const int ZSTD_LUMP_COMPRESSION_LEVEL = 19;
+
+// Dictionaries are meant for the many small flatbuffers (prefabs, materials)
+const size_t ZSTD_DICTIONARY_CAPACITY = 112 * 1024;                // 112 KiB
+const size_t ZSTD_DICTIONARY_MAX_SAMPLE_SIZE = 128 * 1024;         // 128 KiB
+const size_t ZSTD_DICTIONARY_MAX_SAMPLES_SIZE = 16 * 1024 * 1024;  // 16 MiB
+
+static bool isZstdCompression(LumpCompressionMethod compression_method) {
+  return compression_method == LumpCompressionMethod::Zstd ||
+         compression_method == LumpCompressionMethod::ZstdSeekable;
+}
+
+static ZSTD_CCtx* createZstdContext(const std::vector<char>* dictionary) {
+  ZSTD_CCtx* context = ZSTD_createCCtx();
+  ZSTD_CCtx_setParameter(context, ZSTD_c_compressionLevel,
+                         ZSTD_LUMP_COMPRESSION_LEVEL);
+
+  // Loaded dictionaries are used for every frame compressed by the context
+  if (dictionary != nullptr) {
+    ZSTD_CCtx_loadDictionary(context, dictionary->data(), dictionary->size());
+  }
+
+  return context;
+}
+
+// Unchanged files are left alone so that their modification times survive,
+// which keeps runtime verification caches and file syncing tools happy
+static bool fileMatches(const std::filesystem::path& file_path,
+                        const char* data, size_t size) {
+  std::error_code ec;
+  if (std::filesystem::file_size(file_path, ec) != size || ec) return false;
+
+  std::ifstream file(file_path.c_str(), std::ifstream::binary);
+  std::vector<char> buffer(ASSET_FILE_CHUNK_SIZE);
+  size_t compared_size = 0;
+
+  while (compared_size < size) {
+    size_t chunk_size = std::min<size_t>(buffer.size(), size - compared_size);
+    if (!file.read(buffer.data(), chunk_size)) return false;
+    if (memcmp(buffer.data(), data + compared_size, chunk_size) != 0) {
+      return false;
+    }
+
+    compared_size += chunk_size;
+  }
+
+  return true;
+}
+
+static void writeFileIfChanged(const std::filesystem::path& file_path,
+                               const char* data, size_t size) {
+  if (fileMatches(file_path, data, size)) {
+    log_dbg_fmt("%s is unchanged", file_path.string().c_str());
+    return;
+  }
+
+  std::ofstream file(file_path.c_str(), std::ofstream::binary);
+  file.write(data, size);
+  file.close();
+}
+
+static bool filesMatch(const std::filesystem::path& a_path,
+                       const std::filesystem::path& b_path) {
+  std::error_code ec;
+  uintmax_t size = std::filesystem::file_size(a_path, ec);
+  if (ec || std::filesystem::file_size(b_path, ec) != size || ec) return false;
+
+  std::ifstream a_file(a_path.c_str(), std::ifstream::binary);
+  std::ifstream b_file(b_path.c_str(), std::ifstream::binary);
+  std::vector<char> a_buffer(ASSET_FILE_CHUNK_SIZE);
+  std::vector<char> b_buffer(ASSET_FILE_CHUNK_SIZE);
+
+  while (a_file.read(a_buffer.data(), a_buffer.size()) ||
+         a_file.gcount() > 0) {
+    size_t chunk_size = a_file.gcount();
+    if (!b_file.read(b_buffer.data(), chunk_size)) return false;
+    if (memcmp(a_buffer.data(), b_buffer.data(), chunk_size) != 0) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static bool replaceFileIfChanged(const std::filesystem::path& new_path,
+                                 const std::filesystem::path& file_path) {
+  std::error_code ec;
+
+  if (filesMatch(new_path, file_path)) {
+    log_dbg_fmt("%s is unchanged", file_path.string().c_str());
+    std::filesystem::remove(new_path, ec);
+    return true;
+  }
+
+  std::filesystem::rename(new_path, file_path, ec);
+  if (ec) {
+    log_err_fmt("Failed to replace %s", file_path.string().c_str());
+    std::filesystem::remove(new_path, ec);
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Writes a lump file while hashing it, so finished lumps never need
+ * to be held in memory.
+ */
+class LumpFileWriter {
+ public:
+  explicit LumpFileWriter(const std::filesystem::path& lump_path)
+      : lump_file(lump_path.c_str(), std::ofstream::binary) {
+    hash_state = XXH3_createState();
+    XXH3_64bits_reset(hash_state);
+  }
+
+  ~LumpFileWriter() { XXH3_freeState(hash_state); }
+
+  void write(const char* data, size_t size) {
+    lump_file.write(data, size);
+    XXH3_64bits_update(hash_state, data, size);
+    written_size += size;
+  }
+
+  bool close() {
+    lump_file.close();
+    return !lump_file.fail();
+  }
+
+  size_t getSize() const { return written_size; }
+
+  // Streaming XXH3 matches hashing the whole lump at once
+  LumpHash getChecksum() const {
+    return static_cast<LumpHash>(XXH3_64bits_digest(hash_state));
+  }
+
+ private:
+  std::ofstream lump_file;
+  XXH3_state_t* hash_state;
+  size_t written_size = 0;
+};
+
 AssetBundleBuilder::AssetBundleBuilder(const std::filesystem::path& bundle_root)
     : bundle_root(bundle_root) {
-  log_msg_fmt("Building asset bundle at %s", bundle_root.c_str());
+  log_msg_fmt("Building asset bundle at %s", bundle_root.string().c_str());
 }
 
 AssetBundleBuilder::~AssetBundleBuilder() {
-  log_dbg_fmt("Cleaning up asset bundle %s", bundle_root.c_str());
+  log_dbg_fmt("Cleaning up asset bundle %s", bundle_root.string().c_str());
 
   for (auto& lump : lumps) {
     if (lump == nullptr) continue;
 
-    if (lump->finalizer_thread != nullptr) {
-      if (lump->finalizer_thread->joinable()) {
-        log_wrn("Joining rogue lump finalizer thread");
-        lump->finalizer_thread->join();
+    // Finalizer jobs write to their lump, so let them finish first
+    if (lump->finalized.valid()) {
+      if (lump->finalized.wait_for(std::chrono::seconds(0)) !=
+          std::future_status::ready) {
+        log_wrn("Waiting for rogue lump finalizer");
       }
 
-      delete lump->finalizer_thread;
+      lump->finalized.wait();
     }
 
-    if (lump->data != nullptr) delete[] lump->data;
-
     delete lump;
   }
+
+  if (spool_file.is_open()) spool_file.close();
+  if (!spool_path.empty()) {
+    std::error_code ec;
+    std::filesystem::remove(spool_path, ec);
+  }
 }
 
 AssetResult AssetBundleBuilder::addAsset(
     AssetId* id, flatbuffers::FlatBufferBuilder* fbb,
     flatbuffers::Offset<SerializedAsset> asset_offset) {
   fbb->Finish(asset_offset);
-  size_t asset_size = fbb->GetSize();
+  return addAsset(id, fbb->GetBufferPointer(), fbb->GetSize());
+}
 
+AssetResult AssetBundleBuilder::addAsset(AssetId* id, const uint8_t* asset_data,
+                                         size_t asset_size) {
   if (asset_size > ASSET_LUMP_MAX_SIZE) {
     log_err("Asset size exceeds max asset lump size");
     return AssetResult::BadSize;
   }
 
-  // Generate ID by hashing asset data
-  *id = static_cast<AssetId>(XXH3_64bits(fbb->GetBufferPointer(), asset_size));
+  *id = getAssetId(asset_data, asset_size);
 
   if (used_ids.find(*id) != used_ids.end()) {
     log_wrn_fmt("Attempted to build asset with duplicated ID 0x%0x", *id);
     return AssetResult::DuplicateAsset;
   }
 
-  if (lumps.size() == 0) {
-    lumps.resize(1);
-    lumps[0] = allocateLump(0);
-  }
+  if (locality_packing) {
+    if (!spool_file.is_open()) {
+      spool_path = bundle_root / ASSET_SPOOL_NAME;
+      spool_file.open(spool_path.c_str(),
+                      std::ofstream::binary | std::ofstream::trunc);
 
-  uint32_t lump_index = lumps.size() - 1;
-
-  if (lumps[lump_index]->total_size + asset_size > ASSET_LUMP_MAX_SIZE) {
-    // Now that we're done with this lump, finalize it
-    launchFinalizer(lumps[lump_index]);
-
-    lump_index++;
-    LumpToSave* new_lump = allocateLump(lump_index);
-    lumps.push_back(new_lump);
-  }
+      if (!spool_file.is_open()) {
+        log_err_fmt("Failed to create asset spool %s",
+                    spool_path.string().c_str());
+        return AssetResult::BadContents;
+      }
+    }
 
-  if (lumps[lump_index]->finalizer_thread != nullptr) {
-    log_err_fmt("Lump %d has already been finalized", lump_index);
-    return AssetResult::BadContents;
+    SpooledAsset spooled_asset;
+    spooled_asset.id = *id;
+    spooled_asset.offset = spool_size;
+    spooled_asset.size = asset_size;
+    spooled_assets.push_back(spooled_asset);
+
+    spool_file.write(reinterpret_cast<const char*>(asset_data), asset_size);
+    spool_size += asset_size;
+  } else {
+    AssetResult result = appendToLump(*id, asset_data, asset_size);
+    if (result != AssetResult::Success) return result;
   }
 
-  AssetToSave new_asset;
-  new_asset.id = *id;
-  new_asset.size = asset_size;
-  lumps[lump_index]->assets.push_back(new_asset);
-
-  memcpy(lumps[lump_index]->data + lumps[lump_index]->total_size,
-         fbb->GetBufferPointer(), asset_size);
-
-  lumps[lump_index]->total_size += asset_size;
   used_ids.emplace(*id);
 
+  std::vector<AssetId> dependencies;
+  getDirectDependencies(GetSerializedAsset(asset_data), &dependencies);
+  if (dependencies.size() > 0) {
+    asset_dependencies.emplace(*id, std::move(dependencies));
+  }
+
   return AssetResult::Success;
 }
 
@@ -115,39 +281,150 @@ AssetResult AssetBundleBuilder::addBundleExport(const std::string& alias,
   return AssetResult::Success;
 }
 
+AssetId AssetBundleBuilder::getAssetId(const uint8_t* asset_data,
+                                       size_t asset_size) {
+  // Generate ID by hashing asset data
+  return static_cast<AssetId>(XXH3_64bits(asset_data, asset_size));
+}
+
 AssetResult AssetBundleBuilder::addInitialPrefab(AssetId prefab) {
   initial_prefabs.push_back(prefab);
   return AssetResult::Success;
 }
 
+bool AssetBundleBuilder::loadAccessTrace(
+    const std::filesystem::path& trace_path) {
+  std::ifstream trace_file(trace_path.c_str());
+  if (!trace_file.is_open()) {
+    log_err_fmt("Failed to open access trace %s", trace_path.string().c_str());
+    return false;
+  }
+
+  auto trace = nlohmann::json::parse(trace_file, nullptr, false);
+  if (trace.is_discarded() || !trace.is_object()) {
+    log_err_fmt("Access trace %s is not valid JSON",
+                trace_path.string().c_str());
+    return false;
+  }
+
+  auto events_iter = trace.find("traceEvents");
+  if (events_iter == trace.end() || !events_iter->is_array()) {
+    log_err_fmt("Access trace %s has no trace events",
+                trace_path.string().c_str());
+    return false;
+  }
+
+  const std::string subject_prefix = "asset 0x";
+
+  // Events are written in the order their zones ended, not started
+  std::vector<std::pair<double, AssetId>> retrievals;
+  for (const auto& event : *events_iter) {
+    if (!event.is_object() || event.value("name", "") != "Retrieve") continue;
+
+    auto time_iter = event.find("ts");
+    auto args_iter = event.find("args");
+    if (time_iter == event.end() || !time_iter->is_number() ||
+        args_iter == event.end() || !args_iter->is_object()) {
+      continue;
+    }
+
+    std::string subject = args_iter->value("subject", "");
+    if (subject.compare(0, subject_prefix.size(), subject_prefix) != 0) {
+      continue;
+    }
+
+    char* id_end;
+    const char* id_start = subject.c_str() + subject_prefix.size();
+    auto id = static_cast<AssetId>(std::strtoul(id_start, &id_end, 16));
+    if (id_end == id_start || *id_end != '\0') continue;
+
+    retrievals.emplace_back(time_iter->get<double>(), id);
+  }
+
+  if (retrievals.empty()) {
+    log_wrn_fmt("Access trace %s has no asset retrievals",
+                trace_path.string().c_str());
+  }
+
+  std::stable_sort(
+      retrievals.begin(), retrievals.end(),
+      [](const std::pair<double, AssetId>& a,
+         const std::pair<double, AssetId>& b) { return a.first < b.first; });
+
+  std::unordered_set<AssetId> seen;
+  access_order.clear();
+  for (const auto& retrieval : retrievals) {
+    if (seen.emplace(retrieval.second).second) {
+      access_order.push_back(retrieval.second);
+    }
+  }
+
+  log_inf_fmt("Read %zu accessed assets from %s", access_order.size(),
+              trace_path.string().c_str());
+  return true;
+}
+
 AssetResult AssetBundleBuilder::buildBundle(const char* registry_name) {
+  if (!spooled_assets.empty()) {
+    AssetResult result = packSpooledAssets();
+    if (result != AssetResult::Success) return result;
+  }
+
   // Finalize the last lump we handled
   launchFinalizer(lumps.back());
 
+  // Every lump is waited on below
+  lumps_in_flight.clear();
+
   flatbuffers::FlatBufferBuilder fbb;
 
   std::vector<flatbuffers::Offset<LumpEntry>> lump_offsets;
+  std::vector<AssetIndexEntry> asset_index;
 
   for (uint32_t lump_index = 0; lump_index < lumps.size(); lump_index++) {
     auto& lump = lumps[lump_index];
 
-    if (lump->finalizer_thread == nullptr) {
-      log_wrn_fmt("Finalizing lump %s late", lump->lump_path.c_str());
+    if (!lump->finalized.valid()) {
+      log_wrn_fmt("Finalizing lump %s late", lump->lump_path.string().c_str());
       launchFinalizer(lump);
     }
 
-    if (lump->finalizer_thread->joinable()) {
-      lump->finalizer_thread->join();
+    // Also rethrows any fatal error from the finalizer
+    if (!lump->finalized.get()) {
+      log_err_fmt("Failed to finalize lump %u; not writing the registry",
+                  lump_index);
+      return AssetResult::BadFile;
     }
 
     AssetEntry* asset_entries;
     auto assets_offset = fbb.CreateUninitializedVectorOfStructs(
         lump->assets.size(), &asset_entries);
 
+    uint32_t asset_offset = 0;
+
     for (uint32_t i = 0; i < lump->assets.size(); i++) {
       auto& asset = lump->assets[i];
       asset_entries[i].mutate_id(asset.id);
       asset_entries[i].mutate_size(asset.size);
+
+      asset_index.emplace_back(asset.id, lump_index, asset_offset, asset.size,
+                               asset.compressed_offset, asset.compressed_size);
+      asset_offset += asset.size;
+    }
+
+    flatbuffers::Offset<flatbuffers::Vector<const CompressedRange*>>
+        compressed_ranges_offset;
+
+    if (isSeekableCompression(lump->compression_method)) {
+      CompressedRange* compressed_ranges;
+      compressed_ranges_offset = fbb.CreateUninitializedVectorOfStructs(
+          lump->assets.size(), &compressed_ranges);
+
+      for (uint32_t i = 0; i < lump->assets.size(); i++) {
+        auto& asset = lump->assets[i];
+        compressed_ranges[i].mutate_offset(asset.compressed_offset);
+        compressed_ranges[i].mutate_size(asset.compressed_size);
+      }
     }
 
     LumpEntryBuilder lump_entry(fbb);
@@ -157,6 +434,9 @@ AssetResult AssetBundleBuilder::buildBundle(const char* registry_name) {
     lump_entry.add_hash_method(lump->hash_method);
     lump_entry.add_compression_method(lump->compression_method);
     lump_entry.add_assets(assets_offset);
+    lump_entry.add_compressed_ranges(compressed_ranges_offset);
+    lump_entry.add_dictionary_id(lump->dictionary_id);
+    lump_entry.add_data_size(asset_offset);
 
     lump_offsets.push_back(lump_entry.Finish());
   }
@@ -178,6 +458,43 @@ AssetResult AssetBundleBuilder::buildBundle(const char* registry_name) {
       initial_prefabs.size());
   auto lumps_offset = fbb.CreateVector(lump_offsets);
 
+  std::vector<flatbuffers::Offset<PrefabDependencies>> prefab_dependencies;
+  for (auto prefab : initial_prefabs) {
+    std::vector<AssetId> closure;
+    getDependencyClosure(prefab, &closure);
+
+    auto assets_offset = fbb.CreateVector(
+        reinterpret_cast<const uint32_t*>(closure.data()), closure.size());
+
+    PrefabDependenciesBuilder dependencies_builder(fbb);
+    dependencies_builder.add_prefab(prefab);
+    dependencies_builder.add_assets(assets_offset);
+    prefab_dependencies.push_back(dependencies_builder.Finish());
+  }
+
+  auto prefab_dependencies_offset = fbb.CreateVector(prefab_dependencies);
+
+  std::vector<flatbuffers::Offset<CompressionDictionary>> dictionaries;
+  if (dictionary_id != 0) {
+    auto data_offset = fbb.CreateVector(
+        reinterpret_cast<const uint8_t*>(dictionary.data()), dictionary.size());
+
+    CompressionDictionaryBuilder dictionary_builder(fbb);
+    dictionary_builder.add_id(dictionary_id);
+    dictionary_builder.add_data(data_offset);
+    dictionaries.push_back(dictionary_builder.Finish());
+  }
+
+  auto dictionaries_offset = fbb.CreateVector(dictionaries);
+
+  // Sorted so that loaders can binary search the registry in place
+  std::sort(asset_index.begin(), asset_index.end(),
+            [](const AssetIndexEntry& a, const AssetIndexEntry& b) {
+              return a.id() < b.id();
+            });
+
+  auto asset_index_offset = fbb.CreateVectorOfStructs(asset_index);
+
   RegistryBuilder registry_builder(fbb);
   registry_builder.add_major_version(MONDRADIKO_VERSION_MAJOR);
   registry_builder.add_minor_version(MONDRADIKO_VERSION_MINOR);
@@ -185,102 +502,637 @@ AssetResult AssetBundleBuilder::buildBundle(const char* registry_name) {
   registry_builder.add_exports(bundle_exports_offset);
   registry_builder.add_initial_prefabs(initial_prefabs_offset);
   registry_builder.add_lumps(lumps_offset);
+  registry_builder.add_dictionaries(dictionaries_offset);
+  registry_builder.add_asset_index(asset_index_offset);
+  registry_builder.add_prefab_dependencies(prefab_dependencies_offset);
 
   fbb.Finish(registry_builder.Finish());
 
+  if (pack_output) {
+    // Loaders prefer a registry over a pack in the same directory
+    std::filesystem::remove(bundle_root / registry_name);
+    return writePack(fbb.GetBufferPointer(), fbb.GetSize());
+  }
+
   auto registry_path = bundle_root / registry_name;
-  std::ofstream registry_file(registry_path.c_str(), std::ofstream::binary);
-  registry_file.write(reinterpret_cast<char*>(fbb.GetBufferPointer()),
-                      fbb.GetSize());
-  registry_file.close();
+  writeFileIfChanged(registry_path,
+                     reinterpret_cast<char*>(fbb.GetBufferPointer()),
+                     fbb.GetSize());
 
   return AssetResult::Success;
 }
 
+AssetResult AssetBundleBuilder::writePack(const uint8_t* registry_data,
+                                          size_t registry_size) {
+  auto pack_path = bundle_root / BUNDLE_PACK_NAME;
+  log_inf_fmt("Writing bundle pack %s", pack_path.string().c_str());
+
+  BundlePackHeader header{};
+  header.magic = BUNDLE_PACK_MAGIC;
+  header.version = BUNDLE_PACK_VERSION;
+  header.lump_count = lumps.size();
+
+  uint64_t write_offset =
+      sizeof(header) + lumps.size() * sizeof(BundlePackLump);
+  header.registry_offset = write_offset;
+  header.registry_size = registry_size;
+  write_offset += registry_size;
+
+  // Page-align every lump so that it can be mapped and advised on its own
+  std::vector<BundlePackLump> pack_lumps(lumps.size());
+  for (uint32_t i = 0; i < lumps.size(); i++) {
+    uint64_t misalignment = write_offset % BUNDLE_PACK_ALIGNMENT;
+    if (misalignment > 0) write_offset += BUNDLE_PACK_ALIGNMENT - misalignment;
+    pack_lumps[i].offset = write_offset;
+    pack_lumps[i].size = lumps[i]->total_size;
+    write_offset += lumps[i]->total_size;
+  }
+
+  std::vector<char> pack_prefix;
+  auto append_prefix = [&pack_prefix](const void* data, size_t size) {
+    const char* bytes = reinterpret_cast<const char*>(data);
+    pack_prefix.insert(pack_prefix.end(), bytes, bytes + size);
+  };
+
+  append_prefix(&header, sizeof(header));
+  append_prefix(pack_lumps.data(), pack_lumps.size() * sizeof(BundlePackLump));
+  append_prefix(registry_data, registry_size);
+
+  // The registry holds every lump's checksum, so if it's unchanged, so is
+  // the rest of the pack
+  std::error_code ec;
+  if (std::filesystem::file_size(pack_path, ec) == write_offset && !ec) {
+    std::vector<char> old_prefix(pack_prefix.size());
+    std::ifstream old_pack(pack_path.c_str(), std::ifstream::binary);
+
+    if (old_pack.read(old_prefix.data(), old_prefix.size()) &&
+        old_prefix == pack_prefix) {
+      log_inf_fmt("Bundle pack %s is unchanged", pack_path.string().c_str());
+      for (auto& lump : lumps) std::filesystem::remove(lump->lump_path);
+      return AssetResult::Success;
+    }
+  }
+
+  std::ofstream pack_file(pack_path.c_str(), std::ofstream::binary);
+  pack_file.write(pack_prefix.data(), pack_prefix.size());
+
+  std::vector<char> buffer(ASSET_FILE_CHUNK_SIZE);
+
+  for (uint32_t i = 0; i < lumps.size(); i++) {
+    auto& lump = lumps[i];
+
+    // Zero-fill up to the lump's aligned offset
+    uint64_t padding =
+        pack_lumps[i].offset - static_cast<uint64_t>(pack_file.tellp());
+    std::fill(buffer.begin(), buffer.end(), 0);
+    pack_file.write(buffer.data(), padding);
+
+    std::ifstream lump_file(lump->lump_path.c_str(), std::ifstream::binary);
+    uint64_t copied_size = 0;
+
+    while (lump_file.read(buffer.data(), buffer.size()) ||
+           lump_file.gcount() > 0) {
+      pack_file.write(buffer.data(), lump_file.gcount());
+      copied_size += lump_file.gcount();
+    }
+
+    lump_file.close();
+
+    if (copied_size != pack_lumps[i].size) {
+      log_err_fmt("Lump %s changed size while packing",
+                  lump->lump_path.string().c_str());
+      return AssetResult::BadSize;
+    }
+
+    // The pack replaces the loose lump files
+    std::filesystem::remove(lump->lump_path);
+  }
+
+  pack_file.close();
+
+  return AssetResult::Success;
+}
+
+void AssetBundleBuilder::getDirectDependencies(
+    const SerializedAsset* asset, std::vector<AssetId>* dependencies) {
+  auto add_dependency = [dependencies](uint32_t id) {
+    if (id != NullAsset) dependencies->push_back(static_cast<AssetId>(id));
+  };
+
+  switch (asset->type()) {
+    case AssetType::PrefabAsset: {
+      const assets::PrefabAsset* prefab = asset->prefab();
+      if (prefab == nullptr) break;
+
+      if (prefab->children() != nullptr) {
+        for (auto child : *prefab->children()) add_dependency(child);
+      }
+
+      if (prefab->mesh_renderer() != nullptr) {
+        add_dependency(prefab->mesh_renderer()->mesh());
+        add_dependency(prefab->mesh_renderer()->material());
+      }
+
+      if (prefab->script() != nullptr) {
+        add_dependency(prefab->script()->script_asset());
+      }
+
+      break;
+    }
+
+    case AssetType::MaterialAsset: {
+      const assets::MaterialAsset* material = asset->material();
+      if (material == nullptr) break;
+
+      add_dependency(material->albedo_texture());
+      add_dependency(material->emissive_texture());
+      add_dependency(material->normal_map_texture());
+      add_dependency(material->metal_roughness_texture());
+      break;
+    }
+
+    default:
+      break;
+  }
+}
+
+void AssetBundleBuilder::getDependencyClosure(AssetId root,
+                                              std::vector<AssetId>* closure) {
+  std::unordered_set<AssetId> visited;
+  std::vector<AssetId> to_visit = {root};
+
+  while (!to_visit.empty()) {
+    AssetId id = to_visit.back();
+    to_visit.pop_back();
+
+    // Skip shared dependencies and assets from other bundles
+    if (!visited.emplace(id).second) continue;
+    if (used_ids.find(id) == used_ids.end()) continue;
+
+    closure->push_back(id);
+
+    auto iter = asset_dependencies.find(id);
+    if (iter == asset_dependencies.end()) continue;
+    to_visit.insert(to_visit.end(), iter->second.begin(), iter->second.end());
+  }
+
+  std::sort(closure->begin(), closure->end());
+}
+
+void AssetBundleBuilder::getPackingOrder(
+    std::vector<std::vector<AssetId>>* groups) {
+  std::unordered_set<AssetId> placed;
+
+  // Depth-first, so that every asset is closely followed by what it uses
+  auto place_closure = [&](AssetId root) {
+    std::vector<AssetId> group;
+    std::vector<AssetId> to_visit = {root};
+
+    while (!to_visit.empty()) {
+      AssetId id = to_visit.back();
+      to_visit.pop_back();
+
+      // Skip shared dependencies and assets from other bundles
+      if (used_ids.find(id) == used_ids.end()) continue;
+      if (!placed.emplace(id).second) continue;
+
+      group.push_back(id);
+
+      auto iter = asset_dependencies.find(id);
+      if (iter == asset_dependencies.end()) continue;
+      to_visit.insert(to_visit.end(), iter->second.rbegin(),
+                      iter->second.rend());
+    }
+
+    if (!group.empty()) groups->push_back(std::move(group));
+  };
+
+  {  // Whatever a client loaded first goes first, in the order it was loaded
+    std::vector<AssetId> accessed;
+    for (auto id : access_order) {
+      if (used_ids.find(id) == used_ids.end()) continue;
+      if (placed.emplace(id).second) accessed.push_back(id);
+    }
+
+    if (!accessed.empty()) groups->push_back(std::move(accessed));
+  }
+
+  for (auto prefab : initial_prefabs) place_closure(prefab);
+  for (const auto& exported_asset : exported_assets) {
+    place_closure(exported_asset.id);
+  }
+
+  std::unordered_set<AssetId> referenced;
+  for (const auto& iter : asset_dependencies) {
+    referenced.insert(iter.second.begin(), iter.second.end());
+  }
+
+  // Then every other tree of assets, in the order they were added
+  for (const auto& spooled_asset : spooled_assets) {
+    if (referenced.find(spooled_asset.id) == referenced.end()) {
+      place_closure(spooled_asset.id);
+    }
+  }
+
+  // Only assets in reference cycles are left
+  for (const auto& spooled_asset : spooled_assets) {
+    place_closure(spooled_asset.id);
+  }
+}
+
+AssetResult AssetBundleBuilder::packSpooledAssets() {
+  spool_file.close();
+
+  std::ifstream spool(spool_path.c_str(), std::ifstream::binary);
+  if (!spool.is_open()) {
+    log_err_fmt("Failed to open asset spool %s", spool_path.string().c_str());
+    return AssetResult::BadContents;
+  }
+
+  std::unordered_map<AssetId, const SpooledAsset*> spooled_by_id;
+  for (const auto& spooled_asset : spooled_assets) {
+    spooled_by_id.emplace(spooled_asset.id, &spooled_asset);
+  }
+
+  std::vector<std::vector<AssetId>> groups;
+  getPackingOrder(&groups);
+
+  log_inf_fmt("Packing %zu assets in %zu dependency groups",
+              spooled_assets.size(), groups.size());
+
+  std::vector<uint8_t> asset_data;
+
+  for (const auto& group : groups) {
+    size_t group_size = 0;
+    for (auto id : group) group_size += spooled_by_id.at(id)->size;
+
+    // Start a new lump instead of splitting a group that fits in one
+    if (!lumps.empty() && lumps.back()->total_size > 0 &&
+        lumps.back()->total_size + group_size > ASSET_LUMP_MAX_SIZE &&
+        group_size <= ASSET_LUMP_MAX_SIZE) {
+      startLump();
+    }
+
+    for (auto id : group) {
+      const SpooledAsset* spooled_asset = spooled_by_id.at(id);
+
+      asset_data.resize(spooled_asset->size);
+      spool.seekg(spooled_asset->offset);
+      if (!spool.read(reinterpret_cast<char*>(asset_data.data()),
+                      asset_data.size())) {
+        log_err_fmt("Failed to read asset 0x%0x from spool", id);
+        return AssetResult::BadContents;
+      }
+
+      AssetResult result =
+          appendToLump(id, asset_data.data(), asset_data.size());
+      if (result != AssetResult::Success) return result;
+    }
+  }
+
+  spool.close();
+  spooled_assets.clear();
+  spool_size = 0;
+
+  std::error_code ec;
+  std::filesystem::remove(spool_path, ec);
+  spool_path.clear();
+
+  return AssetResult::Success;
+}
+
+AssetResult AssetBundleBuilder::appendToLump(AssetId id,
+                                             const uint8_t* asset_data,
+                                             size_t asset_size) {
+  if (lumps.empty() ||
+      lumps.back()->total_size + asset_size > ASSET_LUMP_MAX_SIZE) {
+    startLump();
+  }
+
+  uint32_t lump_index = lumps.size() - 1;
+  LumpToSave* lump = lumps[lump_index];
+
+  if (lump->finalized.valid()) {
+    log_err_fmt("Lump %d has already been finalized", lump_index);
+    return AssetResult::BadContents;
+  }
+
+  AssetToSave new_asset;
+  new_asset.id = id;
+  new_asset.size = asset_size;
+  lump->assets.push_back(new_asset);
+
+  const char* asset_bytes = reinterpret_cast<const char*>(asset_data);
+  lump->data.insert(lump->data.end(), asset_bytes, asset_bytes + asset_size);
+  lump->total_size += asset_size;
+
+  return AssetResult::Success;
+}
+
+void AssetBundleBuilder::startLump() {
+  if (!lumps.empty()) {
+    // Now that we're done with this lump, finalize it
+    launchFinalizer(lumps.back());
+
+    // Bound memory use by waiting on older lumps before starting a new one
+    size_t max_lumps = max_lumps_in_flight;
+    if (max_lumps == 0) max_lumps = finalizer_jobs.getWorkerNum() + 1;
+    waitForFinalizers(max_lumps - 1);
+  }
+
+  lumps.push_back(allocateLump(lumps.size()));
+}
+
 void AssetBundleBuilder::launchFinalizer(LumpToSave* lump) {
-  if (lump->finalizer_thread != nullptr) {
+  if (lump->finalized.valid()) {
     log_err("Attempting to finalize lump twice");
     return;
   }
 
-  // TODO(marceline-cramer) Thread pool
-  // TODO(marceline-cramer) Job subsystem
+  const std::vector<char>* lump_dictionary = nullptr;
+  lump->dictionary_id = 0;
+
+  if (isZstdCompression(default_compression)) {
+    // Train on the first lump to be finalized so all lumps can share it
+    if (train_dictionary) {
+      trainDictionary(lump);
+      train_dictionary = false;
+    }
+
+    if (dictionary_id != 0) {
+      lump_dictionary = &dictionary;
+      lump->dictionary_id = dictionary_id;
+    }
+  }
+
+  LumpCompressionMethod compression_method = default_compression;
+  auto finalize = [lump, compression_method, lump_dictionary]() {
+    return finalizeLump(lump, compression_method, LumpHashMethod::xxHash,
+                        lump_dictionary);
+  };
+
+  lump->finalized = finalizer_jobs.submit(finalize);
+  lumps_in_flight.push_back(lump);
+}
+
+void AssetBundleBuilder::waitForFinalizers(size_t max_pending) {
+  while (lumps_in_flight.size() > max_pending) {
+    lumps_in_flight.front()->finalized.wait();
+    lumps_in_flight.pop_front();
+  }
+}
+
+void AssetBundleBuilder::trainDictionary(const LumpToSave* lump) {
+  log_dbg("Training Zstd dictionary");
+
+  std::vector<char> samples;
+  std::vector<size_t> sample_sizes;
+  size_t asset_offset = 0;
+
+  for (auto& asset : lump->assets) {
+    const char* asset_data = lump->data.data() + asset_offset;
+    asset_offset += asset.size;
+
+    if (asset.size > ZSTD_DICTIONARY_MAX_SAMPLE_SIZE) continue;
+    if (samples.size() + asset.size > ZSTD_DICTIONARY_MAX_SAMPLES_SIZE) break;
+
+    samples.insert(samples.end(), asset_data, asset_data + asset.size);
+    sample_sizes.push_back(asset.size);
+  }
+
+  dictionary.resize(ZSTD_DICTIONARY_CAPACITY);
+  size_t dictionary_size =
+      ZDICT_trainFromBuffer(dictionary.data(), dictionary.size(),
+                            samples.data(), sample_sizes.data(),
+                            static_cast<unsigned>(sample_sizes.size()));
+
+  if (ZDICT_isError(dictionary_size)) {
+    // Small bundles may not have enough samples; they just go without
+    log_wrn_fmt("Failed to train Zstd dictionary: %s",
+                ZDICT_getErrorName(dictionary_size));
+    dictionary.clear();
+    return;
+  }
 
-  std::thread* new_thread = new std::thread(
-      finalizeLump, lump, default_compression, LumpHashMethod::xxHash);
-  lump->finalizer_thread = new_thread;
+  dictionary.resize(dictionary_size);
+  dictionary_id = ZDICT_getDictID(dictionary.data(), dictionary.size());
+  log_inf_fmt("Trained %zu-byte Zstd dictionary 0x%08x from %zu assets",
+              dictionary_size, dictionary_id, sample_sizes.size());
 }
 
 AssetBundleBuilder::LumpToSave* AssetBundleBuilder::allocateLump(
     uint32_t lump_index) {
   LumpToSave* new_lump = new LumpToSave;
   new_lump->total_size = 0;
-  new_lump->data = new char[ASSET_LUMP_MAX_SIZE];
   new_lump->assets.resize(0);
-  new_lump->finalizer_thread = nullptr;
   new_lump->lump_path = bundle_root / generateLumpName(lump_index);
+  new_lump->compression_method = LumpCompressionMethod::None;
+  new_lump->dictionary_id = 0;
+  new_lump->checksum = 0;
+  new_lump->hash_method = LumpHashMethod::xxHash;
   return new_lump;
 }
 
-void AssetBundleBuilder::finalizeLump(LumpToSave* lump,
-                                      LumpCompressionMethod compression_method,
-                                      LumpHashMethod hash_method) {
-  if (hash_method != LumpHashMethod::xxHash) {
-    log_ftl("Non-xxHash hash methods are not yet supported");
+bool AssetBundleBuilder::compressLZ4(const LumpToSave* lump,
+                                     LumpFileWriter* writer) {
+  LZ4F_preferences_t preferences;
+  memset(&preferences, 0, sizeof(preferences));
+  preferences.frameInfo.contentSize = lump->total_size;
+  // TODO(marceline-cramer) Custom compression level from bundle manifest
+  preferences.compressionLevel = LZ4HC_CLEVEL_DEFAULT;
+  preferences.autoFlush = 1;
+  preferences.favorDecSpeed = 1;
+
+  LZ4F_cctx* context;
+  LZ4F_createCompressionContext(&context, LZ4F_VERSION);
+
+  // Large enough for the frame header, any chunk, and the frame footer
+  std::vector<char> compressed(
+      LZ4F_compressBound(ASSET_FILE_CHUNK_SIZE, &preferences));
+
+  size_t out_size = LZ4F_compressBegin(context, compressed.data(),
+                                       compressed.size(), &preferences);
+
+  for (size_t read_offset = 0;
+       !LZ4F_isError(out_size) && read_offset < lump->total_size;) {
+    writer->write(compressed.data(), out_size);
+
+    size_t chunk_size =
+        std::min<size_t>(ASSET_FILE_CHUNK_SIZE, lump->total_size - read_offset);
+    out_size = LZ4F_compressUpdate(context, compressed.data(),
+                                   compressed.size(),
+                                   lump->data.data() + read_offset,
+                                   chunk_size, nullptr);
+    read_offset += chunk_size;
   }
 
-  lump->compression_method = compression_method;
-  lump->hash_method = hash_method;
+  if (!LZ4F_isError(out_size)) {
+    writer->write(compressed.data(), out_size);
+    out_size = LZ4F_compressEnd(context, compressed.data(), compressed.size(),
+                                nullptr);
+  }
 
-  if (compression_method == LumpCompressionMethod::LZ4) {
-    // TODO(marceline-cramer) More lump compression types?
-    log_dbg("Compressing lump with LZ4");
+  LZ4F_freeCompressionContext(context);
+
+  if (LZ4F_isError(out_size)) {
+    log_err_fmt("LZ4 compression failed: %s", LZ4F_getErrorName(out_size));
+    return false;
+  }
+
+  writer->write(compressed.data(), out_size);
+  return true;
+}
 
-    LZ4F_preferences_t preferences;
-    memset(&preferences, 0, sizeof(preferences));
-    preferences.frameInfo.contentSize = lump->total_size;
+bool AssetBundleBuilder::compressLZ4Seekable(LumpToSave* lump,
+                                             LumpFileWriter* writer) {
+  size_t max_asset_size = 0;
+  for (auto& asset : lump->assets) {
+    max_asset_size = std::max(max_asset_size, asset.size);
+  }
+
+  std::vector<char> compressed(LZ4_compressBound(max_asset_size));
+  size_t read_offset = 0;
+
+  for (auto& asset : lump->assets) {
     // TODO(marceline-cramer) Custom compression level from bundle manifest
-    preferences.compressionLevel = LZ4HC_CLEVEL_DEFAULT;
-    preferences.autoFlush = 1;
-    preferences.favorDecSpeed = 1;
+    int out_size = LZ4_compress_HC(lump->data.data() + read_offset,
+                                   compressed.data(), asset.size,
+                                   compressed.size(), LZ4HC_CLEVEL_DEFAULT);
 
-    size_t compressed_size =
-        LZ4F_compressFrameBound(lump->total_size, &preferences);
-    char* compressed_data = new char[compressed_size];
+    if (out_size <= 0) {
+      log_err_fmt("LZ4 compression of asset 0x%0x failed", asset.id);
+      return false;
+    }
 
-    size_t out_size =
-        LZ4F_compressFrame(compressed_data, compressed_size, lump->data,
-                           lump->total_size, &preferences);
+    asset.compressed_offset = writer->getSize();
+    asset.compressed_size = out_size;
+    writer->write(compressed.data(), out_size);
+
+    read_offset += asset.size;
+  }
+
+  return true;
+}
 
-    if (LZ4F_isError(out_size)) {
-      log_err_fmt("LZ4 compression failed: %s", LZ4F_getErrorName(out_size));
-      return;
+bool AssetBundleBuilder::compressZstd(const LumpToSave* lump,
+                                      const std::vector<char>* dictionary,
+                                      LumpFileWriter* writer) {
+  ZSTD_CCtx* context = createZstdContext(dictionary);
+
+  // Streamed frames only include their content size if it's pledged first
+  ZSTD_CCtx_setPledgedSrcSize(context, lump->total_size);
+
+  std::vector<char> compressed(ZSTD_CStreamOutSize());
+  ZSTD_inBuffer input = {lump->data.data(), lump->total_size, 0};
+  size_t remaining;
+
+  do {
+    ZSTD_outBuffer output = {compressed.data(), compressed.size(), 0};
+    remaining = ZSTD_compressStream2(context, &output, &input, ZSTD_e_end);
+
+    if (ZSTD_isError(remaining)) {
+      log_err_fmt("Zstd compression failed: %s", ZSTD_getErrorName(remaining));
+      ZSTD_freeCCtx(context);
+      return false;
     }
 
-    // TODO(marceline-cramer) Stream compression data out to the file
-    delete[] lump->data;
-    lump->total_size = out_size;
-    lump->data = compressed_data;
-  } else if (compression_method != LumpCompressionMethod::None) {
-    log_err("Non-LZ4 compression methods are not yet implemented");
+    writer->write(compressed.data(), output.pos);
+  } while (remaining > 0);
+
+  ZSTD_freeCCtx(context);
+  return true;
+}
+
+bool AssetBundleBuilder::compressZstdSeekable(
+    LumpToSave* lump, const std::vector<char>* dictionary,
+    LumpFileWriter* writer) {
+  size_t max_asset_size = 0;
+  for (auto& asset : lump->assets) {
+    max_asset_size = std::max(max_asset_size, asset.size);
   }
 
-  {
-    log_dbg("Hashing lump with xxHash");
+  std::vector<char> compressed(ZSTD_compressBound(max_asset_size));
+  size_t read_offset = 0;
+
+  ZSTD_CCtx* context = createZstdContext(dictionary);
 
-    LumpHash checksum =
-        static_cast<LumpHash>(XXH3_64bits(lump->data, lump->total_size));
-    log_dbg_fmt("Lump has checksum 0x%0lx", checksum);
-    lump->checksum = checksum;
+  for (auto& asset : lump->assets) {
+    size_t out_size =
+        ZSTD_compress2(context, compressed.data(), compressed.size(),
+                       lump->data.data() + read_offset, asset.size);
+
+    if (ZSTD_isError(out_size)) {
+      log_err_fmt("Zstd compression of asset 0x%0x failed: %s", asset.id,
+                  ZSTD_getErrorName(out_size));
+      ZSTD_freeCCtx(context);
+      return false;
+    }
+
+    asset.compressed_offset = writer->getSize();
+    asset.compressed_size = out_size;
+    writer->write(compressed.data(), out_size);
+
+    read_offset += asset.size;
   }
 
-  {
-    log_dbg("Writing lump data to file");
+  ZSTD_freeCCtx(context);
+  return true;
+}
 
-    std::ofstream lump_file(lump->lump_path.c_str(), std::ofstream::binary);
-    lump_file.write(reinterpret_cast<char*>(lump->data), lump->total_size);
-    lump_file.close();
+bool AssetBundleBuilder::finalizeLump(LumpToSave* lump,
+                                      LumpCompressionMethod compression_method,
+                                      LumpHashMethod hash_method,
+                                      const std::vector<char>* dictionary) {
+  if (hash_method != LumpHashMethod::xxHash) {
+    log_ftl("Non-xxHash hash methods are not yet supported");
+  }
+
+  lump->compression_method = compression_method;
+  lump->hash_method = hash_method;
+
+  // Written beside the old lump, which is only replaced if this differs
+  auto temp_path = lump->lump_path;
+  temp_path += ".tmp";
+
+  LumpFileWriter writer(temp_path);
+  bool compressed = true;
+
+  if (compression_method == LumpCompressionMethod::LZ4) {
+    log_dbg("Compressing lump with LZ4");
+    compressed = compressLZ4(lump, &writer);
+  } else if (compression_method == LumpCompressionMethod::LZ4Seekable) {
+    log_dbg("Compressing lump assets individually with LZ4");
+    compressed = compressLZ4Seekable(lump, &writer);
+  } else if (compression_method == LumpCompressionMethod::Zstd) {
+    log_dbg("Compressing lump with Zstd");
+    compressed = compressZstd(lump, dictionary, &writer);
+  } else if (compression_method == LumpCompressionMethod::ZstdSeekable) {
+    log_dbg("Compressing lump assets individually with Zstd");
+    compressed = compressZstdSeekable(lump, dictionary, &writer);
+  } else {
+    if (compression_method != LumpCompressionMethod::None) {
+      log_err("Unrecognized lump compression method");
+      compressed = false;
+    } else {
+      writer.write(lump->data.data(), lump->total_size);
+    }
   }
+
+  // The uncompressed data isn't needed anymore
+  std::vector<char>().swap(lump->data);
+
+  if (!compressed || !writer.close()) {
+    log_err_fmt("Failed to write lump %s", lump->lump_path.string().c_str());
+    std::error_code ec;
+    std::filesystem::remove(temp_path, ec);
+    return false;
+  }
+
+  lump->total_size = writer.getSize();
+  lump->checksum = writer.getChecksum();
+  log_dbg_fmt("Lump has checksum 0x%0lx", lump->checksum);
+
+  return replaceFileIfChanged(temp_path, lump->lump_path);
 }
 
 }  // namespace converter
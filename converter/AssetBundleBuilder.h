@@ -3,12 +3,16 @@
 
 #pragma once
 
+#include <deque>
 #include <filesystem>
+#include <fstream>
+#include <future>
 #include <string>
-#include <thread>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
+#include "core/jobs/JobQueue.h"
 #include "lib/include/flatbuffers_headers.h"
 #include "types/assets/AssetTypes.h"
 #include "types/assets/Registry_generated.h"
@@ -17,6 +21,9 @@
 namespace mondradiko {
 namespace converter {
 
+// Forward declarations
+class LumpFileWriter;
+
 class AssetBundleBuilder {
  public:
   explicit AssetBundleBuilder(const std::filesystem::path&);
@@ -26,9 +33,36 @@ class AssetBundleBuilder {
     default_compression = method;
   }
 
+  // Only used by Zstandard compression methods
+  void setTrainDictionary(bool train) { train_dictionary = train; }
+
+  // Writes one page-aligned bundle pack instead of a registry and lump files
+  void setPackOutput(bool pack) { pack_output = pack; }
+
+  // Caps how many lumps are held in memory while waiting to be finalized,
+  // including the one being filled. Zero picks one per finalizer thread.
+  void setMaxLumpsInFlight(uint32_t max_lumps) {
+    max_lumps_in_flight = max_lumps;
+  }
+
+  // Packs lumps by prefab dependencies instead of in the order assets are
+  // added (on by default). Must be set before adding any assets.
+  void setLocalityPacking(bool locality) { locality_packing = locality; }
+
+  // Reads which assets a client loaded first from its --asset-trace file,
+  // so that locality packing places them first, in the order they were read
+  bool loadAccessTrace(const std::filesystem::path&);
+
   assets::AssetResult addAsset(assets::AssetId*,
                                flatbuffers::FlatBufferBuilder*,
                                flatbuffers::Offset<assets::SerializedAsset>);
+
+  // Adds an already-finished SerializedAsset buffer
+  assets::AssetResult addAsset(assets::AssetId*, const uint8_t*, size_t);
+
+  // IDs only depend on asset contents, so they can be known before adding
+  static assets::AssetId getAssetId(const uint8_t*, size_t);
+
   assets::AssetResult addInitialPrefab(assets::AssetId);
   assets::AssetResult addBundleExport(const std::string&, assets::AssetId);
   assets::AssetResult buildBundle(const char*);
@@ -39,9 +73,20 @@ class AssetBundleBuilder {
   assets::LumpCompressionMethod default_compression =
       assets::LumpCompressionMethod::None;
 
+  bool train_dictionary = false;
+  bool pack_output = false;
+  uint32_t max_lumps_in_flight = 0;
+  bool locality_packing = true;
+  std::vector<char> dictionary;
+  uint32_t dictionary_id = 0;
+
   struct AssetToSave {
     assets::AssetId id;
     size_t size;
+
+    // Only used by seekable compression methods
+    size_t compressed_offset = 0;
+    size_t compressed_size = 0;
   };
 
   struct AssetToExport {
@@ -51,28 +96,71 @@ class AssetBundleBuilder {
 
   struct LumpToSave {
     size_t total_size;
-    char* data;
+
+    // Uncompressed asset data, freed once the lump is written
+    std::vector<char> data;
 
     std::vector<AssetToSave> assets;
 
     // Finalized metadata
-    std::thread* finalizer_thread;
+    // Resolves to whether the lump file was written
+    std::future<bool> finalized;
     std::filesystem::path lump_path;
     assets::LumpCompressionMethod compression_method;
+    uint32_t dictionary_id;
     assets::LumpHash checksum;
     assets::LumpHashMethod hash_method;
   };
 
   std::vector<LumpToSave*> lumps;
+
+  // Locality packing holds added assets on disk until buildBundle()
+  struct SpooledAsset {
+    assets::AssetId id;
+    uint64_t offset;
+    size_t size;
+  };
+
+  std::filesystem::path spool_path;
+  std::ofstream spool_file;
+  uint64_t spool_size = 0;
+  std::vector<SpooledAsset> spooled_assets;
+  std::vector<assets::AssetId> access_order;
+
+  core::JobQueue finalizer_jobs;
+  std::deque<LumpToSave*> lumps_in_flight;
   std::unordered_set<assets::AssetId> used_ids;
   std::vector<AssetToExport> exported_assets;
   std::vector<assets::AssetId> initial_prefabs;
 
+  // Assets directly referenced by each asset
+  std::unordered_map<assets::AssetId, std::vector<assets::AssetId>>
+      asset_dependencies;
+
+  static void getDirectDependencies(const assets::SerializedAsset*,
+                                    std::vector<assets::AssetId>*);
+  void getDependencyClosure(assets::AssetId, std::vector<assets::AssetId>*);
+  void getPackingOrder(std::vector<std::vector<assets::AssetId>>*);
+  assets::AssetResult packSpooledAssets();
+  assets::AssetResult appendToLump(assets::AssetId, const uint8_t*, size_t);
+  void startLump();
+
+  assets::AssetResult writePack(const uint8_t*, size_t);
   void launchFinalizer(LumpToSave*);
+  void waitForFinalizers(size_t);
   LumpToSave* allocateLump(uint32_t);
-
-  static void finalizeLump(LumpToSave*, assets::LumpCompressionMethod,
-                           assets::LumpHashMethod);
+  void trainDictionary(const LumpToSave*);
+
+  static bool finalizeLump(LumpToSave*, assets::LumpCompressionMethod,
+                           assets::LumpHashMethod, const std::vector<char>*);
+
+  // These stream compressed data out to the lump's file
+  static bool compressLZ4(const LumpToSave*, LumpFileWriter*);
+  static bool compressLZ4Seekable(LumpToSave*, LumpFileWriter*);
+  static bool compressZstd(const LumpToSave*, const std::vector<char>*,
+                           LumpFileWriter*);
+  static bool compressZstdSeekable(LumpToSave*, const std::vector<char>*,
+                                   LumpFileWriter*);
 };
 
 }  // namespace converter
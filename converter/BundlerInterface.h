@@ -25,6 +25,10 @@ class BundlerInterface {
   virtual void addConverter(std::string, const ConverterInterface*) = 0;
   virtual assets::AssetId getAssetByAlias(const std::string&) = 0;
   virtual std::filesystem::path getAssetPath(const toml::table&) = 0;
+
+  // Records a file read by the current conversion, besides the asset's own
+  // file (e.g. a glTF's external buffers), for conversion cache invalidation
+  virtual void addSourceFile(const std::filesystem::path&) = 0;
   virtual void bundle() = 0;
 };
 
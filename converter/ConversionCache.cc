@@ -0,0 +1,305 @@
+// Copyright (c) 2020-2021 the Mondradiko contributors.
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include "converter/ConversionCache.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+#include "log/log.h"
+#include "xxhash.h"  // NOLINT
+
+namespace mondradiko {
+namespace converter {
+
+const uint32_t CONVERSION_CACHE_MAGIC = 0x4343444d;  // "MDCC"
+const uint32_t CONVERSION_CACHE_VERSION = 2;
+
+const uint32_t CONVERSION_HASH_CHUNK_SIZE = 1024 * 1024;  // 1 MiB
+
+// Tables are unordered, so sort their keys to get a stable hash
+static void serializeCanonical(const toml::value& value, std::string* out) {
+  if (value.is_table()) {
+    const auto& table = value.as_table();
+
+    std::vector<std::string> keys;
+    for (const auto& iter : table) keys.push_back(iter.first);
+    std::sort(keys.begin(), keys.end());
+
+    *out += "{";
+    for (const auto& key : keys) {
+      *out += key + "=";
+      serializeCanonical(table.at(key), out);
+      *out += ",";
+    }
+    *out += "}";
+  } else if (value.is_array()) {
+    *out += "[";
+    for (const auto& element : value.as_array()) {
+      serializeCanonical(element, out);
+      *out += ",";
+    }
+    *out += "]";
+  } else {
+    *out += toml::format(value);
+  }
+}
+
+// Entries are built in memory so that their payload can be hashed
+static void writeU32(std::string* out, uint32_t value) {
+  out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void writeU64(std::string* out, uint64_t value) {
+  out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void writeString(std::string* out, const std::string& value) {
+  writeU32(out, value.size());
+  out->append(value);
+}
+
+// Every read is bounded by the bytes left in the entry, and fails for good
+// once one runs past the end
+struct EntryReader {
+  const char* data;
+  size_t remaining;
+  bool failed = false;
+
+  bool read(void* out, size_t size) {
+    if (failed || size > remaining) {
+      failed = true;
+      return false;
+    }
+
+    memcpy(out, data, size);
+    data += size;
+    remaining -= size;
+    return true;
+  }
+
+  // Rejects element counts that can't possibly fit in the rest of the entry
+  bool readCount(size_t min_element_size, uint32_t* count) {
+    if (!read(count, sizeof(*count))) return false;
+    if (*count > remaining / min_element_size) failed = true;
+    return !failed;
+  }
+};
+
+static uint32_t readU32(EntryReader* reader) {
+  uint32_t value = 0;
+  reader->read(&value, sizeof(value));
+  return value;
+}
+
+static uint64_t readU64(EntryReader* reader) {
+  uint64_t value = 0;
+  reader->read(&value, sizeof(value));
+  return value;
+}
+
+static std::string readString(EntryReader* reader) {
+  uint32_t size = readU32(reader);
+  if (reader->failed || size > reader->remaining) {
+    reader->failed = true;
+    return std::string();
+  }
+
+  std::string value(size, '\0');
+  reader->read(value.data(), size);
+  return value;
+}
+
+ConversionCache::ConversionCache(const std::filesystem::path& cache_root)
+    : cache_root(cache_root) {
+  std::error_code ec;
+  std::filesystem::create_directories(cache_root, ec);
+  if (ec) {
+    log_wrn_fmt("Failed to create conversion cache %s",
+                cache_root.string().c_str());
+  }
+}
+
+uint64_t ConversionCache::getKey(const std::string& converter_type,
+                                 uint32_t converter_version,
+                                 const toml::table& options) {
+  std::string key_data = converter_type + ";";
+  key_data += std::to_string(converter_version) + ";";
+  key_data += std::to_string(CONVERSION_CACHE_VERSION) + ";";
+  serializeCanonical(toml::value(options), &key_data);
+
+  return XXH3_64bits(key_data.data(), key_data.size());
+}
+
+bool ConversionCache::hashFile(const std::filesystem::path& file_path,
+                               uint64_t* hash) {
+  std::ifstream file(file_path.c_str(), std::ifstream::binary);
+  if (!file.is_open()) return false;
+
+  XXH3_state_t* hash_state = XXH3_createState();
+  XXH3_64bits_reset(hash_state);
+
+  std::vector<char> buffer(CONVERSION_HASH_CHUNK_SIZE);
+  while (file.read(buffer.data(), buffer.size()) || file.gcount() > 0) {
+    XXH3_64bits_update(hash_state, buffer.data(), file.gcount());
+  }
+
+  *hash = XXH3_64bits_digest(hash_state);
+  XXH3_freeState(hash_state);
+  return true;
+}
+
+bool ConversionCache::load(uint64_t key, Entry* entry) {
+  auto entry_path = _getEntryPath(key);
+
+  std::ifstream entry_file(entry_path.c_str(), std::ifstream::binary);
+  if (!entry_file.is_open()) return false;
+
+  entry_file.seekg(0, std::ios::end);
+  std::streamoff file_size = entry_file.tellg();
+  entry_file.seekg(0, std::ios::beg);
+
+  uint32_t magic = 0;
+  uint32_t version = 0;
+  uint64_t payload_hash = 0;
+  const std::streamoff header_size =
+      sizeof(magic) + sizeof(version) + sizeof(payload_hash);
+
+  if (file_size >= header_size) {
+    entry_file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+    entry_file.read(reinterpret_cast<char*>(&version), sizeof(version));
+    entry_file.read(reinterpret_cast<char*>(&payload_hash),
+                    sizeof(payload_hash));
+  }
+
+  if (!entry_file || magic != CONVERSION_CACHE_MAGIC ||
+      version != CONVERSION_CACHE_VERSION) {
+    log_wrn_fmt("Ignoring invalid conversion cache entry %s",
+                entry_path.string().c_str());
+    return false;
+  }
+
+  std::vector<char> payload(file_size - header_size);
+  entry_file.read(payload.data(), payload.size());
+
+  // Catches truncated or otherwise corrupted entries
+  if (!entry_file ||
+      XXH3_64bits(payload.data(), payload.size()) != payload_hash) {
+    log_wrn_fmt("Ignoring corrupted conversion cache entry %s",
+                entry_path.string().c_str());
+    return false;
+  }
+
+  EntryReader reader{payload.data(), payload.size()};
+  uint32_t count;
+
+  if (reader.readCount(sizeof(uint32_t) + sizeof(uint64_t), &count)) {
+    entry->source_files.resize(count);
+    for (auto& source_file : entry->source_files) {
+      source_file.path = readString(&reader);
+      source_file.hash = readU64(&reader);
+    }
+  }
+
+  if (reader.readCount(sizeof(uint32_t) * 2, &count)) {
+    entry->alias_lookups.resize(count);
+    for (auto& alias_lookup : entry->alias_lookups) {
+      alias_lookup.alias = readString(&reader);
+      alias_lookup.id = readU32(&reader);
+    }
+  }
+
+  if (reader.readCount(sizeof(uint64_t), &count)) {
+    entry->assets.resize(count);
+    for (auto& asset : entry->assets) {
+      uint64_t asset_size = readU64(&reader);
+      if (reader.failed || asset_size > reader.remaining) {
+        reader.failed = true;
+        break;
+      }
+
+      asset.resize(asset_size);
+      reader.read(asset.data(), asset.size());
+    }
+  }
+
+  // Anything missing or left over means the entry has some other layout
+  if (reader.failed || reader.remaining != 0) {
+    log_wrn_fmt("Ignoring malformed conversion cache entry %s",
+                entry_path.string().c_str());
+    return false;
+  }
+
+  return true;
+}
+
+void ConversionCache::store(uint64_t key, const Entry& entry) {
+  auto entry_path = _getEntryPath(key);
+
+  std::string payload;
+
+  writeU32(&payload, entry.source_files.size());
+  for (const auto& source_file : entry.source_files) {
+    writeString(&payload, source_file.path);
+    writeU64(&payload, source_file.hash);
+  }
+
+  writeU32(&payload, entry.alias_lookups.size());
+  for (const auto& alias_lookup : entry.alias_lookups) {
+    writeString(&payload, alias_lookup.alias);
+    writeU32(&payload, alias_lookup.id);
+  }
+
+  writeU32(&payload, entry.assets.size());
+  for (const auto& asset : entry.assets) {
+    writeU64(&payload, asset.size());
+    payload.append(reinterpret_cast<const char*>(asset.data()), asset.size());
+  }
+
+  std::string header;
+  writeU32(&header, CONVERSION_CACHE_MAGIC);
+  writeU32(&header, CONVERSION_CACHE_VERSION);
+  writeU64(&header, XXH3_64bits(payload.data(), payload.size()));
+
+  // Identical manifest entries share a key, so write through a file unique
+  // to this thread and then atomically replace the old entry
+  auto temp_path = entry_path;
+  temp_path += "." +
+               std::to_string(std::hash<std::thread::id>()(
+                   std::this_thread::get_id())) +
+               ".tmp";
+
+  {
+    std::ofstream entry_file(temp_path.c_str(), std::ofstream::binary);
+    if (!entry_file.is_open()) {
+      log_wrn_fmt("Failed to write conversion cache entry %s",
+                  entry_path.string().c_str());
+      return;
+    }
+
+    entry_file.write(header.data(), header.size());
+    entry_file.write(payload.data(), payload.size());
+  }
+
+  std::error_code ec;
+  std::filesystem::rename(temp_path, entry_path, ec);
+  if (ec) {
+    log_wrn_fmt("Failed to write conversion cache entry %s",
+                entry_path.string().c_str());
+    std::filesystem::remove(temp_path, ec);
+  }
+}
+
+std::filesystem::path ConversionCache::_getEntryPath(uint64_t key) {
+  char entry_name[32];
+  snprintf(entry_name, sizeof(entry_name), "%016" PRIx64 ".bin", key);
+  return cache_root / entry_name;
+}
+
+}  // namespace converter
+}  // namespace mondradiko
@@ -0,0 +1,62 @@
+// Copyright (c) 2020-2021 the Mondradiko contributors.
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "lib/include/toml_headers.h"
+#include "types/assets/AssetTypes.h"
+
+namespace mondradiko {
+namespace converter {
+
+/**
+ * @brief On-disk cache of converted manifest assets.
+ *
+ * Each manifest entry is cached under a key derived from its converter,
+ * converter version, and manifest options. An entry is only reused when every
+ * source file it read still has the same content hash, and every alias it
+ * looked up still resolves to the same asset.
+ */
+class ConversionCache {
+ public:
+  struct SourceFile {
+    // Relative to the manifest's directory
+    std::string path;
+    uint64_t hash;
+  };
+
+  struct AliasLookup {
+    std::string alias;
+    assets::AssetId id;
+  };
+
+  struct Entry {
+    std::vector<SourceFile> source_files;
+    std::vector<AliasLookup> alias_lookups;
+
+    // Finished SerializedAsset buffers, in the order they were added
+    std::vector<std::vector<uint8_t>> assets;
+  };
+
+  explicit ConversionCache(const std::filesystem::path&);
+
+  static uint64_t getKey(const std::string&, uint32_t, const toml::table&);
+  static bool hashFile(const std::filesystem::path&, uint64_t*);
+
+  // Both of these are safe to call from worker threads
+  bool load(uint64_t, Entry*);
+  void store(uint64_t, const Entry&);
+
+ private:
+  std::filesystem::path cache_root;
+
+  std::filesystem::path _getEntryPath(uint64_t);
+};
+
+}  // namespace converter
+}  // namespace mondradiko
@@ -20,6 +20,10 @@ class ConverterInterface {
   using AssetBuilder = flatbuffers::FlatBufferBuilder;
 
   virtual AssetOffset convert(AssetBuilder*, const toml::table&) const = 0;
+
+  // Bump this whenever the converter's output changes, so that assets
+  // converted by older versions aren't reused from the conversion cache
+  virtual uint32_t getVersion() const = 0;
 };
 
 }  // namespace converter
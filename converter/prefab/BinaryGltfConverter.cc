@@ -30,7 +30,9 @@ ConverterInterface::AssetOffset BinaryGltfConverter::convert(
     log_wrn_fmt("GLTF warning: %s", warning.c_str());
   }
 
-  return _loadModel(fbb, gltf_model);
+  _addExternalFiles(gltf_model, model_path);
+
+  return _loadModel(fbb, gltf_model, asset);
 }
 
 }  // namespace converter
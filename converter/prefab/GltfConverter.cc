@@ -3,24 +3,52 @@
 
 #include "converter/prefab/GltfConverter.h"
 
+#include <algorithm>
 #include <memory>
-#include <unordered_map>
+#include <string>
 #include <vector>
 
 #include "converter/BundlerInterface.h"
+#include "converter/prefab/MeshOptimization.h"
 #include "log/log.h"
 #include "types/assets/PrefabAsset_generated.h"
+#include "xxhash.h"  // NOLINT
 
 namespace mondradiko {
 namespace converter {
 
 GltfConverter::GltfConverter(BundlerInterface *bundler) : _bundler(bundler) {}
 
-GltfConverter::AssetOffset GltfConverter::_loadModel(AssetBuilder *fbb,
-                                                     GltfModel model) const {
+void GltfConverter::_addExternalFiles(
+    GltfModel model, const std::filesystem::path &model_path) const {
+  auto add_uri = [&](const std::string &uri) {
+    // Embedded data is already covered by the model file's hash
+    if (uri.empty() || uri.rfind("data:", 0) == 0) return;
+    _bundler->addSourceFile(model_path.parent_path() / uri);
+  };
+
+  for (const auto &buffer : model.buffers) add_uri(buffer.uri);
+  for (const auto &image : model.images) add_uri(image.uri);
+}
+
+GltfConverter::AssetOffset GltfConverter::_loadModel(
+    AssetBuilder *fbb, GltfModel model, const toml::table &asset) const {
+  ModelMemo memo;
+
+  bool merge_static = false;
+  auto merge_iter = asset.find("merge_static");
+  if (merge_iter != asset.end()) {
+    merge_static = merge_iter->second.as_boolean();
+  }
+
+  auto compress_iter = asset.find("compress_textures");
+  if (compress_iter != asset.end()) {
+    memo.compress_textures = compress_iter->second.as_boolean();
+  }
+
   std::vector<uint32_t> children;
   for (const auto &scene : model.scenes) {
-    auto child_id = _loadScene(model, scene);
+    auto child_id = _loadScene(model, &memo, scene, merge_static);
     children.push_back(static_cast<uint32_t>(child_id));
   }
 
@@ -38,18 +66,23 @@ GltfConverter::AssetOffset GltfConverter::_loadModel(AssetBuilder *fbb,
   return asset_offset;
 }
 
-assets::AssetId GltfConverter::_loadScene(GltfModel model,
-                                          GltfScene scene) const {
+assets::AssetId GltfConverter::_loadScene(GltfModel model, ModelMemo *memo,
+                                          GltfScene scene,
+                                          bool merge_static) const {
   log_inf("Loading scene");
 
   flatbuffers::FlatBufferBuilder fbb;
 
   std::vector<uint32_t> children;
 
-  for (auto node_index : scene.nodes) {
-    const tinygltf::Node &node = model.nodes[node_index];
-    auto child_id = _loadNode(model, node, glm::vec3(1.0, 1.0, 1.0));
-    children.push_back(static_cast<uint32_t>(child_id));
+  if (merge_static) {
+    _mergeScene(model, memo, scene, &children);
+  } else {
+    for (auto node_index : scene.nodes) {
+      const tinygltf::Node &node = model.nodes[node_index];
+      auto child_id = _loadNode(model, memo, node, glm::vec3(1.0, 1.0, 1.0));
+      children.push_back(static_cast<uint32_t>(child_id));
+    }
   }
 
   auto children_offset = fbb.CreateVector(children);
@@ -67,7 +100,8 @@ assets::AssetId GltfConverter::_loadScene(GltfModel model,
   return prefab_id;
 }
 
-assets::AssetId GltfConverter::_loadNode(GltfModel model, GltfNode node,
+assets::AssetId GltfConverter::_loadNode(GltfModel model, ModelMemo *memo,
+                                         GltfNode node,
                                          glm::vec3 parent_scale) const {
   std::vector<uint32_t> children;
 
@@ -87,46 +121,39 @@ assets::AssetId GltfConverter::_loadNode(GltfModel model, GltfNode node,
     node_orientation = glm::make_quat(node.rotation.data());
   }
 
+  // Prefab transforms can't scale, so the parent's scale is baked into both
+  // the node's meshes and its position within the parent
+  node_translation *= parent_scale;
   node_scale *= parent_scale;
 
   // Create mesh
   if (node.mesh >= 0) {
     const auto &mesh = model.meshes[node.mesh];
 
-    for (const auto &primitive : mesh.primitives) {
+    for (size_t i = 0; i < mesh.primitives.size(); i++) {
+      const auto &primitive = mesh.primitives[i];
+
       if (primitive.material < 0) {
         log_err("Primitive has no material; skipping");
         continue;
       }
 
-      assets::AssetId mesh_id = _loadPrimitive(model, primitive, node_scale);
-
-      const tinygltf::Material &material = model.materials[primitive.material];
-      assets::AssetId material_id = _loadMaterial(model, material);
-
-      flatbuffers::FlatBufferBuilder fbb;
-
-      assets::MeshRendererPrefab mesh_renderer;
-      mesh_renderer.mutate_mesh(mesh_id);
-      mesh_renderer.mutate_material(material_id);
-
-      assets::TransformPrefab transform;
-      assets::GlmToVec3(&transform.mutable_position(),
-                        glm::vec3(0.0, 0.0, 0.0));
-      assets::GlmToQuat(&transform.mutable_orientation(),
-                        glm::quat(1.0, 0.0, 0.0, 0.0));
-
-      assets::PrefabAssetBuilder prefab(fbb);
-      prefab.add_mesh_renderer(&mesh_renderer);
-      prefab.add_transform(&transform);
-      auto prefab_offset = prefab.Finish();
+      // Nodes instancing the same mesh at the same scale share it
+      assets::AssetId mesh_id;
+      auto primitive_key = std::make_tuple(node.mesh, i, node_scale.x,
+                                           node_scale.y, node_scale.z);
+      auto primitive_iter = memo->primitives.find(primitive_key);
+      if (primitive_iter != memo->primitives.end()) {
+        mesh_id = primitive_iter->second;
+      } else {
+        mesh_id = _loadPrimitive(model, primitive, node_scale);
+        memo->primitives.emplace(primitive_key, mesh_id);
+      }
 
-      assets::SerializedAssetBuilder asset(fbb);
-      asset.add_type(assets::AssetType::PrefabAsset);
-      asset.add_prefab(prefab_offset);
-      auto asset_offset = asset.Finish();
+      assets::AssetId material_id =
+          _loadMaterial(model, memo, primitive.material);
 
-      assets::AssetId asset_id = _bundler->addAsset(&fbb, asset_offset);
+      assets::AssetId asset_id = _addMeshRenderer(mesh_id, material_id);
       children.push_back(static_cast<uint32_t>(asset_id));
     }
   }
@@ -134,7 +161,8 @@ assets::AssetId GltfConverter::_loadNode(GltfModel model, GltfNode node,
   {  // Load children
     for (auto child_index : node.children) {
       const auto &child_node = model.nodes[child_index];
-      assets::AssetId child_id = _loadNode(model, child_node, node_scale);
+      assets::AssetId child_id =
+          _loadNode(model, memo, child_node, node_scale);
       children.push_back(static_cast<uint32_t>(child_id));
     }
   }
@@ -163,6 +191,177 @@ assets::AssetId GltfConverter::_loadNode(GltfModel model, GltfNode node,
   }
 }
 
+// Keeps merged meshes well under the max lump size
+const size_t GLTF_MERGED_MESH_MAX_VERTEX_NUM = 512 * 1024;
+
+void GltfConverter::_mergeScene(GltfModel model, ModelMemo *memo,
+                                GltfScene scene,
+                                std::vector<uint32_t> *children) const {
+  StaticMerge merge;
+
+  for (const auto &animation : model.animations) {
+    for (const auto &channel : animation.channels) {
+      merge.animated_nodes.insert(channel.target_node);
+    }
+  }
+
+  NodeTransform root;
+  root.translation = glm::vec3(0.0, 0.0, 0.0);
+  root.orientation = glm::quat(1.0, 0.0, 0.0, 0.0);
+  root.scale = glm::vec3(1.0, 1.0, 1.0);
+
+  for (auto node_index : scene.nodes) {
+    _mergeNode(model, memo, node_index, root, &merge);
+  }
+
+  children->insert(children->end(), merge.dynamic_prefabs.begin(),
+                   merge.dynamic_prefabs.end());
+
+  for (auto &merged : merge.meshes) {
+    assets::AssetId mesh_id = _buildMesh(&merged.vertices, &merged.indices);
+    if (mesh_id == assets::NullAsset) continue;
+
+    // Free each mesh's buffers as soon as it's written
+    std::vector<assets::MeshCompactVertex>().swap(merged.vertices);
+    std::vector<uint32_t>().swap(merged.indices);
+
+    assets::AssetId material_id = _loadMaterial(model, memo, merged.material);
+    assets::AssetId asset_id = _addMeshRenderer(mesh_id, material_id);
+    children->push_back(static_cast<uint32_t>(asset_id));
+  }
+
+  log_inf_fmt("Merged static nodes into %zu meshes and %zu unmerged nodes",
+              merge.meshes.size(), merge.dynamic_prefabs.size());
+}
+
+void GltfConverter::_mergeNode(GltfModel model, ModelMemo *memo,
+                               int node_index, const NodeTransform &parent,
+                               StaticMerge *merge) const {
+  GltfNode node = model.nodes[node_index];
+
+  // Animated subtrees keep their hierarchy, placed where their parent is
+  if (merge->animated_nodes.find(node_index) != merge->animated_nodes.end()) {
+    assets::AssetId node_id = _loadNode(model, memo, node, parent.scale);
+
+    flatbuffers::FlatBufferBuilder fbb;
+
+    std::vector<uint32_t> children = {static_cast<uint32_t>(node_id)};
+    auto children_offset = fbb.CreateVector(children);
+
+    assets::TransformPrefab transform;
+    assets::GlmToVec3(&transform.mutable_position(), parent.translation);
+    assets::GlmToQuat(&transform.mutable_orientation(), parent.orientation);
+
+    assets::PrefabAssetBuilder prefab_asset(fbb);
+    prefab_asset.add_children(children_offset);
+    prefab_asset.add_transform(&transform);
+    auto prefab_offset = prefab_asset.Finish();
+
+    assets::SerializedAssetBuilder asset(fbb);
+    asset.add_type(assets::AssetType::PrefabAsset);
+    asset.add_prefab(prefab_offset);
+    auto asset_offset = asset.Finish();
+
+    assets::AssetId prefab_id = _bundler->addAsset(&fbb, asset_offset);
+    merge->dynamic_prefabs.push_back(static_cast<uint32_t>(prefab_id));
+    return;
+  }
+
+  glm::vec3 node_translation = glm::vec3(0.0, 0.0, 0.0);
+  glm::vec3 node_scale = glm::vec3(1.0, 1.0, 1.0);
+  glm::quat node_orientation = glm::quat(1.0, 0.0, 0.0, 0.0);
+
+  if (node.translation.size() == 3) {
+    node_translation = glm::make_vec3(node.translation.data());
+  }
+
+  if (node.scale.size() == 3) {
+    node_scale = glm::make_vec3(node.scale.data());
+  }
+
+  if (node.rotation.size() == 4) {
+    node_orientation = glm::make_quat(node.rotation.data());
+  }
+
+  NodeTransform world;
+  world.translation = parent.translation +
+                      parent.orientation * (parent.scale * node_translation);
+  world.orientation = parent.orientation * node_orientation;
+  world.scale = parent.scale * node_scale;
+
+  if (node.mesh >= 0) {
+    const auto &mesh = model.meshes[node.mesh];
+
+    glm::mat4 transform = glm::translate(glm::mat4(1.0), world.translation) *
+                          glm::mat4_cast(world.orientation) *
+                          glm::scale(glm::mat4(1.0), world.scale);
+
+    for (const auto &primitive : mesh.primitives) {
+      if (primitive.material < 0) {
+        log_err("Primitive has no material; skipping");
+        continue;
+      }
+
+      size_t vertex_num = 0;
+      auto position_iter = primitive.attributes.find("POSITION");
+      if (position_iter != primitive.attributes.end()) {
+        vertex_num = model.accessors[position_iter->second].count;
+      }
+
+      // Start another mesh for this material if the open one is full
+      MergedMesh *merged = nullptr;
+      auto open_iter = merge->open_meshes.find(primitive.material);
+      if (open_iter != merge->open_meshes.end()) {
+        merged = &merge->meshes[open_iter->second];
+        if (merged->vertices.size() + vertex_num >
+            GLTF_MERGED_MESH_MAX_VERTEX_NUM) {
+          merged = nullptr;
+        }
+      }
+
+      if (merged == nullptr) {
+        merge->open_meshes[primitive.material] = merge->meshes.size();
+        merge->meshes.emplace_back();
+        merged = &merge->meshes.back();
+        merged->material = primitive.material;
+      }
+
+      _readPrimitive(model, primitive, transform, &merged->vertices,
+                     &merged->indices);
+    }
+  }
+
+  for (auto child_index : node.children) {
+    _mergeNode(model, memo, child_index, world, merge);
+  }
+}
+
+assets::AssetId GltfConverter::_addMeshRenderer(
+    assets::AssetId mesh_id, assets::AssetId material_id) const {
+  flatbuffers::FlatBufferBuilder fbb;
+
+  assets::MeshRendererPrefab mesh_renderer;
+  mesh_renderer.mutate_mesh(mesh_id);
+  mesh_renderer.mutate_material(material_id);
+
+  assets::TransformPrefab transform;
+  assets::GlmToVec3(&transform.mutable_position(), glm::vec3(0.0, 0.0, 0.0));
+  assets::GlmToQuat(&transform.mutable_orientation(),
+                    glm::quat(1.0, 0.0, 0.0, 0.0));
+
+  assets::PrefabAssetBuilder prefab(fbb);
+  prefab.add_mesh_renderer(&mesh_renderer);
+  prefab.add_transform(&transform);
+  auto prefab_offset = prefab.Finish();
+
+  assets::SerializedAssetBuilder asset(fbb);
+  asset.add_type(assets::AssetType::PrefabAsset);
+  asset.add_prefab(prefab_offset);
+  auto asset_offset = asset.Finish();
+
+  return _bundler->addAsset(&fbb, asset_offset);
+}
+
 /**
  * @brief Helper class for reading GLTF buffers.
  *
@@ -201,37 +400,56 @@ class GltfAccessor {
 assets::AssetId GltfConverter::_loadPrimitive(GltfModel model,
                                               GltfPrimitive primitive,
                                               glm::vec3 scale) const {
-  std::vector<assets::MeshVertex> vertices;
+  std::vector<assets::MeshCompactVertex> vertices;
   std::vector<uint32_t> indices;
 
+  glm::mat4 transform = glm::scale(glm::mat4(1.0), scale);
+  if (!_readPrimitive(model, primitive, transform, &vertices, &indices)) {
+    return assets::NullAsset;
+  }
+
+  return _buildMesh(&vertices, &indices);
+}
+
+bool GltfConverter::_readPrimitive(
+    GltfModel model, GltfPrimitive primitive, const glm::mat4 &transform,
+    std::vector<assets::MeshCompactVertex> *vertices,
+    std::vector<uint32_t> *indices) const {
   if (primitive.mode != TINYGLTF_MODE_TRIANGLES) {
     log_ftl("GLTF primitive must be triangle list");
-    return assets::NullAsset;
+    return false;
   }
 
   const auto &attributes = primitive.attributes;
 
   if (attributes.find("POSITION") == primitive.attributes.end()) {
     log_err("GLTF primitive must have position attributes");
-    return assets::NullAsset;
+    return false;
   }
 
   if (attributes.find("NORMAL") == primitive.attributes.end()) {
     log_err("GLTF primitive must have normal attributes");
-    return assets::NullAsset;
+    return false;
   }
 
   if (attributes.find("TEXCOORD_0") == primitive.attributes.end()) {
     log_err("GLTF primitive must have texture coordinates");
-    return assets::NullAsset;
+    return false;
   }
 
   // TODO(marceline-cramer) Generate indices if they're not there
   if (primitive.indices <= -1) {
     log_err("GLTF primitive must have indices");
-    return assets::NullAsset;
+    return false;
   }
 
+  // Appended after anything already read
+  uint32_t base_vertex = vertices->size();
+  size_t base_index = indices->size();
+
+  glm::mat3 tangent_matrix = glm::mat3(transform);
+  glm::mat3 normal_matrix = glm::transpose(glm::inverse(tangent_matrix));
+
   {  // Load vertices
     GltfAccessor pos_accessor(model, attributes.find("POSITION")->second);
     GltfAccessor norm_accessor(model, attributes.find("NORMAL")->second);
@@ -243,47 +461,46 @@ assets::AssetId GltfConverter::_loadPrimitive(GltfModel model,
           model, attributes.find("TANGENT")->second);
     }
 
-    assets::Vec3 tangent_vec;
-    assets::GlmToVec3(&tangent_vec, glm::vec3(0.0, 1.0, 0.0));
+    uint32_t packed_tangent = assets::PackOctahedral(glm::vec3(0.0, 1.0, 0.0));
+
+    // TODO(marceline-cramer) Read mesh vertex colors
+    uint32_t packed_color = glm::packUnorm4x8(glm::vec4(1.0, 1.0, 1.0, 1.0));
 
     for (size_t v = 0; v < pos_accessor.size(); v++) {
       const float *position_raw = pos_accessor.get<float>(v);
       const float *normal_raw = norm_accessor.get<float>(v);
       const float *tex_coord = tex_accessor.get<float>(v);
 
-      // Scale the position
-      glm::vec3 position =
-          glm::vec3(position_raw[0], position_raw[1], position_raw[2]) * scale;
+      // Transform the position
+      glm::vec3 position = glm::vec3(
+          transform * glm::vec4(position_raw[0], position_raw[1],
+                                position_raw[2], 1.0));
 
-      // Normalize the normal
+      // Transform and normalize the normal
       glm::vec3 normal = glm::normalize(
+          normal_matrix *
           glm::vec3(normal_raw[0], normal_raw[1], normal_raw[2]));
 
       if (tan_accessor) {
         const float *tangent_raw = tan_accessor->get<float>(v);
 
-        // Normalize the tangent
+        // Transform and normalize the tangent
         glm::vec3 tangent = glm::normalize(
+            tangent_matrix *
             glm::vec3(tangent_raw[0], tangent_raw[1], tangent_raw[2]));
-        assets::GlmToVec3(&tangent_vec, tangent);
+        packed_tangent = assets::PackOctahedral(tangent);
       }
 
-      assets::Vec3 position_vec;
-      assets::GlmToVec3(&position_vec, position);
-
-      assets::Vec3 normal_vec;
-      assets::GlmToVec3(&normal_vec, normal);
-
-      // TODO(marceline-cramer) Read mesh vertex colors
-      assets::Vec3 color_vec;
-      assets::Vec2 tex_coord_vec;
-
-      assets::GlmToVec3(&color_vec, glm::vec3(1.0, 1.0, 1.0));
-      assets::GlmToVec2(&tex_coord_vec, glm::vec2(tex_coord[0], tex_coord[1]));
-
-      assets::MeshVertex vertex(position_vec, normal_vec, tangent_vec,
-                                color_vec, tex_coord_vec);
-      vertices.push_back(vertex);
+      assets::MeshCompactVertex vertex;
+      vertex.mutable_position()->Mutate(0, position.x);
+      vertex.mutable_position()->Mutate(1, position.y);
+      vertex.mutable_position()->Mutate(2, position.z);
+      vertex.mutate_normal(assets::PackOctahedral(normal));
+      vertex.mutate_tangent(packed_tangent);
+      vertex.mutate_color(packed_color);
+      vertex.mutate_tex_coord(
+          glm::packHalf2x16(glm::vec2(tex_coord[0], tex_coord[1])));
+      vertices->push_back(vertex);
     }
   }
 
@@ -301,21 +518,21 @@ assets::AssetId GltfConverter::_loadPrimitive(GltfModel model,
       case TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT: {
         const uint32_t *buf = static_cast<const uint32_t *>(dataPtr);
         for (size_t index = 0; index < accessor.count; index++) {
-          indices.push_back(buf[index]);
+          indices->push_back(base_vertex + buf[index]);
         }
         break;
       }
       case TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT: {
         const uint16_t *buf = static_cast<const uint16_t *>(dataPtr);
         for (size_t index = 0; index < accessor.count; index++) {
-          indices.push_back(buf[index]);
+          indices->push_back(base_vertex + buf[index]);
         }
         break;
       }
       case TINYGLTF_PARAMETER_TYPE_UNSIGNED_BYTE: {
         const uint8_t *buf = static_cast<const uint8_t *>(dataPtr);
         for (size_t index = 0; index < accessor.count; index++) {
-          indices.push_back(buf[index]);
+          indices->push_back(base_vertex + buf[index]);
         }
         break;
       }
@@ -326,15 +543,64 @@ assets::AssetId GltfConverter::_loadPrimitive(GltfModel model,
     }
   }
 
+  // Mirroring transforms flip the winding order, so flip it back
+  if (glm::determinant(tangent_matrix) < 0.0f) {
+    for (size_t i = base_index; i + 2 < indices->size(); i += 3) {
+      std::swap((*indices)[i + 1], (*indices)[i + 2]);
+    }
+  }
+
+  return true;
+}
+
+assets::AssetId GltfConverter::_buildMesh(
+    std::vector<assets::MeshCompactVertex> *vertices,
+    std::vector<uint32_t> *indices) const {
+  {  // Optimize for rendering
+    MeshOptimizationReport report;
+    if (!optimizeMesh(vertices, indices, &report)) {
+      log_err("Failed to optimize GLTF primitive");
+      return assets::NullAsset;
+    }
+
+    log_inf_fmt("Optimized mesh: %zu -> %zu vertices, ACMR %.3f -> %.3f",
+                report.vertex_num_before, report.vertex_num_after,
+                report.acmr_before, report.acmr_after);
+  }
+
+  std::vector<assets::MeshLod> lods;
+
+  {  // Generate levels of detail
+    generateMeshLods(*vertices, indices, &lods);
+
+    for (size_t i = 1; i < lods.size(); i++) {
+      log_dbg_fmt("Mesh LOD %zu: %u triangles, error %f", i,
+                  lods[i].index_num() / 3, lods[i].error());
+    }
+  }
+
   {  // Write primitive data
     flatbuffers::FlatBufferBuilder fbb;
 
-    auto vertices_offset = fbb.CreateVectorOfStructs(vertices);
-    auto indices_offset = fbb.CreateVector(indices);
+    auto vertices_offset = fbb.CreateVectorOfStructs(*vertices);
+    auto lods_offset = fbb.CreateVectorOfStructs(lods);
+
+    // Halve index memory and bandwidth for meshes that fit 16-bit indices
+    flatbuffers::Offset<flatbuffers::Vector<uint32_t>> indices_offset;
+    flatbuffers::Offset<flatbuffers::Vector<uint16_t>> short_indices_offset;
+
+    if (vertices->size() <= UINT16_MAX + 1) {
+      std::vector<uint16_t> short_indices(indices->begin(), indices->end());
+      short_indices_offset = fbb.CreateVector(short_indices);
+    } else {
+      indices_offset = fbb.CreateVector(*indices);
+    }
 
     assets::MeshAssetBuilder mesh_asset(fbb);
-    mesh_asset.add_vertices(vertices_offset);
+    mesh_asset.add_compact_vertices(vertices_offset);
     mesh_asset.add_indices(indices_offset);
+    mesh_asset.add_short_indices(short_indices_offset);
+    mesh_asset.add_lods(lods_offset);
     auto mesh_offset = mesh_asset.Finish();
 
     assets::SerializedAssetBuilder asset(fbb);
@@ -374,8 +640,13 @@ void loadVector(assets::Vec4 *dst, const std::vector<double> &src,
   }
 }
 
-assets::AssetId GltfConverter::_loadMaterial(GltfModel model,
-                                             GltfMaterial material) const {
+assets::AssetId GltfConverter::_loadMaterial(GltfModel model, ModelMemo *memo,
+                                             int material_index) const {
+  auto memo_iter = memo->materials.find(material_index);
+  if (memo_iter != memo->materials.end()) return memo_iter->second;
+
+  GltfMaterial material = model.materials[material_index];
+
   flatbuffers::FlatBufferBuilder fbb;
 
   assets::MaterialAssetBuilder material_builder(fbb);
@@ -410,7 +681,8 @@ assets::AssetId GltfConverter::_loadMaterial(GltfModel model,
     material_builder.add_emissive_factor(&emissive_factor);
 
     assets::AssetId emissive_texture =
-        _loadTexture(model, base.emissiveTexture, false);
+        _loadTexture(model, memo, base.emissiveTexture.index,
+                     TextureRole::Emissive);
     material_builder.add_emissive_texture(emissive_texture);
 
     material_builder.add_normal_map_scale(base.normalTexture.scale);
@@ -419,8 +691,8 @@ assets::AssetId GltfConverter::_loadMaterial(GltfModel model,
     if (base.normalTexture.index >= 0) {
       const auto &normal_texture = model.textures[base.normalTexture.index];
       if (normal_texture.source >= 0) {
-        const auto &normal_image = model.images[normal_texture.source];
-        normal_map_texture = _loadImage(normal_image, false);
+        normal_map_texture = _loadImage(model, memo, normal_texture.source,
+                                        TextureRole::Normal);
       }
     }
     material_builder.add_normal_map_texture(normal_map_texture);
@@ -435,14 +707,16 @@ assets::AssetId GltfConverter::_loadMaterial(GltfModel model,
     material_builder.add_albedo_factor(&albedo_factor);
 
     assets::AssetId albedo_texture =
-        _loadTexture(model, pbr.baseColorTexture, true);
+        _loadTexture(model, memo, pbr.baseColorTexture.index,
+                     TextureRole::Albedo);
     material_builder.add_albedo_texture(albedo_texture);
 
     material_builder.add_metallic_factor(pbr.metallicFactor);
     material_builder.add_roughness_factor(pbr.roughnessFactor);
 
     assets::AssetId metal_roughness_texture =
-        _loadTexture(model, pbr.metallicRoughnessTexture, false);
+        _loadTexture(model, memo, pbr.metallicRoughnessTexture.index,
+                     TextureRole::MetalRoughness);
     material_builder.add_metal_roughness_texture(metal_roughness_texture);
   }
 
@@ -454,33 +728,98 @@ assets::AssetId GltfConverter::_loadMaterial(GltfModel model,
   auto asset_offset = asset_builder.Finish();
 
   assets::AssetId asset_id = _bundler->addAsset(&fbb, asset_offset);
+  memo->materials.emplace(material_index, asset_id);
   return asset_id;
 }
 
-assets::AssetId GltfConverter::_loadTexture(GltfModel model,
-                                            GltfTextureInfo texture_info,
-                                            bool srgb) const {
-  if (texture_info.index < 0) {
+assets::AssetId GltfConverter::_loadTexture(GltfModel model, ModelMemo *memo,
+                                            int texture_index,
+                                            TextureRole role) const {
+  if (texture_index < 0) {
     log_err("Attempting to load null texture info");
     return assets::NullAsset;
   }
 
-  const auto &texture = model.textures[texture_info.index];
+  const auto &texture = model.textures[texture_index];
 
   if (texture.source < 0) {
     log_err("Attempting to load null texture source");
     return assets::NullAsset;
   }
 
-  const auto &image = model.images[texture.source];
-
   // TODO(marceline-cramer) Add sampler support
 
-  return _loadImage(image, srgb);
+  return _loadImage(model, memo, texture.source, role);
 }
 
-assets::AssetId GltfConverter::_loadImage(GltfImage image, bool srgb) const {
-  flatbuffers::FlatBufferBuilder fbb;
+// Expands 8- or 16-bit images with 1-4 components to RGBA8
+static bool convertToRgba8(const tinygltf::Image &image,
+                           std::vector<uint8_t> *texels) {
+  if (image.component < 1 || image.component > 4) return false;
+
+  uint32_t component_size;
+  if (image.bits == 8 &&
+      image.pixel_type == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE) {
+    component_size = 1;
+  } else if (image.bits == 16 &&
+             image.pixel_type == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT) {
+    component_size = 2;
+  } else {
+    return false;
+  }
+
+  size_t texel_num = static_cast<size_t>(image.width) * image.height;
+  if (image.image.size() < texel_num * image.component * component_size) {
+    return false;
+  }
+
+  texels->resize(texel_num * 4);
+
+  for (size_t i = 0; i < texel_num; i++) {
+    uint8_t components[4] = {0, 0, 0, 255};
+
+    for (int c = 0; c < image.component; c++) {
+      size_t offset = ((i * image.component) + c) * component_size;
+
+      // 16-bit components are little-endian, so keep the high byte
+      components[c] = image.image[offset + component_size - 1];
+    }
+
+    // Grayscale images replicate their value across RGB
+    if (image.component <= 2) {
+      components[3] = image.component == 2 ? components[1] : 255;
+      components[1] = components[0];
+      components[2] = components[0];
+    }
+
+    std::copy(components, components + 4, &(*texels)[i * 4]);
+  }
+
+  return true;
+}
+
+// Keeps memory bounded when bundling many large textures
+const size_t GLTF_IMAGE_CACHE_MAX_SIZE = 256 * 1024 * 1024;  // 256 MiB
+
+static uint64_t hashImage(const tinygltf::Image &image, TextureRole role,
+                          assets::TextureFormat format) {
+  int header[] = {image.width,      image.height,
+                  image.component,  image.bits,
+                  image.pixel_type, static_cast<int>(role),
+                  static_cast<int>(format)};
+
+  uint64_t seed = XXH3_64bits(header, sizeof(header));
+  return XXH3_64bits_withSeed(image.image.data(), image.image.size(), seed);
+}
+
+assets::AssetId GltfConverter::_loadImage(GltfModel model, ModelMemo *memo,
+                                          int image_index,
+                                          TextureRole role) const {
+  auto memo_key = std::make_pair(image_index, role);
+  auto memo_iter = memo->images.find(memo_key);
+  if (memo_iter != memo->images.end()) return memo_iter->second;
+
+  GltfImage image = model.images[image_index];
 
   log_inf("Loading GLTF image");
   log_inf_fmt("Name:\t\t\"%s\"", image.name.c_str());
@@ -488,40 +827,31 @@ assets::AssetId GltfConverter::_loadImage(GltfImage image, bool srgb) const {
   log_inf_fmt("Bits/channel:\t%d", image.bits);
   log_inf_fmt("Size:\t\t%dx%d", image.width, image.height);
 
-  auto data_offset =
-      fbb.CreateVector(reinterpret_cast<const uint8_t *>(image.image.data()),
-                       image.image.size());
+  // Uncompressed textures load on GPUs without BC support
+  assets::TextureFormat format = assets::TextureFormat::Raw;
+  if (memo->compress_textures) format = getTextureFormat(role);
 
-  assets::TextureAssetBuilder texture(fbb);
+  auto compressed = _compressImage(image, role, format);
 
-  texture.add_components(image.component);
-  texture.add_bit_depth(image.bits);
+  flatbuffers::FlatBufferBuilder fbb;
 
-  {
-    using Components = assets::TextureComponentType;
-    std::unordered_map<int, assets::TextureComponentType> types;
-    types.emplace(TINYGLTF_COMPONENT_TYPE_BYTE, Components::Byte);
-    types.emplace(TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE, Components::UByte);
-    types.emplace(TINYGLTF_COMPONENT_TYPE_SHORT, Components::Short);
-    types.emplace(TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT, Components::UShort);
-    types.emplace(TINYGLTF_COMPONENT_TYPE_INT, Components::Int);
-    types.emplace(TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT, Components::UInt);
-    types.emplace(TINYGLTF_COMPONENT_TYPE_FLOAT, Components::Float);
-    types.emplace(TINYGLTF_COMPONENT_TYPE_DOUBLE, Components::Double);
-
-    auto iter = types.find(image.pixel_type);
-
-    if (iter == types.end()) {
-      log_ftl_fmt("Unrecognized GLTF image component type %d", image.component);
-    }
+  auto data_offset = fbb.CreateVector(compressed->data);
+  auto mip_levels_offset = fbb.CreateVectorOfStructs(compressed->mip_levels);
 
-    texture.add_component_type(iter->second);
-  }
+  assets::TextureAssetBuilder texture(fbb);
+
+  // Block-compressed textures are decoded to normalized RGBA, and raw ones
+  // are always converted to RGBA8
+  texture.add_components(4);
+  texture.add_bit_depth(8);
+  texture.add_component_type(assets::TextureComponentType::UByte);
 
   texture.add_width(image.width);
   texture.add_height(image.height);
-  texture.add_srgb(srgb);
+  texture.add_srgb(isSrgbTexture(role));
   texture.add_data(data_offset);
+  texture.add_format(compressed->format);
+  texture.add_mip_levels(mip_levels_offset);
   auto texture_offset = texture.Finish();
 
   assets::SerializedAssetBuilder asset(fbb);
@@ -531,8 +861,66 @@ assets::AssetId GltfConverter::_loadImage(GltfImage image, bool srgb) const {
 
   assets::AssetId asset_id = _bundler->addAsset(&fbb, asset_offset);
   log_dbg_fmt("Added GLTF image: 0x%0dx", asset_id);
+
+  memo->images.emplace(memo_key, asset_id);
   return asset_id;
 }
 
+std::shared_ptr<const GltfConverter::CompressedImage>
+GltfConverter::_compressImage(GltfImage image, TextureRole role,
+                              assets::TextureFormat format) const {
+  log_zone;
+
+  // Models often share textures, so reuse their pixels' last conversion
+  uint64_t image_hash = hashImage(image, role, format);
+
+  {
+    std::unique_lock<std::mutex> lock(image_cache_mutex);
+    auto iter = image_cache.find(image_hash);
+    if (iter != image_cache.end()) {
+      log_dbg("Reusing compressed GLTF image");
+      return iter->second;
+    }
+  }
+
+  if (image.width <= 0 || image.height <= 0) {
+    log_ftl_fmt("Invalid GLTF image size %dx%d", image.width, image.height);
+  }
+
+  std::vector<uint8_t> texels;
+  if (!convertToRgba8(image, &texels)) {
+    log_ftl_fmt("Unsupported GLTF image format (%d components, %d bits)",
+                image.component, image.bits);
+  }
+
+  auto compressed = std::make_shared<CompressedImage>();
+  compressed->format = format;
+
+  auto levels =
+      generateMipChain(std::move(texels), image.width, image.height, role);
+
+  for (auto &level : levels) {
+    compressTextureLevel(&level, compressed->format);
+    compressed->mip_levels.emplace_back(compressed->data.size(),
+                                        level.data.size());
+    compressed->data.insert(compressed->data.end(), level.data.begin(),
+                            level.data.end());
+  }
+
+  log_inf_fmt("Converted %zu mip levels to %zu bytes", levels.size(),
+              compressed->data.size());
+
+  {
+    std::unique_lock<std::mutex> lock(image_cache_mutex);
+    size_t new_size = image_cache_size + compressed->data.size();
+    if (new_size <= GLTF_IMAGE_CACHE_MAX_SIZE &&
+        image_cache.emplace(image_hash, compressed).second) {
+      image_cache_size = new_size;
+    }
+  }
+
+  return compressed;
+}
+
 }  // namespace converter
 }  // namespace mondradiko
@@ -3,8 +3,20 @@
 
 #pragma once
 
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
 #include "converter/ConverterInterface.h"
+#include "converter/texture/TextureCompression.h"
 #include "lib/include/tinygltf_headers.h"
+#include "types/assets/MeshAsset_generated.h"
 
 namespace mondradiko {
 namespace converter {
@@ -16,6 +28,9 @@ class GltfConverter : public ConverterInterface {
  public:
   explicit GltfConverter(BundlerInterface*);
 
+  // ConverterInterface implementation
+  uint32_t getVersion() const final { return 9; }
+
  protected:
   BundlerInterface* _bundler;
 
@@ -25,16 +40,82 @@ class GltfConverter : public ConverterInterface {
   using GltfNode = const tinygltf::Node&;
   using GltfPrimitive = const tinygltf::Primitive&;
   using GltfMaterial = const tinygltf::Material&;
-  using GltfTextureInfo = const tinygltf::TextureInfo&;
   using GltfImage = const tinygltf::Image&;
 
-  AssetOffset _loadModel(AssetBuilder*, GltfModel) const;
-  assets::AssetId _loadScene(GltfModel, GltfScene) const;
-  assets::AssetId _loadNode(GltfModel, GltfNode, glm::vec3) const;
+  // Assets already converted from the model being converted, by glTF index
+  struct ModelMemo {
+    std::map<std::pair<int, TextureRole>, assets::AssetId> images;
+    std::map<int, assets::AssetId> materials;
+
+    // Meshes are keyed by mesh, primitive, and the scale baked into them
+    std::map<std::tuple<int, size_t, float, float, float>, assets::AssetId>
+        primitives;
+
+    // From the asset's compress_textures option
+    bool compress_textures = true;
+  };
+
+  // Where a node is in its scene, composed the same way as by _loadNode()
+  struct NodeTransform {
+    glm::vec3 translation;
+    glm::quat orientation;
+    glm::vec3 scale;
+  };
+
+  // Static primitives baked into one mesh per material, for merge_static
+  struct MergedMesh {
+    int material;
+    std::vector<assets::MeshCompactVertex> vertices;
+    std::vector<uint32_t> indices;
+  };
+
+  struct StaticMerge {
+    // Animated nodes and their descendants aren't merged
+    std::set<int> animated_nodes;
+
+    // The mesh currently being filled for each material
+    std::map<int, size_t> open_meshes;
+    std::vector<MergedMesh> meshes;
+
+    // Prefabs of the unmerged subtrees
+    std::vector<uint32_t> dynamic_prefabs;
+  };
+
+  // A converted image, shared by every model that uses the same pixels
+  struct CompressedImage {
+    assets::TextureFormat format;
+    std::vector<uint8_t> data;
+    std::vector<assets::TextureMipLevel> mip_levels;
+  };
+
+  // Converters are shared by conversion threads, so this is locked
+  mutable std::mutex image_cache_mutex;
+  mutable std::unordered_map<uint64_t, std::shared_ptr<const CompressedImage>>
+      image_cache;
+  mutable size_t image_cache_size = 0;
+
+  // Records externally referenced buffers and images as source files
+  void _addExternalFiles(GltfModel, const std::filesystem::path&) const;
+
+  AssetOffset _loadModel(AssetBuilder*, GltfModel, const toml::table&) const;
+  assets::AssetId _loadScene(GltfModel, ModelMemo*, GltfScene, bool) const;
+  assets::AssetId _loadNode(GltfModel, ModelMemo*, GltfNode, glm::vec3) const;
+  void _mergeScene(GltfModel, ModelMemo*, GltfScene,
+                   std::vector<uint32_t>*) const;
+  void _mergeNode(GltfModel, ModelMemo*, int, const NodeTransform&,
+                  StaticMerge*) const;
   assets::AssetId _loadPrimitive(GltfModel, GltfPrimitive, glm::vec3) const;
-  assets::AssetId _loadMaterial(GltfModel, GltfMaterial) const;
-  assets::AssetId _loadTexture(GltfModel, GltfTextureInfo, bool) const;
-  assets::AssetId _loadImage(GltfImage, bool) const;
+  bool _readPrimitive(GltfModel, GltfPrimitive, const glm::mat4&,
+                      std::vector<assets::MeshCompactVertex>*,
+                      std::vector<uint32_t>*) const;
+  assets::AssetId _buildMesh(std::vector<assets::MeshCompactVertex>*,
+                             std::vector<uint32_t>*) const;
+  assets::AssetId _addMeshRenderer(assets::AssetId, assets::AssetId) const;
+  assets::AssetId _loadMaterial(GltfModel, ModelMemo*, int) const;
+  assets::AssetId _loadTexture(GltfModel, ModelMemo*, int, TextureRole) const;
+  assets::AssetId _loadImage(GltfModel, ModelMemo*, int, TextureRole) const;
+  std::shared_ptr<const CompressedImage> _compressImage(
+      GltfImage, TextureRole, assets::TextureFormat) const;
 };
 
 }  // namespace converter
@@ -0,0 +1,158 @@
+// Copyright (c) 2020-2021 the Mondradiko contributors.
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include "converter/prefab/MeshOptimization.h"
+
+#include "lib/include/meshoptimizer_headers.h"
+#include "log/log.h"
+
+namespace mondradiko {
+namespace converter {
+
+const size_t MESH_VERTEX_CACHE_SIZE = 16;
+
+// Allow slightly worse vertex cache efficiency for less overdraw
+const float MESH_OVERDRAW_THRESHOLD = 1.05f;
+
+// Including the full mesh
+const size_t MESH_LOD_MAX_NUM = 5;
+
+// Don't bother simplifying meshes that are already this small
+const size_t MESH_LOD_MIN_INDEX_NUM = 384;
+
+// Each LOD aims for half of the previous one's triangles, but is discarded
+// if it can't remove at least a fifth of them
+const float MESH_LOD_REDUCTION = 0.5f;
+const float MESH_LOD_MIN_REDUCTION = 0.8f;
+
+// Relative to the mesh's extents
+const float MESH_LOD_MAX_ERROR = 0.1f;
+
+// Positions are the first member of MeshCompactVertex
+static const float* getPositions(
+    const std::vector<assets::MeshCompactVertex>& vertices) {
+  return vertices.data()->position()->data();
+}
+
+const size_t MESH_POSITION_STRIDE = sizeof(assets::MeshCompactVertex);
+
+bool optimizeMesh(std::vector<assets::MeshCompactVertex>* vertices,
+                  std::vector<uint32_t>* indices,
+                  MeshOptimizationReport* report) {
+  log_zone;
+
+  size_t vertex_num = vertices->size();
+  size_t index_num = indices->size();
+
+  for (auto index : *indices) {
+    if (index >= vertex_num) {
+      log_err_fmt("Mesh index %u is out of range of %zu vertices", index,
+                  vertex_num);
+      return false;
+    }
+  }
+
+  report->vertex_num_before = vertex_num;
+  report->acmr_before = getMeshAcmr(*indices, vertex_num);
+
+  if (index_num == 0 || vertex_num == 0) {
+    report->vertex_num_after = vertex_num;
+    report->acmr_after = report->acmr_before;
+    return true;
+  }
+
+  {  // Weld identical vertices
+    std::vector<uint32_t> remap(vertex_num);
+    size_t unique_num = meshopt_generateVertexRemap(
+        remap.data(), indices->data(), index_num, vertices->data(),
+        vertex_num, sizeof(assets::MeshCompactVertex));
+
+    std::vector<assets::MeshCompactVertex> welded(unique_num);
+    meshopt_remapVertexBuffer(welded.data(), vertices->data(), vertex_num,
+                              sizeof(assets::MeshCompactVertex), remap.data());
+    meshopt_remapIndexBuffer(indices->data(), indices->data(), index_num,
+                             remap.data());
+
+    *vertices = std::move(welded);
+    vertex_num = unique_num;
+  }
+
+  meshopt_optimizeVertexCache(indices->data(), indices->data(), index_num,
+                              vertex_num);
+
+  meshopt_optimizeOverdraw(indices->data(), indices->data(), index_num,
+                           getPositions(*vertices), vertex_num,
+                           MESH_POSITION_STRIDE,
+                           MESH_OVERDRAW_THRESHOLD);
+
+  // Drops any vertices that no triangle refers to
+  vertex_num = meshopt_optimizeVertexFetch(
+      vertices->data(), indices->data(), index_num, vertices->data(),
+      vertex_num, sizeof(assets::MeshCompactVertex));
+  vertices->resize(vertex_num);
+
+  report->vertex_num_after = vertex_num;
+  report->acmr_after = getMeshAcmr(*indices, vertex_num);
+  return true;
+}
+
+void generateMeshLods(const std::vector<assets::MeshCompactVertex>& vertices,
+                      std::vector<uint32_t>* indices,
+                      std::vector<assets::MeshLod>* lods) {
+  log_zone;
+
+  size_t vertex_num = vertices.size();
+  size_t base_index_num = indices->size();
+
+  lods->clear();
+  lods->emplace_back(0, base_index_num, 0.0f);
+
+  if (vertex_num == 0 || base_index_num < MESH_LOD_MIN_INDEX_NUM) return;
+
+  const float* positions = getPositions(vertices);
+  float mesh_scale = meshopt_simplifyScale(positions, vertex_num,
+                                           MESH_POSITION_STRIDE);
+
+  std::vector<uint32_t> lod_indices(base_index_num);
+  size_t previous_index_num = base_index_num;
+
+  while (lods->size() < MESH_LOD_MAX_NUM) {
+    size_t target_index_num =
+        static_cast<size_t>(previous_index_num * MESH_LOD_REDUCTION) / 3 * 3;
+    if (target_index_num < MESH_LOD_MIN_INDEX_NUM / 2) break;
+
+    // Always simplify the full mesh, so that errors don't accumulate
+    float lod_error = 0.0f;
+    size_t lod_index_num = meshopt_simplify(
+        lod_indices.data(), indices->data(), base_index_num,
+        positions, vertex_num, MESH_POSITION_STRIDE, target_index_num,
+        MESH_LOD_MAX_ERROR, 0, &lod_error);
+
+    if (lod_index_num == 0 ||
+        lod_index_num > previous_index_num * MESH_LOD_MIN_REDUCTION) {
+      break;
+    }
+
+    meshopt_optimizeVertexCache(lod_indices.data(), lod_indices.data(),
+                                lod_index_num, vertex_num);
+
+    lods->emplace_back(indices->size(), lod_index_num,
+                       lod_error * mesh_scale);
+    indices->insert(indices->end(), lod_indices.begin(),
+                    lod_indices.begin() + lod_index_num);
+
+    previous_index_num = lod_index_num;
+  }
+}
+
+float getMeshAcmr(const std::vector<uint32_t>& indices, size_t vertex_num) {
+  if (indices.size() < 3) return 0.0f;
+
+  auto stats = meshopt_analyzeVertexCache(indices.data(), indices.size(),
+                                          vertex_num, MESH_VERTEX_CACHE_SIZE,
+                                          0, 0);
+  return stats.acmr;
+}
+
+}  // namespace converter
+}  // namespace mondradiko
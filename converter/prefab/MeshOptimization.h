@@ -0,0 +1,50 @@
+// Copyright (c) 2020-2021 the Mondradiko contributors.
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "types/assets/MeshAsset_generated.h"
+
+namespace mondradiko {
+namespace converter {
+
+struct MeshOptimizationReport {
+  size_t vertex_num_before;
+  size_t vertex_num_after;
+
+  // Average cache miss ratio: vertex shader invocations per triangle
+  float acmr_before;
+  float acmr_after;
+};
+
+/**
+ * @brief Optimizes a triangle list for rendering, in place.
+ *
+ * Welds binary-identical vertices, reorders triangles for the post-transform
+ * vertex cache and then for overdraw, and finally reorders vertices in the
+ * order they're first fetched. The result renders identically.
+ *
+ * Returns false (leaving the mesh untouched) if an index is out of range.
+ */
+bool optimizeMesh(std::vector<assets::MeshCompactVertex>*,
+                  std::vector<uint32_t>*, MeshOptimizationReport*);
+
+/**
+ * @brief Generates progressively simplified levels of detail for a mesh.
+ *
+ * LODs are simplified with quadric edge collapse and share the mesh's
+ * vertices. Their indices are appended to the index buffer, and the first
+ * LOD is always the full mesh. Call after optimizeMesh().
+ */
+void generateMeshLods(const std::vector<assets::MeshCompactVertex>&,
+                      std::vector<uint32_t>*, std::vector<assets::MeshLod>*);
+
+// Simulates a typical 16-entry post-transform vertex cache
+float getMeshAcmr(const std::vector<uint32_t>&, size_t);
+
+}  // namespace converter
+}  // namespace mondradiko
@@ -18,6 +18,7 @@ class PrefabBuilder : public ConverterInterface {
 
   // ConverterInterface implementation
   AssetOffset convert(AssetBuilder*, const toml::table&) const final;
+  uint32_t getVersion() const final { return 1; }
 
  private:
   BundlerInterface* bundler;
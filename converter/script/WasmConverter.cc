@@ -4,14 +4,48 @@
 #include "converter/script/WasmConverter.h"
 
 #include <fstream>
-#include <vector>
+#include <string>
 
 #include "converter/BundlerInterface.h"
 #include "log/log.h"
+#include "types/assets/ScriptEngine.h"
 
 namespace mondradiko {
 namespace converter {
 
+// Logs and frees a wasmtime error, returning true if there was one
+static bool handleError(wasmtime_error_t* error) {
+  if (error == nullptr) return false;
+
+  wasm_byte_vec_t error_message;
+  wasmtime_error_message(error, &error_message);
+  wasmtime_error_delete(error);
+
+  std::string error_string(error_message.data, error_message.size);
+  wasm_byte_vec_delete(&error_message);
+  log_err_fmt("Wasmtime error thrown: %s", error_string.c_str());
+  return true;
+}
+
+WasmConverter::WasmConverter(BundlerInterface* bundler,
+                             assets::ScriptType script_type)
+    : _bundler(bundler), _script_type(script_type) {
+  wasm_config_t* config = assets::createScriptEngineConfig();
+  if (config == nullptr) {
+    log_ftl("Failed to create Wasm config");
+  }
+
+  // Frees the config
+  _engine = wasm_engine_new_with_config(config);
+  if (_engine == nullptr) {
+    log_ftl("Failed to create Wasm engine");
+  }
+}
+
+WasmConverter::~WasmConverter() {
+  if (_engine) wasm_engine_delete(_engine);
+}
+
 WasmConverter::AssetOffset WasmConverter::convert(
     AssetBuilder* fbb, const toml::table& asset) const {
   auto wasm_path = _bundler->getAssetPath(asset);
@@ -19,7 +53,7 @@ WasmConverter::AssetOffset WasmConverter::convert(
   std::ifstream script_file(wasm_path, std::ifstream::binary);
 
   if (!script_file) {
-    log_ftl_fmt("Failed to open %s", wasm_path.c_str());
+    log_ftl_fmt("Failed to open %s", wasm_path.string().c_str());
   }
 
   script_file.seekg(0, std::ios::end);
@@ -30,11 +64,27 @@ WasmConverter::AssetOffset WasmConverter::convert(
   script_file.read(reinterpret_cast<char*>(script_data.data()), length);
   script_file.close();
 
+  std::vector<uint8_t> precompiled;
+  if (!_precompile(script_data, &precompiled)) {
+    log_ftl_fmt("Failed to compile %s", wasm_path.string().c_str());
+  }
+
   auto data_offset = fbb->CreateVector(script_data);
 
+  flatbuffers::Offset<flatbuffers::Vector<uint8_t>> precompiled_offset;
+  flatbuffers::Offset<flatbuffers::String> engine_offset;
+  if (precompiled.size() > 0) {
+    precompiled_offset = fbb->CreateVector(precompiled);
+    engine_offset = fbb->CreateString(assets::getScriptEngineKey());
+  }
+
   assets::ScriptAssetBuilder script_asset(*fbb);
   script_asset.add_type(_script_type);
   script_asset.add_data(data_offset);
+  if (precompiled.size() > 0) {
+    script_asset.add_precompiled(precompiled_offset);
+    script_asset.add_precompiled_engine(engine_offset);
+  }
   auto script_offset = script_asset.Finish();
 
   assets::SerializedAssetBuilder serialized_asset(*fbb);
@@ -45,5 +95,51 @@ WasmConverter::AssetOffset WasmConverter::convert(
   return asset_offset;
 }
 
+bool WasmConverter::_precompile(const std::vector<uint8_t>& script_data,
+                                std::vector<uint8_t>* precompiled) const {
+  log_zone;
+
+  wasm_byte_vec_t script_vec;
+  wasm_byte_vec_new(&script_vec, script_data.size(),
+                    reinterpret_cast<const char*>(script_data.data()));
+
+  wasm_byte_vec_t binary_vec;
+  if (_script_type == assets::ScriptType::WasmText) {
+    wasmtime_error_t* wat_error = wasmtime_wat2wasm(&script_vec, &binary_vec);
+    wasm_byte_vec_delete(&script_vec);
+    if (handleError(wat_error)) {
+      log_err("Failed to translate Wasm text to binary");
+      return false;
+    }
+  } else {
+    binary_vec = script_vec;
+  }
+
+  // Compiling also validates the module, so that broken scripts are caught
+  // at bundle time instead of at runtime
+  wasm_module_t* module = nullptr;
+  wasmtime_error_t* module_error =
+      wasmtime_module_new(_engine, &binary_vec, &module);
+  wasm_byte_vec_delete(&binary_vec);
+  if (handleError(module_error)) {
+    log_err("Failed to compile Wasm module");
+    return false;
+  }
+
+  // The bytecode is still usable without native code, so only warn here
+  wasm_byte_vec_t serialized;
+  wasmtime_error_t* serialize_error =
+      wasmtime_module_serialize(module, &serialized);
+  wasm_module_delete(module);
+  if (handleError(serialize_error)) {
+    log_wrn("Failed to serialize Wasm module; it won't be precompiled");
+    return true;
+  }
+
+  precompiled->assign(serialized.data, serialized.data + serialized.size);
+  wasm_byte_vec_delete(&serialized);
+  return true;
+}
+
 }  // namespace converter
 }  // namespace mondradiko
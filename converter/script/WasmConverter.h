@@ -3,7 +3,11 @@
 
 #pragma once
 
+#include <cstdint>
+#include <vector>
+
 #include "converter/ConverterInterface.h"
+#include "lib/include/wasm_headers.h"
 
 namespace mondradiko {
 namespace converter {
@@ -13,15 +17,21 @@ class BundlerInterface;
 
 class WasmConverter : public ConverterInterface {
  public:
-  explicit WasmConverter(BundlerInterface* bundler, assets::ScriptType script_type)
-    : _bundler(bundler), _script_type(script_type) {}
+  WasmConverter(BundlerInterface*, assets::ScriptType);
+  ~WasmConverter();
 
   // ConverterInterface implementation
   AssetOffset convert(AssetBuilder*, const toml::table&) const final;
+  uint32_t getVersion() const final { return 2; }
 
  private:
   BundlerInterface* _bundler;
   const assets::ScriptType _script_type;
+
+  // Configured like the runtime's engine; safe to share between threads
+  wasm_engine_t* _engine = nullptr;
+
+  bool _precompile(const std::vector<uint8_t>&, std::vector<uint8_t>*) const;
 };
 
 }  // namespace converter
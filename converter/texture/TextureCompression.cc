@@ -0,0 +1,465 @@
+// Copyright (c) 2020-2021 the Mondradiko contributors.
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include "converter/texture/TextureCompression.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "log/log.h"
+
+namespace mondradiko {
+namespace converter {
+
+namespace {
+
+const uint32_t BLOCK_DIM = 4;
+const uint32_t BLOCK_TEXEL_NUM = BLOCK_DIM * BLOCK_DIM;
+
+using BlockTexels = uint8_t[BLOCK_TEXEL_NUM][4];
+
+// Interpolation weights of BC7's 4-bit indices, out of 64
+const uint32_t BC7_WEIGHTS[16] = {0,  4,  9,  13, 17, 21, 26, 30,
+                                  34, 38, 43, 47, 51, 55, 60, 64};
+
+float srgbToLinear(float value) {
+  if (value <= 0.04045f) return value / 12.92f;
+  return std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+float linearToSrgb(float value) {
+  if (value <= 0.0031308f) return value * 12.92f;
+  return 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+}
+
+uint8_t toUnorm8(float value) {
+  return static_cast<uint8_t>(std::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+TextureLevel downsample(const TextureLevel& src, TextureRole role) {
+  bool srgb = isSrgbTexture(role);
+  bool normal = role == TextureRole::Normal;
+
+  TextureLevel dst;
+  dst.width = std::max(src.width / 2, 1u);
+  dst.height = std::max(src.height / 2, 1u);
+  dst.data.resize(dst.width * dst.height * 4);
+
+  for (uint32_t y = 0; y < dst.height; y++) {
+    for (uint32_t x = 0; x < dst.width; x++) {
+      float sum[4] = {};
+
+      // Odd edges reuse their last row or column
+      for (uint32_t dy = 0; dy < 2; dy++) {
+        for (uint32_t dx = 0; dx < 2; dx++) {
+          uint32_t src_x = std::min(x * 2 + dx, src.width - 1);
+          uint32_t src_y = std::min(y * 2 + dy, src.height - 1);
+          const uint8_t* texel = &src.data[(src_y * src.width + src_x) * 4];
+
+          for (uint32_t c = 0; c < 4; c++) {
+            float value = texel[c] / 255.0f;
+            if (srgb && c < 3) value = srgbToLinear(value);
+            if (normal && c < 3) value = value * 2.0f - 1.0f;
+            sum[c] += value;
+          }
+        }
+      }
+
+      float average[4];
+      for (uint32_t c = 0; c < 4; c++) average[c] = sum[c] / 4.0f;
+
+      if (normal) {
+        float length =
+            std::sqrt(average[0] * average[0] + average[1] * average[1] +
+                      average[2] * average[2]);
+        for (uint32_t c = 0; c < 3; c++) {
+          if (length > 0.0f) average[c] /= length;
+          average[c] = average[c] * 0.5f + 0.5f;
+        }
+      }
+
+      uint8_t* texel = &dst.data[(y * dst.width + x) * 4];
+      for (uint32_t c = 0; c < 4; c++) {
+        float value = average[c];
+        if (srgb && c < 3) value = linearToSrgb(value);
+        texel[c] = toUnorm8(value);
+      }
+    }
+  }
+
+  return dst;
+}
+
+// Partial blocks repeat their last row or column
+void fetchBlock(const TextureLevel& level, uint32_t block_x, uint32_t block_y,
+                BlockTexels texels) {
+  for (uint32_t y = 0; y < BLOCK_DIM; y++) {
+    for (uint32_t x = 0; x < BLOCK_DIM; x++) {
+      uint32_t src_x = std::min(block_x * BLOCK_DIM + x, level.width - 1);
+      uint32_t src_y = std::min(block_y * BLOCK_DIM + y, level.height - 1);
+      const uint8_t* texel = &level.data[(src_y * level.width + src_x) * 4];
+      std::copy(texel, texel + 4, texels[y * BLOCK_DIM + x]);
+    }
+  }
+}
+
+/**
+ * Finds the line that best fits a block's texels, using their first
+ * channel_num channels. Endpoints are written to min_point and max_point.
+ */
+void fitBlockLine(const BlockTexels texels, uint32_t channel_num,
+                  float min_point[4], float max_point[4]) {
+  float mean[4] = {};
+  for (uint32_t i = 0; i < BLOCK_TEXEL_NUM; i++) {
+    for (uint32_t c = 0; c < channel_num; c++) mean[c] += texels[i][c];
+  }
+  for (uint32_t c = 0; c < channel_num; c++) mean[c] /= BLOCK_TEXEL_NUM;
+
+  float covariance[4][4] = {};
+  for (uint32_t i = 0; i < BLOCK_TEXEL_NUM; i++) {
+    for (uint32_t a = 0; a < channel_num; a++) {
+      for (uint32_t b = 0; b < channel_num; b++) {
+        covariance[a][b] +=
+            (texels[i][a] - mean[a]) * (texels[i][b] - mean[b]);
+      }
+    }
+  }
+
+  // Start the power iteration from the channel that varies the most. Its
+  // own variance keeps each step from vanishing, which a fixed starting
+  // axis can't guarantee (i.e. (1, 1, 1) on an edge from red to green).
+  uint32_t widest_channel = 0;
+  float trace = 0.0f;
+  for (uint32_t c = 0; c < channel_num; c++) {
+    trace += covariance[c][c];
+    if (covariance[c][c] > covariance[widest_channel][widest_channel]) {
+      widest_channel = c;
+    }
+  }
+
+  float axis[4] = {};
+
+  // Otherwise, every texel is identical
+  if (trace > 0.0f) {
+    axis[widest_channel] = 1.0f;
+
+    for (uint32_t iteration = 0; iteration < 8; iteration++) {
+      float next[4] = {};
+      float length = 0.0f;
+
+      for (uint32_t a = 0; a < channel_num; a++) {
+        for (uint32_t b = 0; b < channel_num; b++) {
+          next[a] += covariance[a][b] * axis[b];
+        }
+        length = std::max(length, std::abs(next[a]));
+      }
+
+      for (uint32_t c = 0; c < channel_num; c++) axis[c] = next[c] / length;
+    }
+  }
+
+  float min_t = 0.0f;
+  float max_t = 0.0f;
+  float axis_length_sq = 0.0f;
+  for (uint32_t c = 0; c < channel_num; c++) {
+    axis_length_sq += axis[c] * axis[c];
+  }
+
+  if (axis_length_sq > 0.0f) {
+    for (uint32_t i = 0; i < BLOCK_TEXEL_NUM; i++) {
+      float t = 0.0f;
+      for (uint32_t c = 0; c < channel_num; c++) {
+        t += (texels[i][c] - mean[c]) * axis[c];
+      }
+
+      t /= axis_length_sq;
+      min_t = std::min(min_t, t);
+      max_t = std::max(max_t, t);
+    }
+  }
+
+  for (uint32_t c = 0; c < channel_num; c++) {
+    min_point[c] = std::clamp(mean[c] + axis[c] * min_t, 0.0f, 255.0f);
+    max_point[c] = std::clamp(mean[c] + axis[c] * max_t, 0.0f, 255.0f);
+  }
+}
+
+uint32_t findNearest(const uint8_t* texel, const int palette[][4],
+                     uint32_t palette_size, uint32_t channel_num) {
+  uint32_t best_index = 0;
+  int best_error = INT32_MAX;
+
+  for (uint32_t i = 0; i < palette_size; i++) {
+    int error = 0;
+    for (uint32_t c = 0; c < channel_num; c++) {
+      int difference = texel[c] - palette[i][c];
+      error += difference * difference;
+    }
+
+    if (error < best_error) {
+      best_error = error;
+      best_index = i;
+    }
+  }
+
+  return best_index;
+}
+
+uint16_t packRgb565(const float color[4]) {
+  uint32_t r = static_cast<uint32_t>(color[0] * 31.0f / 255.0f + 0.5f);
+  uint32_t g = static_cast<uint32_t>(color[1] * 63.0f / 255.0f + 0.5f);
+  uint32_t b = static_cast<uint32_t>(color[2] * 31.0f / 255.0f + 0.5f);
+  return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+void unpackRgb565(uint16_t packed, int color[4]) {
+  int r = (packed >> 11) & 31;
+  int g = (packed >> 5) & 63;
+  int b = packed & 31;
+  color[0] = (r << 3) | (r >> 2);
+  color[1] = (g << 2) | (g >> 4);
+  color[2] = (b << 3) | (b >> 2);
+  color[3] = 255;
+}
+
+void encodeBC1(const BlockTexels texels, uint8_t* block) {
+  float min_color[4];
+  float max_color[4];
+  fitBlockLine(texels, 3, min_color, max_color);
+
+  uint16_t color0 = packRgb565(max_color);
+  uint16_t color1 = packRgb565(min_color);
+
+  // color0 > color1 selects the four-color (opaque) mode
+  if (color0 < color1) std::swap(color0, color1);
+
+  uint32_t indices = 0;
+
+  if (color0 != color1) {
+    int palette[4][4];
+    unpackRgb565(color0, palette[0]);
+    unpackRgb565(color1, palette[1]);
+    for (uint32_t c = 0; c < 3; c++) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+
+    for (uint32_t i = 0; i < BLOCK_TEXEL_NUM; i++) {
+      indices |= findNearest(texels[i], palette, 4, 3) << (i * 2);
+    }
+  }
+
+  block[0] = color0 & 0xff;
+  block[1] = color0 >> 8;
+  block[2] = color1 & 0xff;
+  block[3] = color1 >> 8;
+  for (uint32_t i = 0; i < 4; i++) block[4 + i] = (indices >> (i * 8)) & 0xff;
+}
+
+// Encodes one channel of a block
+void encodeBC4(const BlockTexels texels, uint32_t channel, uint8_t* block) {
+  int max_value = 0;
+  int min_value = 255;
+  for (uint32_t i = 0; i < BLOCK_TEXEL_NUM; i++) {
+    max_value = std::max<int>(max_value, texels[i][channel]);
+    min_value = std::min<int>(min_value, texels[i][channel]);
+  }
+
+  uint64_t indices = 0;
+
+  // max_value > min_value selects the eight-value mode
+  if (max_value != min_value) {
+    int palette[8][4] = {};
+    palette[0][0] = max_value;
+    palette[1][0] = min_value;
+    for (int i = 2; i < 8; i++) {
+      palette[i][0] = ((8 - i) * max_value + (i - 1) * min_value + 3) / 7;
+    }
+
+    for (uint32_t i = 0; i < BLOCK_TEXEL_NUM; i++) {
+      uint8_t value[4] = {texels[i][channel], 0, 0, 0};
+      uint64_t index = findNearest(value, palette, 8, 1);
+      indices |= index << (i * 3);
+    }
+  }
+
+  block[0] = static_cast<uint8_t>(max_value);
+  block[1] = static_cast<uint8_t>(min_value);
+  for (uint32_t i = 0; i < 6; i++) block[2 + i] = (indices >> (i * 8)) & 0xff;
+}
+
+void encodeBC5(const BlockTexels texels, uint8_t* block) {
+  encodeBC4(texels, 0, block);
+  encodeBC4(texels, 1, block + 8);
+}
+
+class BlockBitWriter {
+ public:
+  explicit BlockBitWriter(uint8_t* block) : block(block) {
+    std::fill(block, block + 16, 0);
+  }
+
+  void write(uint32_t value, uint32_t bit_num) {
+    for (uint32_t i = 0; i < bit_num; i++) {
+      if (value & (1u << i)) block[offset / 8] |= 1 << (offset % 8);
+      offset++;
+    }
+  }
+
+ private:
+  uint8_t* block;
+  uint32_t offset = 0;
+};
+
+// Quantizes to BC7 mode 6's 7-bit endpoints and their shared p-bit
+void quantizeBC7Endpoint(const float endpoint[4], uint32_t quantized[4],
+                         uint32_t* p_bit) {
+  float best_error = INFINITY;
+
+  for (uint32_t p = 0; p < 2; p++) {
+    uint32_t candidate[4];
+    float error = 0.0f;
+
+    for (uint32_t c = 0; c < 4; c++) {
+      float value = (endpoint[c] - p) / 2.0f;
+      candidate[c] =
+          static_cast<uint32_t>(std::clamp(value + 0.5f, 0.0f, 127.0f));
+      float difference = (candidate[c] * 2 + p) - endpoint[c];
+      error += difference * difference;
+    }
+
+    if (error < best_error) {
+      best_error = error;
+      *p_bit = p;
+      std::copy(candidate, candidate + 4, quantized);
+    }
+  }
+}
+
+// Encodes with BC7 mode 6, which is one RGBA line with 4-bit indices
+void encodeBC7(const BlockTexels texels, uint8_t* block) {
+  float endpoints[2][4];
+  fitBlockLine(texels, 4, endpoints[0], endpoints[1]);
+
+  uint32_t quantized[2][4];
+  uint32_t p_bits[2];
+  quantizeBC7Endpoint(endpoints[0], quantized[0], &p_bits[0]);
+  quantizeBC7Endpoint(endpoints[1], quantized[1], &p_bits[1]);
+
+  int palette[16][4];
+  for (uint32_t i = 0; i < 16; i++) {
+    for (uint32_t c = 0; c < 4; c++) {
+      int e0 = quantized[0][c] * 2 + p_bits[0];
+      int e1 = quantized[1][c] * 2 + p_bits[1];
+      palette[i][c] =
+          ((64 - BC7_WEIGHTS[i]) * e0 + BC7_WEIGHTS[i] * e1 + 32) >> 6;
+    }
+  }
+
+  uint32_t indices[BLOCK_TEXEL_NUM];
+  for (uint32_t i = 0; i < BLOCK_TEXEL_NUM; i++) {
+    indices[i] = findNearest(texels[i], palette, 16, 4);
+  }
+
+  // The first index's high bit is implicitly zero, so flip the line if needed
+  if (indices[0] & 8) {
+    std::swap(quantized[0], quantized[1]);
+    std::swap(p_bits[0], p_bits[1]);
+    for (auto& index : indices) index = 15 - index;
+  }
+
+  BlockBitWriter writer(block);
+  writer.write(1 << 6, 7);
+
+  for (uint32_t c = 0; c < 4; c++) {
+    writer.write(quantized[0][c], 7);
+    writer.write(quantized[1][c], 7);
+  }
+
+  writer.write(p_bits[0], 1);
+  writer.write(p_bits[1], 1);
+
+  writer.write(indices[0], 3);
+  for (uint32_t i = 1; i < BLOCK_TEXEL_NUM; i++) writer.write(indices[i], 4);
+}
+
+}  // namespace
+
+assets::TextureFormat getTextureFormat(TextureRole role) {
+  switch (role) {
+    case TextureRole::Albedo:
+      return assets::TextureFormat::BC7;
+    case TextureRole::Normal:
+      return assets::TextureFormat::BC5;
+    case TextureRole::Emissive:
+    case TextureRole::MetalRoughness:
+    default:
+      return assets::TextureFormat::BC1;
+  }
+}
+
+bool isSrgbTexture(TextureRole role) {
+  return role == TextureRole::Albedo || role == TextureRole::Emissive;
+}
+
+std::vector<TextureLevel> generateMipChain(std::vector<uint8_t> texels,
+                                           uint32_t width, uint32_t height,
+                                           TextureRole role) {
+  log_zone;
+
+  std::vector<TextureLevel> levels;
+  levels.push_back({width, height, std::move(texels)});
+
+  while (levels.back().width > 1 || levels.back().height > 1) {
+    levels.push_back(downsample(levels.back(), role));
+  }
+
+  return levels;
+}
+
+void compressTextureLevel(TextureLevel* level, assets::TextureFormat format) {
+  log_zone;
+
+  void (*encode_block)(const BlockTexels, uint8_t*);
+  uint32_t block_size;
+
+  switch (format) {
+    case assets::TextureFormat::BC1: {
+      encode_block = encodeBC1;
+      block_size = 8;
+      break;
+    }
+
+    case assets::TextureFormat::BC5: {
+      encode_block = encodeBC5;
+      block_size = 16;
+      break;
+    }
+
+    case assets::TextureFormat::BC7: {
+      encode_block = encodeBC7;
+      block_size = 16;
+      break;
+    }
+
+    default:
+      return;
+  }
+
+  uint32_t block_width = (level->width + BLOCK_DIM - 1) / BLOCK_DIM;
+  uint32_t block_height = (level->height + BLOCK_DIM - 1) / BLOCK_DIM;
+  std::vector<uint8_t> blocks(block_width * block_height * block_size);
+
+  for (uint32_t y = 0; y < block_height; y++) {
+    for (uint32_t x = 0; x < block_width; x++) {
+      BlockTexels texels;
+      fetchBlock(*level, x, y, texels);
+      encode_block(texels, &blocks[(y * block_width + x) * block_size]);
+    }
+  }
+
+  level->data = std::move(blocks);
+}
+
+}  // namespace converter
+}  // namespace mondradiko
@@ -0,0 +1,41 @@
+// Copyright (c) 2020-2021 the Mondradiko contributors.
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "types/assets/TextureAsset_generated.h"
+
+namespace mondradiko {
+namespace converter {
+
+// How a material uses a texture, which decides its filtering and format
+enum class TextureRole { Albedo, Emissive, Normal, MetalRoughness };
+
+struct TextureLevel {
+  uint32_t width;
+  uint32_t height;
+
+  // RGBA8 texels, or compressed blocks
+  std::vector<uint8_t> data;
+};
+
+assets::TextureFormat getTextureFormat(TextureRole);
+bool isSrgbTexture(TextureRole);
+
+/**
+ * @brief Generates every mip level of an RGBA8 texture, down to 1x1.
+ *
+ * The first level is the texture itself. Colors are averaged in linear
+ * space, and normals are renormalized after averaging.
+ */
+std::vector<TextureLevel> generateMipChain(std::vector<uint8_t>, uint32_t,
+                                           uint32_t, TextureRole);
+
+// Compresses an RGBA8 level in place
+void compressTextureLevel(TextureLevel*, assets::TextureFormat);
+
+}  // namespace converter
+}  // namespace mondradiko
@@ -24,21 +24,26 @@ bool Asset::load(const assets::SerializedAsset* asset) {
 }
 
 void Asset::_ref() {
-  log_zone;
-
   ref_count++;
+  unreferenced_since = 0;
+
+  // Referenced again before it could be collected
+  if (_state == AssetState::Cached) _state = AssetState::Loaded;
 }
 
 void Asset::_unref() {
-  log_zone;
+  if (ref_count == 0) {
+    log_err("Asset was unreferenced more times than it was referenced");
+    return;
+  }
 
-  ref_count--;
+  // Only the last reference marks the asset for collection
+  if (--ref_count > 0) return;
 
   if (_state == AssetState::Loaded) {
-    if (ref_count <= 0) {
-      _state = AssetState::Cached;
-    }
+    _state = AssetState::Cached;
   }
 }
+
 }  // namespace core
 }  // namespace mondradiko
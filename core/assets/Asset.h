@@ -3,6 +3,8 @@
 
 #pragma once
 
+#include <atomic>
+
 #include "types/assets/AssetTypes.h"
 #include "types/assets/SerializedAsset_generated.h"
 
@@ -27,11 +29,22 @@ enum class AssetState {
 
 class Asset {
  public:
+  Asset() {}
+
+  // Assets are copied from their type's template, and start unreferenced
+  Asset(const Asset& other) : _state(other._state) {}
+  Asset& operator=(const Asset&) = delete;
+
   virtual ~Asset() {}
 
   bool load(const assets::SerializedAsset*);
   virtual bool isLoaded() const { return _state == AssetState::Loaded; }
 
+  // True while an asynchronous load has not yet finished
+  virtual bool isPending() const {
+    return _state == AssetState::Retrieving || _state == AssetState::Loading;
+  }
+
  protected:
   template <class AssetType>
   friend class AssetHandle;
@@ -39,12 +52,25 @@ class Asset {
   friend class AssetPool;
 
   virtual bool _load(const assets::SerializedAsset*) = 0;
+
+  /**
+   * @brief Drops everything this asset holds outside of itself.
+   *
+   * Called on every remaining asset just before the AssetPool destroys them
+   * all, in no particular order. Implementations release their handles to
+   * other assets, and forget space allocated from render passes that may
+   * already be destroyed, so that their destructors touch neither.
+   */
+  virtual void _releaseReferences() {}
   void _ref();
   void _unref();
 
  private:
   AssetState _state = AssetState::Unloaded;
-  uint32_t ref_count = 0;
+  std::atomic<uint32_t> ref_count{0};
+
+  // AssetPool::collect() pass when this was first seen unreferenced, or zero
+  uint64_t unreferenced_since = 0;
 };
 
 }  // namespace core
@@ -12,7 +12,7 @@ namespace core {
 template <class AssetType>
 class AssetHandle {
  public:
-  AssetHandle() : ptr(nullptr) {}
+  AssetHandle() : id(NullAsset), ptr(nullptr) {}
 
   explicit AssetHandle(std::nullptr_t ptr) : id(NullAsset), ptr(ptr) {}
 
@@ -26,13 +26,16 @@ class AssetHandle {
     _ref();
   }
 
+  // Moving steals the other handle's reference
   explicit AssetHandle(AssetHandle<AssetType>&& other) {
     id = other.id;
     ptr = other.ptr;
-    _ref();
+    other.id = NullAsset;
+    other.ptr = nullptr;
   }
 
   AssetHandle<AssetType>& operator=(const AssetHandle<AssetType>& other) {
+    if (this == &other) return *this;
     _unref();
     id = other.id;
     ptr = other.ptr;
@@ -41,10 +44,12 @@ class AssetHandle {
   }
 
   AssetHandle<AssetType>& operator=(AssetHandle<AssetType>&& other) {
+    if (this == &other) return *this;
     _unref();
     id = other.id;
     ptr = other.ptr;
-    _ref();
+    other.id = NullAsset;
+    other.ptr = nullptr;
     return *this;
   }
 
@@ -71,19 +76,20 @@ class AssetHandle {
     return false;
   }
 
+  bool isPending() const {
+    if (ptr != nullptr) return ptr->isPending();
+    return false;
+  }
+
  private:
   AssetId id;
   AssetType* ptr;
 
-  // FIXME(marceline-cramer) Un/refing assets segfaults on engine unload
-
   void _ref() {
-    return;
     if (ptr != nullptr) ptr->_ref();
   }
 
   void _unref() {
-    return;
     if (ptr != nullptr) ptr->_unref();
   }
 };
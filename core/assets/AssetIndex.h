@@ -0,0 +1,115 @@
+// Copyright (c) 2020-2021 the Mondradiko contributors.
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <cstdint>
+
+#include "core/assets/Asset.h"
+#include "types/containers/vector.h"
+
+namespace mondradiko {
+namespace core {
+
+/**
+ * @brief Flat hash table mapping AssetIds to their storage slots.
+ *
+ * Entries are stored inline with linear probing, so a lookup usually only
+ * touches one cache line. Erasing uses backward-shift deletion, so there are
+ * no tombstones to slow down later lookups.
+ */
+class AssetIndex {
+ public:
+  struct Entry {
+    AssetId id;
+    uint32_t type;
+    uint32_t slot;
+  };
+
+  AssetIndex() : entries(MIN_CAPACITY, Entry{NullAsset, 0, 0}) {}
+
+  size_t size() const { return entry_num; }
+  bool empty() const { return entry_num == 0; }
+
+  const Entry* find(AssetId id) const {
+    if (id == NullAsset) return nullptr;
+
+    size_t mask = entries.size() - 1;
+    for (size_t i = _hash(id) & mask;; i = (i + 1) & mask) {
+      const Entry& entry = entries[i];
+      if (entry.id == id) return &entry;
+      if (entry.id == NullAsset) return nullptr;
+    }
+  }
+
+  // The ID must not already be in the index
+  void insert(AssetId id, uint32_t type, uint32_t slot) {
+    // Keep the load factor under 3/4
+    if ((entry_num + 1) * 4 > entries.size() * 3) _rehash(entries.size() * 2);
+
+    _place(Entry{id, type, slot});
+    entry_num++;
+  }
+
+  void erase(AssetId id) {
+    if (id == NullAsset) return;
+
+    size_t mask = entries.size() - 1;
+    size_t hole = _hash(id) & mask;
+    while (entries[hole].id != id) {
+      if (entries[hole].id == NullAsset) return;
+      hole = (hole + 1) & mask;
+    }
+
+    // Shift following entries back until one is already in its home bucket
+    for (size_t i = (hole + 1) & mask;; i = (i + 1) & mask) {
+      if (entries[i].id == NullAsset) break;
+
+      size_t home = _hash(entries[i].id) & mask;
+      if (((i - home) & mask) >= ((i - hole) & mask)) {
+        entries[hole] = entries[i];
+        hole = i;
+      }
+    }
+
+    entries[hole].id = NullAsset;
+    entry_num--;
+  }
+
+  template <typename Function>
+  void forEach(Function&& function) const {
+    for (const auto& entry : entries) {
+      if (entry.id != NullAsset) function(entry);
+    }
+  }
+
+ private:
+  static constexpr size_t MIN_CAPACITY = 64;
+
+  types::vector<Entry> entries;
+  size_t entry_num = 0;
+
+  // AssetIds are already hashes, but not necessarily well-mixed in low bits
+  static size_t _hash(AssetId id) {
+    return static_cast<size_t>(id * UINT32_C(0x9E3779B1) >> 7);
+  }
+
+  void _place(const Entry& new_entry) {
+    size_t mask = entries.size() - 1;
+    size_t i = _hash(new_entry.id) & mask;
+    while (entries[i].id != NullAsset) i = (i + 1) & mask;
+    entries[i] = new_entry;
+  }
+
+  void _rehash(size_t new_capacity) {
+    types::vector<Entry> old_entries(new_capacity, Entry{NullAsset, 0, 0});
+    old_entries.swap(entries);
+
+    for (const auto& entry : old_entries) {
+      if (entry.id != NullAsset) _place(entry);
+    }
+  }
+};
+
+}  // namespace core
+}  // namespace mondradiko
@@ -0,0 +1,260 @@
+// Copyright (c) 2020-2021 the Mondradiko contributors.
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include "core/assets/AssetPool.h"
+
+#include <chrono>
+#include <utility>
+
+#include "core/assets/AssetTrace.h"
+#include "log/log.h"
+
+namespace mondradiko {
+namespace core {
+
+void AssetPool::update() {
+  log_zone;
+
+  types::vector<RetrievedAsset> finished;
+
+  {
+    std::unique_lock<std::mutex> lock(retrieved_mutex);
+    finished.swap(retrieved_assets);
+  }
+
+  for (const auto& retrieved : finished) {
+    Asset* asset = _findAsset(retrieved.id);
+
+    // Skip assets that were loaded synchronously in the meantime
+    if (asset != nullptr && asset->_state == AssetState::Retrieving) {
+      _finishLoad(retrieved.id, asset, retrieved.type, retrieved.data);
+    }
+
+    // Let the Filesystem evict the asset's lump if it needs to
+    if (retrieved.data != nullptr) fs->releaseAsset(retrieved.id);
+  }
+}
+
+void AssetPool::flush() {
+  log_zone;
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(retrieved_mutex);
+      retrieved_condition.wait(lock, [this]() {
+        return retrieving_num == 0 || !retrieved_assets.empty();
+      });
+
+      if (retrieved_assets.empty()) return;
+    }
+
+    // Loading may queue up more retrievals (i.e. prefab children)
+    update();
+  }
+}
+
+// Must exceed the number of frames the renderer keeps in flight
+static const uint64_t ASSET_COLLECT_DELAY = 3;
+
+void AssetPool::collect(double time_budget) {
+  log_zone;
+
+  using clock = std::chrono::steady_clock;
+  auto collect_start = clock::now();
+
+  collect_pass++;
+
+  // Start a new sweep over the whole pool
+  if (collect_queue.empty()) {
+    collect_queue.reserve(index.size());
+    index.forEach([this](const AssetIndex::Entry& entry) {
+      collect_queue.push_back(entry.id);
+    });
+  }
+
+  uint32_t collected_num = 0;
+
+  while (!collect_queue.empty()) {
+    AssetId id = collect_queue.back();
+    collect_queue.pop_back();
+
+    if (_tryCollect(id, ASSET_COLLECT_DELAY)) collected_num++;
+
+    std::chrono::duration<double> elapsed = clock::now() - collect_start;
+    if (elapsed.count() > time_budget) break;
+  }
+
+  if (collected_num > 0) log_dbg_fmt("Collected %u assets", collected_num);
+}
+
+void AssetPool::unloadAll() {
+  log_zone;
+
+  // Freeing an asset may release the last reference to its dependencies
+  // (i.e. prefab children), so keep sweeping until nothing else is freed
+  bool collected_any = true;
+  while (collected_any) {
+    collected_any = false;
+    collect_pass++;
+
+    types::vector<AssetId> ids;
+    ids.reserve(index.size());
+    index.forEach(
+        [&ids](const AssetIndex::Entry& entry) { ids.push_back(entry.id); });
+
+    for (auto id : ids) {
+      if (_tryCollect(id, 0)) collected_any = true;
+    }
+  }
+
+  collect_queue.clear();
+
+  if (!index.empty()) {
+    log_wrn_fmt("%zu assets are still referenced after unloading",
+                index.size());
+  }
+}
+
+void AssetPool::_releaseAll() {
+  log_zone;
+
+  index.forEach([this](const AssetIndex::Entry& entry) {
+    storages[entry.type]->get(entry.slot)->_releaseReferences();
+  });
+
+  size_t referenced_num = 0;
+  index.forEach([this, &referenced_num](const AssetIndex::Entry& entry) {
+    if (storages[entry.type]->get(entry.slot)->ref_count > 0) {
+      referenced_num++;
+    }
+  });
+
+  if (referenced_num > 0) {
+    log_wrn_fmt("Destroying %zu assets that are still referenced",
+                referenced_num);
+  }
+}
+
+bool AssetPool::_tryCollect(AssetId id, uint64_t delay) {
+  const AssetIndex::Entry* entry = index.find(id);
+  if (entry == nullptr) return false;
+
+  AssetStorage* storage = storages[entry->type];
+  uint32_t slot = entry->slot;
+  Asset* asset = storage->get(slot);
+
+  // The I/O workers will report back on these
+  if (asset->_state == AssetState::Retrieving) return false;
+
+  if (asset->ref_count > 0) {
+    asset->unreferenced_since = 0;
+    return false;
+  }
+
+  if (asset->unreferenced_since == 0) {
+    asset->unreferenced_since = collect_pass;
+  }
+
+  if (collect_pass - asset->unreferenced_since < delay) return false;
+
+  asset->_state = AssetState::Unloading;
+  index.erase(id);
+  storage->destroy(slot);
+
+  return true;
+}
+
+Asset* AssetPool::_findAsset(AssetId id) {
+  const AssetIndex::Entry* entry = index.find(id);
+  if (entry == nullptr) return nullptr;
+  return storages[entry->type]->get(entry->slot);
+}
+
+bool AssetPool::_resetIfFailed(const AssetIndex::Entry* entry) {
+  AssetStorage* storage = storages[entry->type];
+  Asset* asset = storage->get(entry->slot);
+
+  // Only a failed load leaves an indexed asset in either of these states
+  if (asset->_state != AssetState::Unloaded &&
+      asset->_state != AssetState::Stored) {
+    return false;
+  }
+
+  // The new copy starts unreferenced, but the old handles still count
+  uint32_t ref_count = asset->ref_count;
+  storage->reset(entry->slot);
+  storage->get(entry->slot)->ref_count = ref_count;
+
+  return true;
+}
+
+void AssetPool::_retrieve(AssetId id, assets::AssetType type) {
+  {
+    std::unique_lock<std::mutex> lock(retrieved_mutex);
+    retrieving_num++;
+  }
+
+  fs->getJobQueue()->addJob([this, id, type]() {
+    RetrievedAsset retrieved;
+    retrieved.id = id;
+    retrieved.type = type;
+
+    if (!fs->loadAsset(&retrieved.data, id)) {
+      retrieved.data = nullptr;
+    }
+
+    {
+      std::unique_lock<std::mutex> lock(retrieved_mutex);
+      retrieved_assets.push_back(retrieved);
+      retrieving_num--;
+    }
+
+    retrieved_condition.notify_all();
+  });
+}
+
+void AssetPool::_waitForRetrievals() {
+  std::unique_lock<std::mutex> lock(retrieved_mutex);
+  retrieved_condition.wait(lock, [this]() { return retrieving_num == 0; });
+}
+
+bool AssetPool::_loadNow(AssetId id, Asset* asset, assets::AssetType type) {
+  const assets::SerializedAsset* asset_data;
+  if (!fs->loadAsset(&asset_data, id)) asset_data = nullptr;
+
+  bool loaded_successfully = _finishLoad(id, asset, type, asset_data);
+  if (asset_data != nullptr) fs->releaseAsset(id);
+  return loaded_successfully;
+}
+
+bool AssetPool::_finishLoad(AssetId id, Asset* asset, assets::AssetType type,
+                            const assets::SerializedAsset* asset_data) {
+  if (asset_data != nullptr && asset_data->type() != type) {
+    const char* type_name = assets::EnumNameAssetType(type);
+    log_err_fmt("SerializedAsset 0x%0lx does not have type %s as expected", id,
+                type_name);
+    asset_data = nullptr;
+  }
+
+  if (asset_data == nullptr) {
+    log_err_fmt("Failed to load asset 0x%0dx", id);
+    asset->_state = AssetState::Unloaded;
+    return false;
+  }
+
+  bool loaded_successfully;
+  {
+    AssetTraceZone trace_zone(AssetTraceStage::Load, id);
+    loaded_successfully = asset->load(asset_data);
+  }
+
+  if (!loaded_successfully) {
+    log_err_fmt("Failed to load asset 0x%0dx", id);
+    return false;
+  }
+
+  return true;
+}
+
+}  // namespace core
+}  // namespace mondradiko
@@ -3,10 +3,15 @@
 
 #pragma once
 
+#include <condition_variable>
+#include <mutex>
 #include <type_traits>
+#include <utility>
 
 #include "core/assets/Asset.h"
 #include "core/assets/AssetHandle.h"
+#include "core/assets/AssetIndex.h"
+#include "core/assets/AssetStorage.h"
 #include "core/filesystem/Filesystem.h"
 #include "lib/include/entt_headers.h"
 #include "log/log.h"
@@ -27,10 +32,13 @@ class AssetPool {
   explicit AssetPool(Filesystem* fs) : fs(fs) {}
 
   ~AssetPool() {
-    unloadAll();
+    // I/O workers may still be referencing this pool
+    _waitForRetrievals();
+    _releaseAll();
 
-    for (auto& template_asset : templates) {
-      if (template_asset != nullptr) delete template_asset;
+    // Every remaining asset is destroyed, whether or not it's referenced
+    for (auto& storage : storages) {
+      if (storage != nullptr) delete storage;
     }
   }
 
@@ -39,86 +47,120 @@ class AssetPool {
     uint32_t asset_type = static_cast<uint32_t>(AssetType::ASSET_TYPE);
     const char* type_name = assets::EnumNameAssetType(AssetType::ASSET_TYPE);
 
-    if (asset_type >= templates.size()) {
-      templates.resize(asset_type + 1, nullptr);
-    } else if (templates[asset_type] != nullptr) {
+    if (asset_type >= storages.size()) {
+      storages.resize(asset_type + 1, nullptr);
+    } else if (storages[asset_type] != nullptr) {
       log_err_fmt("Attempted to initialize %s pool twice", type_name);
       return;
     }
 
-    Asset* new_asset = new AssetType(args...);
-    templates[asset_type] = new_asset;
+    storages[asset_type] =
+        new TypedAssetStorage<AssetType>(std::forward<Args>(args)...);
   }
 
   template <typename AssetType>
   AssetHandle<AssetType> load(AssetId id) {
-    uint32_t asset_type = static_cast<uint32_t>(AssetType::ASSET_TYPE);
-    const char* type_name = assets::EnumNameAssetType(AssetType::ASSET_TYPE);
+    auto storage = _getStorage<AssetType>();
+    if (storage == nullptr || id == NullAsset) {
+      return AssetHandle<AssetType>(nullptr);
+    }
 
     {  // Check if this asset already exists
-      auto iter = pool.find(id);
+      const AssetIndex::Entry* entry = index.find(id);
 
-      if (iter != pool.end()) {
-        AssetType* asset = dynamic_cast<AssetType*>(iter->second);
-
-        if (asset == nullptr) {
-          log_err_fmt("Cached asset 0x%0lx does not have type %s as expected",
-                      id, type_name);
+      if (entry != nullptr) {
+        if (!_checkType<AssetType>(entry)) {
           return AssetHandle<AssetType>(nullptr);
-        } else {
-          return AssetHandle<AssetType>(id, asset);
         }
-      }
-    }
 
-    if (templates.size() <= asset_type || templates[asset_type] == nullptr) {
-      log_err_fmt("Attempted to load unitialized asset type %s", type_name);
-      return AssetHandle<AssetType>(nullptr);
-    }
+        AssetType* asset = storage->getTyped(entry->slot);
 
-    const assets::SerializedAsset* asset_data;
-    bool loaded_successfully = fs->loadAsset(&asset_data, id);
+        // Don't wait on the I/O workers if the caller needs it right now
+        if (asset->_state == AssetState::Retrieving) {
+          _loadNow(id, asset, AssetType::ASSET_TYPE);
+        } else if (_resetIfFailed(entry)) {
+          if (!_loadNow(id, asset, AssetType::ASSET_TYPE)) {
+            return AssetHandle<AssetType>(nullptr);
+          }
+        }
 
-    if (loaded_successfully) {
-      if (asset_data->type() != AssetType::ASSET_TYPE) {
-        loaded_successfully = false;
-        log_err_fmt("SerializedAsset 0x%0lx does not have type %s as expected",
-                    id, type_name);
+        return AssetHandle<AssetType>(id, asset);
       }
     }
 
-    if (!loaded_successfully) {
-      log_err_fmt("Failed to load asset 0x%0dx", id);
+    uint32_t slot = storage->create();
+    AssetType* new_asset = storage->getTyped(slot);
+
+    if (!_loadNow(id, new_asset, AssetType::ASSET_TYPE)) {
+      storage->destroy(slot);
       return AssetHandle<AssetType>(nullptr);
     }
 
-    AssetType* template_asset = dynamic_cast<AssetType*>(templates[asset_type]);
+    index.insert(id, static_cast<uint32_t>(AssetType::ASSET_TYPE), slot);
+    return AssetHandle<AssetType>(id, new_asset);
+  }
 
-    if (template_asset == nullptr) {
-      log_err_fmt("Template asset for 0x%0lx does not have type %s as expected",
-                  id, type_name);
+  /**
+   * @brief Starts loading an asset in the background.
+   *
+   * The returned handle is pending until the asset has been read and
+   * decompressed by the Filesystem's I/O workers and then loaded by update()
+   * on the calling thread.
+   */
+  template <typename AssetType>
+  AssetHandle<AssetType> loadAsync(AssetId id) {
+    auto storage = _getStorage<AssetType>();
+    if (storage == nullptr || id == NullAsset) {
       return AssetHandle<AssetType>(nullptr);
     }
 
-    AssetType* new_asset = new AssetType(*template_asset);
-    if (!new_asset->load(asset_data)) {
-      log_err_fmt("Failed to load asset 0x%0dx", id);
-      return AssetHandle<AssetType>(nullptr);
+    {  // Check if this asset already exists
+      const AssetIndex::Entry* entry = index.find(id);
+
+      if (entry != nullptr) {
+        if (!_checkType<AssetType>(entry)) {
+          return AssetHandle<AssetType>(nullptr);
+        }
+
+        AssetType* asset = storage->getTyped(entry->slot);
+
+        if (_resetIfFailed(entry)) {
+          asset->_state = AssetState::Retrieving;
+          _retrieve(id, AssetType::ASSET_TYPE);
+        }
+
+        return AssetHandle<AssetType>(id, asset);
+      }
     }
 
-    pool.emplace(id, new_asset);
+    uint32_t slot = storage->create();
+    AssetType* new_asset = storage->getTyped(slot);
+
+    new_asset->_state = AssetState::Retrieving;
+    index.insert(id, static_cast<uint32_t>(AssetType::ASSET_TYPE), slot);
+    _retrieve(id, AssetType::ASSET_TYPE);
+
     return AssetHandle<AssetType>(id, new_asset);
   }
 
-  // TODO(marceline-cramer) Add garbage collecting method
+  // Finishes loading all assets retrieved since the last update
+  void update();
 
-  void unloadAll() {
-    for (auto& asset : pool) {
-      delete asset.second;
-    }
+  // Blocks until all pending assets, including their dependencies, are loaded
+  void flush();
 
-    pool.clear();
-  }
+  /**
+   * @brief Incrementally frees unreferenced assets.
+   *
+   * Meant to be called once per frame. Assets are only freed after going
+   * unreferenced for several consecutive calls, so that GPU resources are no
+   * longer in use by frames in flight. Stops early after the given number of
+   * seconds, and resumes where it left off on the next call.
+   */
+  void collect(double);
+
+  // Frees every unreferenced asset, including newly-unreferenced dependencies
+  void unloadAll();
 
   void addAlias(const types::string& alias, AssetId id) {
     auto iter = aliases.find(alias);
@@ -143,9 +185,75 @@ class AssetPool {
  private:
   Filesystem* fs;
 
-  types::vector<Asset*> templates;
+  // Indexed by AssetType
+  types::vector<AssetStorage*> storages;
   types::unordered_map<types::string, AssetId> aliases;
-  types::unordered_map<AssetId, Asset*> pool;
+  AssetIndex index;
+
+  // Asset IDs remaining in the current collection sweep
+  types::vector<AssetId> collect_queue;
+  uint64_t collect_pass = 0;
+
+  bool _tryCollect(AssetId, uint64_t);
+
+  // Releases every asset's references so that they can be destroyed in any
+  // order, then warns about assets that are still referenced from outside
+  void _releaseAll();
+
+  struct RetrievedAsset {
+    AssetId id;
+    assets::AssetType type;
+
+    // Null if the asset could not be retrieved
+    const assets::SerializedAsset* data;
+  };
+
+  // Shared with the I/O workers
+  std::mutex retrieved_mutex;
+  std::condition_variable retrieved_condition;
+  types::vector<RetrievedAsset> retrieved_assets;
+  uint32_t retrieving_num = 0;
+
+  template <typename AssetType>
+  TypedAssetStorage<AssetType>* _getStorage() {
+    uint32_t asset_type = static_cast<uint32_t>(AssetType::ASSET_TYPE);
+
+    if (storages.size() <= asset_type || storages[asset_type] == nullptr) {
+      const char* type_name = assets::EnumNameAssetType(AssetType::ASSET_TYPE);
+      log_err_fmt("Attempted to load unitialized asset type %s", type_name);
+      return nullptr;
+    }
+
+    // initializeAssetType() only ever stores matching storage types here
+    return static_cast<TypedAssetStorage<AssetType>*>(storages[asset_type]);
+  }
+
+  template <typename AssetType>
+  bool _checkType(const AssetIndex::Entry* entry) {
+    if (entry->type == static_cast<uint32_t>(AssetType::ASSET_TYPE)) {
+      return true;
+    }
+
+    const char* type_name = assets::EnumNameAssetType(AssetType::ASSET_TYPE);
+    log_err_fmt("Cached asset 0x%0lx does not have type %s as expected",
+                entry->id, type_name);
+    return false;
+  }
+
+  Asset* _findAsset(AssetId);
+
+  /**
+   * @brief Prepares an asset whose last load failed to be loaded again.
+   *
+   * The asset is replaced with a fresh copy in the same slot, so that
+   * existing handles stay valid. Returns false if the asset hasn't failed.
+   */
+  bool _resetIfFailed(const AssetIndex::Entry*);
+  void _retrieve(AssetId, assets::AssetType);
+  void _waitForRetrievals();
+  bool _loadNow(AssetId, Asset*, assets::AssetType);
+  bool _finishLoad(AssetId, Asset*, assets::AssetType,
+                   const assets::SerializedAsset*);
 };
 
 }  // namespace core
@@ -0,0 +1,114 @@
+// Copyright (c) 2020-2021 the Mondradiko contributors.
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+
+#include "core/assets/Asset.h"
+#include "types/containers/vector.h"
+
+namespace mondradiko {
+namespace core {
+
+/**
+ * @brief Type-erased slot storage for every asset of one AssetType.
+ *
+ * Slot pointers are kept in one dense array, so resolving a slot is a single
+ * indexed load, and the assets themselves never move once created so that
+ * AssetHandles can keep pointing at them.
+ */
+class AssetStorage {
+ public:
+  virtual ~AssetStorage() {}
+
+  Asset* get(uint32_t slot) const { return slots[slot]; }
+  size_t getLiveNum() const { return slots.size() - free_slots.size(); }
+
+  // Copies a new asset from the template and returns its slot
+  virtual uint32_t create() = 0;
+  virtual void destroy(uint32_t) = 0;
+
+  // Replaces a slot's asset with a new copy of the template, in place
+  virtual void reset(uint32_t) = 0;
+
+ protected:
+  // Null for free slots
+  types::vector<Asset*> slots;
+  types::vector<uint32_t> free_slots;
+
+  uint32_t _allocateSlot() {
+    if (!free_slots.empty()) {
+      uint32_t slot = free_slots.back();
+      free_slots.pop_back();
+      return slot;
+    }
+
+    slots.push_back(nullptr);
+    return slots.size() - 1;
+  }
+};
+
+template <typename AssetType>
+class TypedAssetStorage : public AssetStorage {
+ public:
+  template <typename... Args>
+  explicit TypedAssetStorage(Args&&... args)
+      : template_asset(std::forward<Args>(args)...) {}
+
+  ~TypedAssetStorage() {
+    // Destroy every asset, even if still referenced, so that their GPU
+    // resources don't outlive the renderer. The AssetPool has already had
+    // them release their references, so the order doesn't matter.
+    for (uint32_t slot = 0; slot < slots.size(); slot++) {
+      if (slots[slot] != nullptr) destroy(slot);
+    }
+
+    for (auto chunk : chunks) allocator.deallocate(chunk, CHUNK_SIZE);
+  }
+
+  AssetType* getTyped(uint32_t slot) const {
+    // The AssetPool only hands out slots of this storage's type
+    return static_cast<AssetType*>(slots[slot]);
+  }
+
+  uint32_t create() final {
+    uint32_t slot = _allocateSlot();
+
+    uint32_t chunk_index = slot / CHUNK_SIZE;
+    if (chunk_index >= chunks.size()) {
+      chunks.push_back(allocator.allocate(CHUNK_SIZE));
+    }
+
+    AssetType* location = chunks[chunk_index] + slot % CHUNK_SIZE;
+    slots[slot] = new (location) AssetType(template_asset);
+    return slot;
+  }
+
+  void destroy(uint32_t slot) final {
+    getTyped(slot)->~AssetType();
+    slots[slot] = nullptr;
+    free_slots.push_back(slot);
+  }
+
+  void reset(uint32_t slot) final {
+    AssetType* asset = getTyped(slot);
+    asset->~AssetType();
+    slots[slot] = new (asset) AssetType(template_asset);
+  }
+
+ private:
+  // Assets are allocated in chunks to avoid one heap allocation per asset
+  static constexpr uint32_t CHUNK_SIZE = 64;
+
+  AssetType template_asset;
+
+  std::allocator<AssetType> allocator;
+  types::vector<AssetType*> chunks;
+};
+
+}  // namespace core
+}  // namespace mondradiko
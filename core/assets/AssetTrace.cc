@@ -0,0 +1,255 @@
+// Copyright (c) 2020-2021 the Mondradiko contributors.
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include "core/assets/AssetTrace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <thread>
+
+#include "log/log.h"
+#include "types/containers/unordered_map.h"
+#include "types/containers/vector.h"
+
+namespace mondradiko {
+namespace core {
+
+namespace {
+
+struct TraceEvent {
+  AssetTraceStage stage;
+  types::string subject;
+  uint32_t thread_index;
+  int64_t start_ns;
+  int64_t duration_ns;
+};
+
+std::atomic<bool> trace_enabled{false};
+AssetTrace::Clock::time_point trace_start;
+
+std::mutex trace_mutex;
+types::vector<TraceEvent> trace_events;
+types::unordered_map<std::thread::id, uint32_t> thread_indices;
+
+thread_local assets::AssetId current_asset = assets::NullAsset;
+
+const char* getStageName(AssetTraceStage stage) {
+  switch (stage) {
+    case AssetTraceStage::Retrieve:
+      return "Retrieve";
+    case AssetTraceStage::Lookup:
+      return "Lookup";
+    case AssetTraceStage::LumpFault:
+      return "LumpFault";
+    case AssetTraceStage::Hash:
+      return "Hash";
+    case AssetTraceStage::Decompress:
+      return "Decompress";
+    case AssetTraceStage::Verify:
+      return "Verify";
+    case AssetTraceStage::Load:
+      return "Load";
+    case AssetTraceStage::Upload:
+      return "Upload";
+    default:
+      return "Unknown";
+  }
+}
+
+const uint32_t STAGE_NUM = static_cast<uint32_t>(AssetTraceStage::Upload) + 1;
+
+types::string getAssetSubject(assets::AssetId id) {
+  char subject[32];
+  snprintf(subject, sizeof(subject), "asset 0x%08x", id);
+  return subject;
+}
+
+// Subjects are asset IDs and file paths, but escape them to be safe
+types::string escapeJson(const types::string& text) {
+  types::string escaped;
+
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+      escaped += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      escaped += ' ';
+    } else {
+      escaped += c;
+    }
+  }
+
+  return escaped;
+}
+
+}  // namespace
+
+void AssetTrace::enable() {
+  std::unique_lock<std::mutex> lock(trace_mutex);
+  if (trace_enabled) return;
+
+  trace_start = Clock::now();
+  trace_enabled = true;
+}
+
+bool AssetTrace::isEnabled() { return trace_enabled; }
+
+void AssetTrace::record(AssetTraceStage stage, const types::string& subject,
+                        Clock::time_point start, Clock::time_point end) {
+  if (!trace_enabled) return;
+
+  TraceEvent event;
+  event.stage = stage;
+  event.subject = subject;
+  event.start_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(start - trace_start)
+          .count();
+  event.duration_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+          .count();
+
+  std::unique_lock<std::mutex> lock(trace_mutex);
+
+  auto thread_iter = thread_indices.find(std::this_thread::get_id());
+  if (thread_iter == thread_indices.end()) {
+    thread_iter = thread_indices
+                      .emplace(std::this_thread::get_id(),
+                               static_cast<uint32_t>(thread_indices.size()))
+                      .first;
+  }
+
+  event.thread_index = thread_iter->second;
+  trace_events.push_back(std::move(event));
+}
+
+bool AssetTrace::writeChromeTrace(const std::filesystem::path& trace_path) {
+  log_zone;
+
+  std::ofstream trace_file(trace_path.c_str());
+  if (!trace_file.is_open()) {
+    log_err_fmt("Failed to open asset trace %s", trace_path.string().c_str());
+    return false;
+  }
+
+  std::unique_lock<std::mutex> lock(trace_mutex);
+
+  // Chrome traces are in microseconds, so keep nanosecond precision
+  trace_file << std::fixed << std::setprecision(3);
+  trace_file << "{\"traceEvents\":[\n";
+
+  for (size_t i = 0; i < trace_events.size(); i++) {
+    const TraceEvent& event = trace_events[i];
+
+    trace_file << "{\"name\":\"" << getStageName(event.stage)
+               << "\",\"cat\":\"asset\",\"ph\":\"X\",\"pid\":1"
+               << ",\"tid\":" << event.thread_index
+               << ",\"ts\":" << event.start_ns / 1000.0
+               << ",\"dur\":" << event.duration_ns / 1000.0
+               << ",\"args\":{\"subject\":\"" << escapeJson(event.subject)
+               << "\"}}";
+
+    if (i + 1 < trace_events.size()) trace_file << ",";
+    trace_file << "\n";
+  }
+
+  trace_file << "]}\n";
+  trace_file.close();
+
+  log_msg_fmt("Wrote %zu asset trace events to %s", trace_events.size(),
+              trace_path.string().c_str());
+  return true;
+}
+
+void AssetTrace::logSummary(uint32_t top_num) {
+  std::unique_lock<std::mutex> lock(trace_mutex);
+
+  if (trace_events.empty()) {
+    log_msg("No asset loads were traced");
+    return;
+  }
+
+  log_msg("Asset load time by stage:");
+
+  int64_t stage_totals[STAGE_NUM] = {};
+  uint32_t stage_counts[STAGE_NUM] = {};
+
+  for (const auto& event : trace_events) {
+    uint32_t stage_index = static_cast<uint32_t>(event.stage);
+    stage_totals[stage_index] += event.duration_ns;
+    stage_counts[stage_index]++;
+  }
+
+  for (uint32_t i = 0; i < STAGE_NUM; i++) {
+    if (stage_counts[i] == 0) continue;
+
+    log_msg_fmt("  %-10s %10.3f ms over %u zones",
+                getStageName(static_cast<AssetTraceStage>(i)),
+                stage_totals[i] / 1e6, stage_counts[i]);
+  }
+
+  types::vector<const TraceEvent*> slowest;
+  slowest.reserve(trace_events.size());
+  for (const auto& event : trace_events) slowest.push_back(&event);
+
+  size_t shown_num = std::min<size_t>(top_num, slowest.size());
+  std::partial_sort(slowest.begin(), slowest.begin() + shown_num,
+                    slowest.end(),
+                    [](const TraceEvent* a, const TraceEvent* b) {
+                      return a->duration_ns > b->duration_ns;
+                    });
+
+  log_msg_fmt("Slowest %zu asset load zones:", shown_num);
+
+  for (size_t i = 0; i < shown_num; i++) {
+    log_msg_fmt("  %10.3f ms  %-10s %s", slowest[i]->duration_ns / 1e6,
+                getStageName(slowest[i]->stage), slowest[i]->subject.c_str());
+  }
+}
+
+AssetTraceZone::AssetTraceZone(AssetTraceStage stage, assets::AssetId id)
+    : enabled(AssetTrace::isEnabled()), stage(stage) {
+  if (!enabled) return;
+
+  subject = getAssetSubject(id);
+
+  sets_current_asset = true;
+  previous_asset = current_asset;
+  current_asset = id;
+
+  start = AssetTrace::Clock::now();
+}
+
+AssetTraceZone::AssetTraceZone(AssetTraceStage stage, const char* name)
+    : enabled(AssetTrace::isEnabled()), stage(stage) {
+  if (!enabled) return;
+
+  subject = name;
+  start = AssetTrace::Clock::now();
+}
+
+AssetTraceZone::AssetTraceZone(AssetTraceStage stage)
+    : enabled(AssetTrace::isEnabled()), stage(stage) {
+  if (!enabled) return;
+
+  if (current_asset != assets::NullAsset) {
+    subject = getAssetSubject(current_asset);
+  } else {
+    subject = "unknown asset";
+  }
+
+  start = AssetTrace::Clock::now();
+}
+
+AssetTraceZone::~AssetTraceZone() {
+  if (!enabled) return;
+
+  AssetTrace::record(stage, subject, start, AssetTrace::Clock::now());
+
+  if (sets_current_asset) current_asset = previous_asset;
+}
+
+}  // namespace core
+}  // namespace mondradiko
@@ -0,0 +1,81 @@
+// Copyright (c) 2020-2021 the Mondradiko contributors.
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+
+#include "types/assets/AssetTypes.h"
+#include "types/containers/string.h"
+
+namespace mondradiko {
+namespace core {
+
+enum class AssetTraceStage {
+  Retrieve,    // Filesystem::loadAsset(), including everything below
+  Lookup,      // Finding the asset's bundle and lump
+  LumpFault,   // Bringing an unloaded lump into memory
+  Hash,        // Verifying a lump's checksum
+  Decompress,  // Decompressing a lump, or one asset of a seekable lump
+  Verify,      // Verifying an asset's flatbuffer
+  Load,        // Asset::_load()
+  Upload       // Copying asset data to the GPU
+};
+
+/**
+ * @brief Records how long each stage of loading each asset takes.
+ *
+ * Unlike log_zone, this works without Tracy, and is meant for finding which
+ * bundles and assets to restructure. Tracing is disabled until enable() is
+ * called, after which every zone costs two clock reads and a locked append.
+ */
+class AssetTrace {
+ public:
+  static void enable();
+  static bool isEnabled();
+
+  // Writes every recorded zone as a Chrome trace (chrome://tracing, Perfetto)
+  static bool writeChromeTrace(const std::filesystem::path&);
+
+  // Logs the total time spent in each stage and the slowest zones
+  static void logSummary(uint32_t);
+
+  using Clock = std::chrono::steady_clock;
+
+  static void record(AssetTraceStage, const types::string&, Clock::time_point,
+                     Clock::time_point);
+};
+
+/**
+ * @brief RAII zone recording one AssetTraceStage.
+ *
+ * Zones for an asset ID also become the current asset of their thread, so
+ * nested zones that don't know which asset they're working on (e.g. GPU
+ * uploads inside of Asset::_load()) are attributed to it.
+ */
+class AssetTraceZone {
+ public:
+  AssetTraceZone(AssetTraceStage, assets::AssetId);
+  AssetTraceZone(AssetTraceStage, const char*);
+
+  // Attributed to the current asset of this thread
+  explicit AssetTraceZone(AssetTraceStage);
+
+  ~AssetTraceZone();
+
+  AssetTraceZone(const AssetTraceZone&) = delete;
+  AssetTraceZone& operator=(const AssetTraceZone&) = delete;
+
+ private:
+  bool enabled;
+  AssetTraceStage stage;
+  types::string subject;
+  AssetTrace::Clock::time_point start;
+
+  bool sets_current_asset = false;
+  assets::AssetId previous_asset;
+};
+
+}  // namespace core
+}  // namespace mondradiko
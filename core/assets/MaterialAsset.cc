@@ -12,6 +12,28 @@
 namespace mondradiko {
 namespace core {
 
+bool MaterialAsset::isLoaded() const {
+  if (!Asset::isLoaded()) return false;
+
+  // Dummy materials never reference textures
+  if (renderer == nullptr) return true;
+
+  // Textures are loaded asynchronously, so wait on all that are used
+  if (uniform.has_albedo_texture && !albedo_texture.isLoaded()) return false;
+  if (uniform.has_emissive_texture && !emissive_texture.isLoaded()) {
+    return false;
+  }
+  if (uniform.normal_map_scale > 0.0 && !normal_map_texture.isLoaded()) {
+    return false;
+  }
+  if (uniform.has_metal_roughness_texture &&
+      !metal_roughness_texture.isLoaded()) {
+    return false;
+  }
+
+  return true;
+}
+
 void MaterialAsset::updateTextureDescriptor(
     GpuDescriptorSet* descriptor) const {
   GpuImage* error_image = renderer->getErrorImage();
@@ -41,6 +63,13 @@ void MaterialAsset::updateTextureDescriptor(
   }
 }
 
+void MaterialAsset::_releaseReferences() {
+  albedo_texture = AssetHandle<TextureAsset>(nullptr);
+  emissive_texture = AssetHandle<TextureAsset>(nullptr);
+  normal_map_texture = AssetHandle<TextureAsset>(nullptr);
+  metal_roughness_texture = AssetHandle<TextureAsset>(nullptr);
+}
+
 bool MaterialAsset::_load(const assets::SerializedAsset* asset) {
   // Skip loading if we initialized as a dummy
   if (renderer == nullptr) return true;
@@ -48,7 +77,8 @@ bool MaterialAsset::_load(const assets::SerializedAsset* asset) {
   const assets::MaterialAsset* material = asset->material();
 
   if (material->albedo_texture() != NullAsset) {
-    albedo_texture = asset_pool->load<TextureAsset>(material->albedo_texture());
+    albedo_texture =
+        asset_pool->loadAsync<TextureAsset>(material->albedo_texture());
     uniform.has_albedo_texture = 1;
   } else {
     uniform.has_albedo_texture = 0;
@@ -56,7 +86,7 @@ bool MaterialAsset::_load(const assets::SerializedAsset* asset) {
 
   if (material->emissive_texture() != NullAsset) {
     emissive_texture =
-        asset_pool->load<TextureAsset>(material->emissive_texture());
+        asset_pool->loadAsync<TextureAsset>(material->emissive_texture());
     uniform.has_emissive_texture = 1;
   } else {
     uniform.has_emissive_texture = 0;
@@ -64,15 +94,15 @@ bool MaterialAsset::_load(const assets::SerializedAsset* asset) {
 
   if (material->normal_map_texture() != NullAsset) {
     normal_map_texture =
-        asset_pool->load<TextureAsset>(material->normal_map_texture());
+        asset_pool->loadAsync<TextureAsset>(material->normal_map_texture());
     uniform.normal_map_scale = material->normal_map_scale();
   } else {
     uniform.normal_map_scale = -1.0;
   }
 
   if (material->metal_roughness_texture() != NullAsset) {
-    metal_roughness_texture =
-        asset_pool->load<TextureAsset>(material->metal_roughness_texture());
+    metal_roughness_texture = asset_pool->loadAsync<TextureAsset>(
+        material->metal_roughness_texture());
     uniform.has_metal_roughness_texture = 1;
   } else {
     uniform.has_metal_roughness_texture = 0;
@@ -44,7 +44,7 @@ class MaterialAsset : public Asset {
       : asset_pool(asset_pool), renderer(renderer) {}
 
   // Override isLoaded() to include the textures
-  bool isLoaded() const final { return albedo_texture.isLoaded(); }
+  bool isLoaded() const final;
 
   const MaterialUniform& getUniform() const { return uniform; }
   bool isDoubleSided() const { return double_sided; }
@@ -54,6 +54,7 @@ class MaterialAsset : public Asset {
  protected:
   // Asset implementation
   bool _load(const assets::SerializedAsset*) final;
+  void _releaseReferences() final;
 
  private:
   AssetPool* asset_pool;
@@ -4,6 +4,7 @@
 #include "core/assets/MeshAsset.h"
 
 #include "core/assets/Asset.h"
+#include "core/assets/AssetTrace.h"
 #include "core/renderer/MeshPass.h"
 #include "core/renderer/Renderer.h"
 #include "log/log.h"
@@ -13,41 +14,147 @@
 namespace mondradiko {
 namespace core {
 
+MeshAsset::~MeshAsset() {
+  // Give this mesh's space in the pools back to the MeshPass
+  if (mesh_pass != nullptr) {
+    if (vertex_num > 0) mesh_pass->freeVertices(vertex_offset, vertex_num);
+    if (index_num > 0) {
+      if (short_indices) {
+        mesh_pass->freeShortIndices(index_offset, index_num);
+      } else {
+        mesh_pass->freeIndices(index_offset, index_num);
+      }
+    }
+  }
+}
+
 bool MeshAsset::_load(const assets::SerializedAsset* asset) {
   // Skip loading if we initialized as a dummy
   if (mesh_pass == nullptr) return true;
 
   const assets::MeshAsset* mesh = asset->mesh();
 
-  types::vector<MeshVertex> vertices(mesh->vertices()->size());
-  types::vector<MeshIndex> indices(mesh->indices()->size());
+  const MeshVertex* vertices = nullptr;
+  size_t new_vertex_num = 0;
+  types::vector<MeshVertex> decoded_vertices;
+
+  if (mesh->compact_vertices() != nullptr) {
+    // Compact vertices are already laid out for the GPU
+    static_assert(sizeof(MeshVertex) == sizeof(assets::MeshCompactVertex));
+    vertices =
+        reinterpret_cast<const MeshVertex*>(mesh->compact_vertices()->Data());
+    new_vertex_num = mesh->compact_vertices()->size();
+  } else if (mesh->vertices() != nullptr) {
+    decoded_vertices.resize(mesh->vertices()->size());
 
-  for (uint32_t i = 0; i < vertices.size(); i++) {
-    const assets::MeshVertex* vertex = mesh->vertices()->Get(i);
+    for (uint32_t i = 0; i < decoded_vertices.size(); i++) {
+      const assets::MeshVertex* vertex = mesh->vertices()->Get(i);
+      MeshVertex& decoded = decoded_vertices[i];
 
-    vertices[i].position = glm::make_vec3(vertex->position().v()->data());
-    vertices[i].tex_coord = glm::make_vec2(vertex->tex_coord().v()->data());
-    vertices[i].color = glm::make_vec3(vertex->color().v()->data());
-    vertices[i].normal = glm::make_vec3(vertex->normal().v()->data());
-    vertices[i].tangent = glm::make_vec3(vertex->tangent().v()->data());
+      glm::vec3 color = glm::make_vec3(vertex->color().v()->data());
+      glm::vec2 tex_coord = glm::make_vec2(vertex->tex_coord().v()->data());
+
+      decoded.position = glm::make_vec3(vertex->position().v()->data());
+      decoded.normal = assets::PackOctahedral(
+          glm::make_vec3(vertex->normal().v()->data()));
+      decoded.tangent = assets::PackOctahedral(
+          glm::make_vec3(vertex->tangent().v()->data()));
+      decoded.color = glm::packUnorm4x8(glm::vec4(color, 1.0f));
+      decoded.tex_coord = glm::packHalf2x16(tex_coord);
+    }
+
+    vertices = decoded_vertices.data();
+    new_vertex_num = decoded_vertices.size();
   }
 
-  for (uint32_t i = 0; i < indices.size(); i++) {
-    indices[i] = mesh->indices()->Get(i);
+  const void* indices = nullptr;
+  size_t new_index_num = 0;
+  bool new_short_indices = false;
+
+  if (mesh->short_indices() != nullptr) {
+    indices = mesh->short_indices()->data();
+    new_index_num = mesh->short_indices()->size();
+    new_short_indices = true;
+  } else if (mesh->indices() != nullptr) {
+    indices = mesh->indices()->data();
+    new_index_num = mesh->indices()->size();
+  }
+
+  {  // Find the bounding sphere
+    glm::vec3 min_position(0.0);
+    glm::vec3 max_position(0.0);
+
+    if (new_vertex_num > 0) {
+      min_position = max_position = vertices[0].position;
+    }
+
+    for (size_t i = 0; i < new_vertex_num; i++) {
+      min_position = glm::min(min_position, vertices[i].position);
+      max_position = glm::max(max_position, vertices[i].position);
+    }
+
+    bounds_center = (min_position + max_position) * 0.5f;
+    bounds_radius = 0.0f;
+
+    for (size_t i = 0; i < new_vertex_num; i++) {
+      bounds_radius = glm::max(
+          bounds_radius, glm::distance(bounds_center, vertices[i].position));
+    }
   }
 
-  vertex_offset = mesh_pass->allocateVertices(vertices.size());
-  index_num = indices.size();
-  index_offset = mesh_pass->allocateIndices(index_num);
+  {  // Read LODs
+    lods.clear();
+
+    if (mesh->lods() == nullptr || mesh->lods()->size() == 0) {
+      lods.push_back({0, new_index_num, 0.0f});
+    }
+
+    if (mesh->lods() != nullptr) {
+      for (const auto* mesh_lod : *mesh->lods()) {
+        size_t lod_end = mesh_lod->index_offset() + mesh_lod->index_num();
+        if (lod_end > new_index_num) {
+          log_err("Mesh LOD is out of range of its indices");
+          return false;
+        }
+
+        lods.push_back({mesh_lod->index_offset(), mesh_lod->index_num(),
+                        mesh_lod->error()});
+      }
+    }
+  }
+
+  vertex_offset = mesh_pass->allocateVertices(new_vertex_num);
+  if (vertex_offset == MeshPass::AllocationFailed) return false;
+  vertex_num = new_vertex_num;
+
+  if (new_short_indices) {
+    index_offset = mesh_pass->allocateShortIndices(new_index_num);
+  } else {
+    index_offset = mesh_pass->allocateIndices(new_index_num);
+  }
+
+  if (index_offset == MeshPass::AllocationFailed) return false;
+  index_num = new_index_num;
+  short_indices = new_short_indices;
+
+  for (auto& lod : lods) lod.index_offset += index_offset;
 
   Renderer* renderer = mesh_pass->getRenderer();
+  AssetTraceZone trace_zone(AssetTraceStage::Upload);
 
   renderer->transferDataToBuffer(
       mesh_pass->getVertexPool(), vertex_offset * sizeof(MeshVertex),
-      vertices.data(), vertices.size() * sizeof(MeshVertex));
-  renderer->transferDataToBuffer(
-      mesh_pass->getIndexPool(), index_offset * sizeof(MeshIndex),
-      indices.data(), indices.size() * sizeof(MeshIndex));
+      vertices, vertex_num * sizeof(MeshVertex));
+
+  if (short_indices) {
+    renderer->transferDataToBuffer(
+        mesh_pass->getShortIndexPool(), index_offset * sizeof(MeshShortIndex),
+        indices, index_num * sizeof(MeshShortIndex));
+  } else {
+    renderer->transferDataToBuffer(
+        mesh_pass->getIndexPool(), index_offset * sizeof(MeshIndex), indices,
+        index_num * sizeof(MeshIndex));
+  }
 
   return true;
 }
@@ -10,6 +10,7 @@
 #include "core/gpu/GpuPipeline.h"
 #include "lib/include/glm_headers.h"
 #include "lib/include/vulkan_headers.h"
+#include "types/containers/vector.h"
 
 namespace mondradiko {
 namespace core {
@@ -19,12 +20,13 @@ class GpuInstance;
 class GpuBuffer;
 class MeshPass;
 
+// Matches assets::MeshCompactVertex, so that it can be uploaded as-is
 struct MeshVertex {
   glm::vec3 position;
-  glm::vec3 normal;
-  glm::vec3 tangent;
-  glm::vec3 color;
-  glm::vec2 tex_coord;
+  uint32_t normal;     // Octahedral, decoded by the vertex shaders
+  uint32_t tangent;    // Octahedral, decoded by the vertex shaders
+  uint32_t color;      // RGBA8
+  uint32_t tex_coord;  // Two half floats
 
   static GpuPipeline::VertexBindings getVertexBindings() {
     // VkVertexInputBindingDescription{binding, stride, inputRate}
@@ -37,15 +39,18 @@ struct MeshVertex {
     // VkVertexInputAttributeDescription{location, binding, format, offset}
     return {
         {0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(MeshVertex, position)},
-        {1, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(MeshVertex, normal)},
-        {2, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(MeshVertex, tangent)},
-        {3, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(MeshVertex, color)},
-        {4, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(MeshVertex, tex_coord)},
+        {1, 0, VK_FORMAT_R16G16_SNORM, offsetof(MeshVertex, normal)},
+        {2, 0, VK_FORMAT_R16G16_SNORM, offsetof(MeshVertex, tangent)},
+        {3, 0, VK_FORMAT_R8G8B8A8_UNORM, offsetof(MeshVertex, color)},
+        {4, 0, VK_FORMAT_R16G16_SFLOAT, offsetof(MeshVertex, tex_coord)},
     };
   }
 };
 
+static_assert(sizeof(MeshVertex) == 28);
+
 using MeshIndex = uint32_t;
+using MeshShortIndex = uint16_t;
 
 class MeshAsset : public Asset {
  public:
@@ -54,21 +59,50 @@ class MeshAsset : public Asset {
   // Asset lifetime implementation
   MeshAsset() : mesh_pass(nullptr) {}
   explicit MeshAsset(MeshPass* mesh_pass) : mesh_pass(mesh_pass) {}
+  ~MeshAsset();
+
+  struct Lod {
+    // Into the MeshPass's index pool
+    size_t index_offset;
+    size_t index_num;
+
+    // Deviation from the full mesh, in the mesh's units
+    float error;
+  };
 
   size_t getVertexOffset() const { return vertex_offset; }
-  size_t getIndexOffset() const { return index_offset; }
-  size_t getIndexNum() const { return index_num; }
+
+  // Short indices live in the MeshPass's separate 16-bit index pool
+  bool hasShortIndices() const { return short_indices; }
+
+  // LOD 0 is always the full mesh, and the rest are progressively simpler
+  size_t getLodNum() const { return lods.size(); }
+  const Lod& getLod(size_t lod_index) const { return lods[lod_index]; }
+
+  // Bounding sphere, in the mesh's space
+  const glm::vec3& getBoundsCenter() const { return bounds_center; }
+  float getBoundsRadius() const { return bounds_radius; }
 
  protected:
   // Asset implementation
   bool _load(const assets::SerializedAsset*) final;
 
+  // The MeshPass's pools are freed in bulk at teardown
+  void _releaseReferences() final { mesh_pass = nullptr; }
+
  private:
   MeshPass* mesh_pass;
 
   size_t vertex_offset = 0;
+  size_t vertex_num = 0;
   size_t index_offset = 0;
   size_t index_num = 0;
+  bool short_indices = false;
+
+  types::vector<Lod> lods;
+
+  glm::vec3 bounds_center = glm::vec3(0.0);
+  float bounds_radius = 0.0f;
 };
 
 }  // namespace core
@@ -31,9 +31,24 @@ PrefabAsset::~PrefabAsset() {
   if (prefab != nullptr) delete prefab;
 }
 
+bool PrefabAsset::isPending() const {
+  if (Asset::isPending()) return true;
+
+  for (auto& child : children) {
+    if (child.isPending()) return true;
+  }
+
+  return false;
+}
+
 EntityId PrefabAsset::instantiate(World* world) const {
+  EntityId self_id = world->registry.create();
+  instantiate(world, self_id);
+  return self_id;
+}
+
+void PrefabAsset::instantiate(World* world, EntityId self_id) const {
   EntityRegistry* registry = &world->registry;
-  EntityId self_id = registry->create();
 
   initComponent<MeshRendererComponent>(asset_pool, registry, self_id,
                                        prefab->mesh_renderer);
@@ -62,8 +77,6 @@ EntityId PrefabAsset::instantiate(World* world) const {
       world->scripts.instantiateScript(self_id, script_asset, script_impl);
     }
   }
-
-  return self_id;
 }
 
 bool PrefabAsset::_load(const assets::SerializedAsset* asset) {
@@ -75,7 +88,7 @@ bool PrefabAsset::_load(const assets::SerializedAsset* asset) {
   children.resize(0);
 
   for (auto& child : prefab->children) {
-    children.push_back(asset_pool->load<PrefabAsset>(child));
+    children.push_back(asset_pool->loadAsync<PrefabAsset>(child));
   }
 
   return true;
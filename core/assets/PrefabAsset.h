@@ -24,11 +24,16 @@ class PrefabAsset : public Asset {
   explicit PrefabAsset(AssetPool* asset_pool) : asset_pool(asset_pool) {}
   ~PrefabAsset();
 
+  // Also pending while any of its children are
+  bool isPending() const final;
+
   EntityId instantiate(World*) const;
+  void instantiate(World*, EntityId) const;
 
  protected:
   // Asset implementation
   bool _load(const assets::SerializedAsset*) final;
+  void _releaseReferences() final { children.clear(); }
 
  private:
   AssetPool* asset_pool;
@@ -5,7 +5,9 @@
 
 #include "core/scripting/environment/ScriptEnvironment.h"
 #include "core/scripting/instance/ComponentScript.h"
+#include "log/log.h"
 #include "types/assets/ScriptAsset_generated.h"
+#include "types/assets/ScriptEngine.h"
 
 namespace mondradiko {
 namespace core {
@@ -27,6 +29,26 @@ bool ScriptAsset::_load(const assets::SerializedAsset* asset) {
     return false;
   }
 
+  // Skip JIT compilation if the bundler's native code runs on this engine
+  const auto* precompiled = script->precompiled();
+  const auto* precompiled_engine = script->precompiled_engine();
+  if (ScriptEnvironment::isTrustingPrecompiledScripts() &&
+      precompiled != nullptr && precompiled->size() > 0 &&
+      precompiled_engine != nullptr) {
+    if (precompiled_engine->str() == assets::getScriptEngineKey()) {
+      script_module = scripts->loadPrecompiledModule(
+          reinterpret_cast<const char*>(precompiled->data()),
+          precompiled->size());
+
+      if (script_module != nullptr) return true;
+      log_wrn("Failed to load precompiled script; compiling it instead");
+    } else {
+      log_dbg_fmt("Script was precompiled for %s, not %s; compiling it",
+                  precompiled_engine->c_str(),
+                  assets::getScriptEngineKey().c_str());
+    }
+  }
+
   const auto& module_data = script->data();
   switch (script->type()) {
     case assets::ScriptType::WasmBinary: {
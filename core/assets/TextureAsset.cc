@@ -3,6 +3,9 @@
 
 #include "core/assets/TextureAsset.h"
 
+#include <algorithm>
+
+#include "core/assets/AssetTrace.h"
 #include "core/gpu/GpuImage.h"
 #include "core/gpu/GpuInstance.h"
 #include "core/renderer/MeshPass.h"
@@ -13,6 +16,21 @@
 namespace mondradiko {
 namespace core {
 
+// Size in bytes of a single mip level with the given extent
+static size_t getLevelSize(assets::TextureFormat format, uint32_t width,
+                           uint32_t height) {
+  // Only RGBA8 is supported for uncompressed textures
+  if (format == assets::TextureFormat::Raw) {
+    return static_cast<size_t>(width) * height * 4;
+  }
+
+  // Block-compressed levels are rounded up to whole 4x4 blocks
+  size_t block_size = format == assets::TextureFormat::BC1 ? 8 : 16;
+  size_t blocks_wide = (width + 3) / 4;
+  size_t blocks_high = (height + 3) / 4;
+  return blocks_wide * blocks_high * block_size;
+}
+
 TextureAsset::~TextureAsset() {
   if (image) delete image;
 }
@@ -22,33 +40,139 @@ bool TextureAsset::_load(const assets::SerializedAsset* asset) {
   if (mesh_pass == nullptr) return true;
 
   const assets::TextureAsset* texture = asset->texture();
+  GpuInstance* gpu = mesh_pass->getRenderer()->getGpu();
 
   VkFormat texture_format;
 
-  // TODO(marceline-cramer) Support all texture types
+  switch (texture->format()) {
+    case assets::TextureFormat::Raw: {
+      // TODO(marceline-cramer) Support all texture types
+
+      if (texture->components() != 4) {
+        log_err("Unsupported number of components");
+        return false;
+      }
+
+      if (texture->component_type() != assets::TextureComponentType::UByte) {
+        log_err("Unsupported component type");
+        return false;
+      }
+
+      if (texture->srgb()) {
+        texture_format = VK_FORMAT_R8G8B8A8_SRGB;
+      } else {
+        texture_format = VK_FORMAT_R8G8B8A8_UNORM;
+      }
+
+      break;
+    }
+
+    case assets::TextureFormat::BC1: {
+      if (texture->srgb()) {
+        texture_format = VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+      } else {
+        texture_format = VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+      }
+
+      break;
+    }
+
+    case assets::TextureFormat::BC5: {
+      texture_format = VK_FORMAT_BC5_UNORM_BLOCK;
+      break;
+    }
+
+    case assets::TextureFormat::BC7: {
+      if (texture->srgb()) {
+        texture_format = VK_FORMAT_BC7_SRGB_BLOCK;
+      } else {
+        texture_format = VK_FORMAT_BC7_UNORM_BLOCK;
+      }
+
+      break;
+    }
 
-  if (texture->components() != 4) {
-    log_ftl("Unsupported number of components");
+    default: {
+      log_err("Unrecognized texture format");
+      return false;
+    }
   }
 
-  if (texture->component_type() != assets::TextureComponentType::UByte) {
-    log_ftl("Unsupported component type");
+  if (texture->format() != assets::TextureFormat::Raw &&
+      !gpu->enabled_features.textureCompressionBC) {
+    log_err("GPU does not support block-compressed textures; bundle with "
+            "compress_textures = false to load this texture");
+    return false;
   }
 
-  if (texture->srgb()) {
-    texture_format = VK_FORMAT_R8G8B8A8_SRGB;
-  } else {
-    texture_format = VK_FORMAT_R8G8B8A8_UNORM;
+  const auto* data = texture->data();
+  if (data == nullptr) {
+    log_err("Texture has no data");
+    return false;
+  }
+
+  if (texture->width() == 0 || texture->height() == 0) {
+    log_err("Texture has no extent");
+    return false;
+  }
+
+  // Textures bundled without mip levels have only their full size
+  const auto* mip_levels = texture->mip_levels();
+  bool has_mip_levels = mip_levels != nullptr && mip_levels->size() > 0;
+  uint32_t level_num = has_mip_levels ? mip_levels->size() : 1;
+
+  uint32_t max_extent = std::max(texture->width(), texture->height());
+  uint32_t max_level_num = 1;
+  while (max_extent >> max_level_num) max_level_num++;
+
+  if (level_num > max_level_num) {
+    log_err_fmt("Texture has too many mip levels (%u)", level_num);
+    return false;
+  }
+
+  types::vector<size_t> level_offsets;
+  for (uint32_t i = 0; i < level_num; i++) {
+    uint32_t level_width = std::max(1u, texture->width() >> i);
+    uint32_t level_height = std::max(1u, texture->height() >> i);
+    size_t expected_size =
+        getLevelSize(texture->format(), level_width, level_height);
+
+    if (!has_mip_levels) {
+      if (data->size() != expected_size) {
+        log_err_fmt("Texture data is %u bytes; expected %zu", data->size(),
+                    expected_size);
+        return false;
+      }
+
+      level_offsets.push_back(0);
+      continue;
+    }
+
+    const auto* level = mip_levels->Get(i);
+
+    if (level->size() != expected_size) {
+      log_err_fmt("Texture mip level %u is %u bytes; expected %zu", i,
+                  level->size(), expected_size);
+      return false;
+    }
+
+    if (static_cast<size_t>(level->offset()) + level->size() > data->size()) {
+      log_err("Texture mip level is out of bounds");
+      return false;
+    }
+
+    level_offsets.push_back(level->offset());
   }
 
   image =
-      new GpuImage(mesh_pass->getRenderer()->getGpu(), texture_format,
-                   texture->width(), texture->height(),
+      new GpuImage(gpu, texture_format, texture->width(), texture->height(),
                    VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-                   VMA_MEMORY_USAGE_GPU_ONLY);
+                   VMA_MEMORY_USAGE_GPU_ONLY, level_offsets.size());
 
+  AssetTraceZone trace_zone(AssetTraceStage::Upload);
   image->transitionLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-  mesh_pass->getRenderer()->transferDataToImage(image, texture->data()->data());
+  mesh_pass->getRenderer()->transferDataToImage(image, data->data(),
+                                                data->size(), level_offsets);
   image->transitionLayout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
   return true;
@@ -9,8 +9,9 @@ namespace mondradiko {
 namespace core {
 
 void MeshRendererComponent::refresh(AssetPool* asset_pool) {
-  mesh_asset = asset_pool->load<MeshAsset>(_data.mesh_asset());
-  material_asset = asset_pool->load<MaterialAsset>(_data.material_asset());
+  mesh_asset = asset_pool->loadAsync<MeshAsset>(_data.mesh_asset());
+  material_asset =
+      asset_pool->loadAsync<MaterialAsset>(_data.material_asset());
 }
 
 // Template specialization to build UpdateComponents event
@@ -37,7 +37,7 @@ class FileCVar : public CVarValueInterface {
     _path = std::filesystem::absolute(_root / value);
 
     if (!std::filesystem::exists(_path)) {
-      log_wrn_fmt("File %s does not exist", _path.c_str());
+      log_wrn_fmt("File %s does not exist", _path.string().c_str());
     }
 
     return true;
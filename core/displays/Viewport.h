@@ -52,6 +52,7 @@ class Viewport {
   virtual ~Viewport() { _destroyImages(); }
 
   uint32_t getSampleCount() { return _sample_count; }
+  uint32_t getImageHeight() { return _image_height; }
   GpuImage* getHdrImage() { return _hdr_image.get(); }
   GpuImage* getOverlayImage() { return _overlay_image.get(); }
   GpuImage* getDepthImage() { return _depth_image.get(); }
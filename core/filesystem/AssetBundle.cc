@@ -3,10 +3,16 @@
 
 #include "core/filesystem/AssetBundle.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <fstream>
 
 #include "core/assets/AssetPool.h"
+#include "core/assets/AssetTrace.h"
+#include "core/filesystem/LumpVerificationCache.h"
+#include "core/filesystem/MappedFile.h"
+#include "core/jobs/JobQueue.h"
 #include "log/log.h"
 #include "types/assets/Registry_generated.h"
 #include "types/build_config.h"
@@ -18,25 +24,44 @@ namespace core {
 // using is ok here because it'd be inconvenient not to use it
 using namespace assets;  // NOLINT
 
-AssetBundle::AssetBundle(const std::filesystem::path& bundle_root)
-    : bundle_root(bundle_root) {}
+AssetBundle::AssetBundle(const std::filesystem::path& bundle_root,
+                         JobQueue* jobs,
+                         const VerificationOptions& verification_options)
+    : bundle_root(bundle_root),
+      jobs(jobs),
+      verification_options(verification_options) {}
 
 AssetBundle::~AssetBundle() {
-  for (const auto& cached_lump : lump_cache) {
-    if (cached_lump.lump) delete cached_lump.lump;
+  cancel_verification = true;
+
+  // Verification jobs reference this bundle, so let them finish first
+  for (auto cached_lump : lump_cache) {
+    if (cached_lump == nullptr) continue;
+    if (cached_lump->verified.valid()) cached_lump->verified.wait();
+  }
+
+  if (verification_cache != nullptr) {
+    verification_cache->save();
+    delete verification_cache;
   }
+
+  for (auto cached_lump : lump_cache) {
+    if (cached_lump == nullptr) continue;
+    if (cached_lump->lump) delete cached_lump->lump;
+    delete cached_lump;
+  }
+
+  // Packed lumps point into this
+  if (pack_file != nullptr) delete pack_file;
 }
 
 AssetResult AssetBundle::loadRegistry(const char* registry_name) {
-  types::vector<char> registry_data;
-  const Registry* registry = nullptr;
-
   {
-    log_zone_named("Load and validate registry file");
+    log_zone_named("Load registry file");
 
     auto registry_path = bundle_root / registry_name;
 
-    log_msg_fmt("Opening asset bundle at %s", registry_path.c_str());
+    log_msg_fmt("Opening asset bundle at %s", registry_path.string().c_str());
 
     if (!std::filesystem::exists(registry_path)) {
       return AssetResult::FileNotFound;
@@ -52,15 +77,104 @@ AssetResult AssetBundle::loadRegistry(const char* registry_name) {
     registry_file.read(registry_data.data(), length);
     registry_file.close();
 
+    registry_bytes = registry_data.data();
+    registry_size = registry_data.size();
+  }
+
+  return _loadRegistry();
+}
+
+AssetResult AssetBundle::loadPack(const char* pack_name) {
+  {
+    log_zone_named("Map bundle pack");
+
+    pack_path = bundle_root / pack_name;
+
+    log_msg_fmt("Opening asset bundle pack at %s", pack_path.string().c_str());
+
+    if (!std::filesystem::exists(pack_path)) {
+      return AssetResult::FileNotFound;
+    }
+
+    pack_file = new MappedFile(pack_path);
+    if (!pack_file->isMapped()) {
+      log_err("Failed to map bundle pack");
+      return AssetResult::BadFile;
+    }
+
+    // Lumps are faulted in sparsely, so don't read ahead past them
+    pack_file->advise(0, pack_file->getSize(), MappedFile::Access::Random);
+  }
+
+  {
+    log_zone_named("Read bundle pack header");
+
+    const char* pack_data = pack_file->getData();
+    size_t pack_size = pack_file->getSize();
+
+    BundlePackHeader header;
+    if (pack_size < sizeof(header)) return AssetResult::UnexpectedEof;
+    memcpy(&header, pack_data, sizeof(header));
+
+    if (header.magic != BUNDLE_PACK_MAGIC) {
+      log_err("Bundle pack has an invalid header");
+      return AssetResult::BadFile;
+    }
+
+    if (header.version != BUNDLE_PACK_VERSION) {
+      return AssetResult::WrongVersion;
+    }
+
+    if (header.lump_count > ASSET_REGISTRY_MAX_LUMPS) {
+      return AssetResult::BadSize;
+    }
+
+    size_t lump_table_end =
+        sizeof(header) + header.lump_count * sizeof(BundlePackLump);
+    if (lump_table_end > pack_size) return AssetResult::UnexpectedEof;
+
+    pack_lumps.resize(header.lump_count);
+    memcpy(pack_lumps.data(), pack_data + sizeof(header),
+           header.lump_count * sizeof(BundlePackLump));
+
+    for (const auto& pack_lump : pack_lumps) {
+      if (pack_lump.offset > pack_size ||
+          pack_lump.size > pack_size - pack_lump.offset) {
+        log_err("Bundle pack lump exceeds pack size");
+        return AssetResult::UnexpectedEof;
+      }
+    }
+
+    if (header.registry_offset > pack_size ||
+        header.registry_size > pack_size - header.registry_offset) {
+      log_err("Bundle pack registry exceeds pack size");
+      return AssetResult::UnexpectedEof;
+    }
+
+    // Read in place; the mapping outlives every lookup into the registry
+    registry_bytes = pack_data + header.registry_offset;
+    registry_size = header.registry_size;
+    pack_file->advise(header.registry_offset, header.registry_size,
+                      MappedFile::Access::WillNeed);
+  }
+
+  return _loadRegistry();
+}
+
+AssetResult AssetBundle::_loadRegistry() {
+  const Registry* registry = nullptr;
+
+  {
+    log_zone_named("Validate registry");
+
     flatbuffers::Verifier verifier(
-        reinterpret_cast<const uint8_t*>(registry_data.data()),
-        registry_data.size());
+        reinterpret_cast<const uint8_t*>(registry_bytes), registry_size);
     if (!VerifyRegistryBuffer(verifier)) {
       log_err("Asset validation failed");
       return AssetResult::InvalidBuffer;
     }
 
-    registry = GetRegistry(registry_data.data());
+    registry = GetRegistry(registry_bytes);
   }
 
   {
@@ -111,13 +225,56 @@ AssetResult AssetBundle::loadRegistry(const char* registry_name) {
       initial_prefabs.push_back(
           static_cast<AssetId>(registry->initial_prefabs()->Get(i)));
     }
+
+    auto registry_dependencies = registry->prefab_dependencies();
+    if (registry_dependencies != nullptr) {
+      for (uint32_t i = 0; i < registry_dependencies->size(); i++) {
+        auto dependencies = registry_dependencies->Get(i);
+        if (dependencies->assets() == nullptr) continue;
+
+        prefab_dependencies.emplace(
+            dependencies->prefab(),
+            types::vector<AssetId>(dependencies->assets()->begin(),
+                                   dependencies->assets()->end()));
+      }
+    }
+  }
+
+  {
+    log_zone_named("Load compression dictionaries");
+
+    auto registry_dictionaries = registry->dictionaries();
+    if (registry_dictionaries != nullptr) {
+      for (uint32_t i = 0; i < registry_dictionaries->size(); i++) {
+        auto dictionary = registry_dictionaries->Get(i);
+
+        if (dictionary->id() == 0 || dictionary->data() == nullptr) {
+          log_err("Invalid compression dictionary in registry");
+          return AssetResult::BadContents;
+        }
+
+        auto dictionary_data =
+            reinterpret_cast<const char*>(dictionary->data()->data());
+        dictionaries.emplace(
+            dictionary->id(),
+            types::vector<char>(dictionary_data,
+                                dictionary_data + dictionary->data()->size()));
+      }
+    }
   }
 
+  // Older registries need their asset lookup rebuilt from the lump entries
+  bool use_registry_index = registry->asset_index() != nullptr;
+
+  // Decompressed size of each lump, for bounding the asset index entries
+  types::vector<uint64_t> lump_data_sizes;
+
   {
     log_zone_named("Load lumps");
 
     uint32_t lump_count = registry->lumps()->size();
-    lump_cache.resize(lump_count, {/*.lump=*/nullptr});
+    lump_cache.resize(lump_count, nullptr);
+    lump_data_sizes.resize(lump_count, 0);
 
     for (uint32_t lump_index = 0; lump_index < lump_count; lump_index++) {
       const LumpEntry* lump_entry = registry->lumps()->Get(lump_index);
@@ -130,25 +287,60 @@ AssetResult AssetBundle::loadRegistry(const char* registry_name) {
         return AssetResult::BadSize;
       }
 
-      uint32_t asset_offset = 0;
+      auto compressed_ranges = lump_entry->compressed_ranges();
+      bool is_seekable =
+          isSeekableCompression(lump_entry->compression_method());
 
-      for (uint32_t asset_index = 0; asset_index < asset_count; asset_index++) {
-        const AssetEntry* asset_entry = lump_entry->assets()->Get(asset_index);
+      if (is_seekable && (compressed_ranges == nullptr ||
+                          compressed_ranges->size() != asset_count)) {
+        log_err("Seekable lump is missing compressed ranges");
+        return AssetResult::BadContents;
+      }
 
-        auto lookup_iter = asset_lookup.find(asset_entry->id());
+      uint64_t asset_offset = 0;
 
-        if (lookup_iter != asset_lookup.end()) {
-          return AssetResult::DuplicateAsset;
-        }
+      if (use_registry_index && lump_entry->data_size() > 0) {
+        // The index has every asset's location, so only the size is needed
+        asset_offset = lump_entry->data_size();
+      } else {
+        for (uint32_t asset_index = 0; asset_index < asset_count;
+             asset_index++) {
+          const AssetEntry* asset_entry =
+              lump_entry->assets()->Get(asset_index);
+
+          if (use_registry_index) {
+            asset_offset += asset_entry->size();
+            continue;
+          }
+
+          auto lookup_iter = asset_lookup.find(asset_entry->id());
+
+          if (lookup_iter != asset_lookup.end()) {
+            return AssetResult::DuplicateAsset;
+          }
+
+          AssetLookupEntry lookup_entry{};
+          lookup_entry.lump_index = lump_index;
+          lookup_entry.offset = asset_offset;
+          lookup_entry.size = asset_entry->size();
+
+          if (is_seekable) {
+            const CompressedRange* range = compressed_ranges->Get(asset_index);
 
-        AssetLookupEntry lookup_entry{};
-        lookup_entry.lump_index = lump_index;
-        lookup_entry.offset = asset_offset;
-        lookup_entry.size = asset_entry->size();
+            if (static_cast<uint64_t>(range->offset()) + range->size() >
+                lump_entry->file_size()) {
+              log_err("Compressed asset range exceeds lump file size");
+              return AssetResult::BadSize;
+            }
 
-        asset_lookup.emplace(asset_entry->id(), lookup_entry);
+            lookup_entry.compressed_offset = range->offset();
+            lookup_entry.compressed_size = range->size();
+          }
 
-        asset_offset += asset_entry->size();
+          asset_lookup.emplace(asset_entry->id(), lookup_entry);
+
+          asset_offset += asset_entry->size();
+        }
       }
 
       // asset_offset now represents the size of the whole lump
@@ -156,47 +348,236 @@ AssetResult AssetBundle::loadRegistry(const char* registry_name) {
         return AssetResult::BadSize;
       }
 
-      lump_cache[lump_index].lump = nullptr;
-      lump_cache[lump_index].file_size = lump_entry->file_size();
-      lump_cache[lump_index].hash_method = lump_entry->hash_method();
-      lump_cache[lump_index].checksum = lump_entry->checksum();
-      lump_cache[lump_index].compression_method =
-          lump_entry->compression_method();
+      lump_data_sizes[lump_index] = asset_offset;
+
+      const types::vector<char>* dictionary = nullptr;
+
+      if (lump_entry->dictionary_id() != 0) {
+        auto dictionary_iter = dictionaries.find(lump_entry->dictionary_id());
+        if (dictionary_iter == dictionaries.end()) {
+          log_err_fmt("Lump %u references missing compression dictionary",
+                      lump_index);
+          return AssetResult::BadContents;
+        }
+
+        dictionary = &dictionary_iter->second;
+      }
+
+      LumpCacheEntry* cached_lump = new LumpCacheEntry;
+      cached_lump->lump = nullptr;
+      cached_lump->dictionary = dictionary;
+      cached_lump->file_size = lump_entry->file_size();
+      cached_lump->hash_method = lump_entry->hash_method();
+      cached_lump->checksum = lump_entry->checksum();
+      cached_lump->compression_method = lump_entry->compression_method();
+      lump_cache[lump_index] = cached_lump;
     }
   }
 
+  if (use_registry_index) {
+    log_zone_named("Validate registry asset index");
+
+    auto index = registry->asset_index();
+
+    for (uint32_t i = 0; i < index->size(); i++) {
+      const AssetIndexEntry* index_entry = index->Get(i);
+
+      if (i > 0) {
+        AssetId previous_id = index->Get(i - 1)->id();
+        if (index_entry->id() == previous_id) {
+          return AssetResult::DuplicateAsset;
+        } else if (index_entry->id() < previous_id) {
+          log_err("Registry asset index is not sorted");
+          return AssetResult::BadContents;
+        }
+      }
+
+      if (index_entry->lump_index() >= lump_cache.size()) {
+        log_err("Registry asset index references a missing lump");
+        return AssetResult::BadContents;
+      }
+
+      if (static_cast<uint64_t>(index_entry->offset()) + index_entry->size() >
+          lump_data_sizes[index_entry->lump_index()]) {
+        log_err("Registry asset index entry exceeds its lump's size");
+        return AssetResult::BadSize;
+      }
+
+      auto cached_lump = lump_cache[index_entry->lump_index()];
+      if (isSeekableCompression(cached_lump->compression_method) &&
+          static_cast<uint64_t>(index_entry->compressed_offset()) +
+                  index_entry->compressed_size() >
+              cached_lump->file_size) {
+        log_err("Compressed asset range exceeds lump file size");
+        return AssetResult::BadSize;
+      }
+    }
+
+    // The entries are structs, so they're laid out contiguously
+    registry_index = reinterpret_cast<const AssetIndexEntry*>(index->Data());
+    registry_index_size = index->size();
+  }
+
   {
     log_zone_named("Build and validate lump cache");
 
-    for (uint32_t i = 0; i < lump_cache.size(); i++) {
-      auto lump_file = generateLumpName(i);
-      auto lump_path = bundle_root / lump_file;
+    if (verification_options.use_cache) {
+      verification_cache =
+          new LumpVerificationCache(bundle_root / "verification.toml");
+    }
+
+    if (pack_file != nullptr && pack_lumps.size() != lump_cache.size()) {
+      log_err("Bundle pack and registry disagree on lump count");
+      return AssetResult::BadContents;
+    }
 
-      if (!std::filesystem::exists(lump_path)) {
+    for (uint32_t i = 0; i < lump_cache.size(); i++) {
+      if (pack_file == nullptr &&
+          !std::filesystem::exists(bundle_root / generateLumpName(i))) {
         return AssetResult::FileNotFound;
       }
 
-      auto& cached_lump = lump_cache[i];
-      AssetLump lump(lump_path);
+      auto cached_lump = lump_cache[i];
+      AssetLump* lump = _openLump(i);
+      bool correct_size = lump->assertFileSize(cached_lump->file_size);
+      delete lump;
 
-      if (!lump.assertFileSize(cached_lump.file_size)) {
-        return AssetResult::BadSize;
-      }
+      if (!correct_size) return AssetResult::BadSize;
+    }
+
+    // Queue all of the hashes before waiting on any of them, so that lumps
+    // are verified in parallel
+    for (uint32_t i = 0; i < lump_cache.size(); i++) {
+      lump_cache[i]->verified = _verifyLump(i);
+    }
 
-      if (!lump.assertHash(cached_lump.hash_method, cached_lump.checksum)) {
-        return AssetResult::InvalidChecksum;
+    if (!verification_options.background) {
+      for (auto cached_lump : lump_cache) {
+        if (!cached_lump->verified.get()) {
+          return AssetResult::InvalidChecksum;
+        }
       }
+
+      if (verification_cache != nullptr) verification_cache->save();
     }
   }
 
   return AssetResult::Success;
 }
 
+bool AssetBundle::_lookUpAsset(AssetId id, AssetLookupEntry* lookup_entry) {
+  if (registry_index == nullptr) {
+    auto lookup_iter = asset_lookup.find(id);
+    if (lookup_iter == asset_lookup.end()) return false;
+
+    *lookup_entry = lookup_iter->second;
+    return true;
+  }
+
+  const AssetIndexEntry* index_end = registry_index + registry_index_size;
+  const AssetIndexEntry* index_entry =
+      std::lower_bound(registry_index, index_end, id,
+                       [](const AssetIndexEntry& entry, AssetId id) {
+                         return entry.id() < id;
+                       });
+
+  if (index_entry == index_end || index_entry->id() != id) return false;
+
+  lookup_entry->lump_index = index_entry->lump_index();
+  lookup_entry->offset = index_entry->offset();
+  lookup_entry->size = index_entry->size();
+  lookup_entry->compressed_offset = index_entry->compressed_offset();
+  lookup_entry->compressed_size = index_entry->compressed_size();
+  return true;
+}
+
+AssetLump* AssetBundle::_openLump(uint32_t lump_index) {
+  auto lump_path = _getLumpPath(lump_index);
+
+  if (pack_file != nullptr) {
+    const BundlePackLump& pack_lump = pack_lumps[lump_index];
+    return new AssetLump(lump_path, pack_file->getData() + pack_lump.offset,
+                         pack_lump.size);
+  } else {
+    return new AssetLump(lump_path);
+  }
+}
+
+std::filesystem::path AssetBundle::_getLumpPath(uint32_t lump_index) {
+  // Packed lumps are named as if the pack were a directory
+  if (pack_file != nullptr) return pack_path / generateLumpName(lump_index);
+  return bundle_root / generateLumpName(lump_index);
+}
+
+std::shared_future<bool> AssetBundle::_verifyLump(uint32_t lump_index) {
+  auto cached_lump = lump_cache[lump_index];
+  auto lump_path = _getLumpPath(lump_index);
+  LumpHashMethod hash_method = cached_lump->hash_method;
+  LumpHash checksum = cached_lump->checksum;
+
+  // Packed lumps are stamped with the pack file, and cached by their name
+  // relative to the bundle root
+  auto lump_file = lump_path.lexically_relative(bundle_root).string();
+  auto stamp_path = pack_file != nullptr ? pack_path : lump_path;
+
+  // Stamp the file before hashing so a concurrent write is never cached
+  LumpVerificationCache::FileStamp stamp;
+  bool has_stamp = LumpVerificationCache::getFileStamp(stamp_path, &stamp);
+
+  if (verification_cache != nullptr && has_stamp &&
+      verification_cache->isVerified(lump_file, stamp, checksum)) {
+    log_dbg_fmt("Lump %s was previously verified", lump_path.string().c_str());
+
+    std::promise<bool> cached_result;
+    cached_result.set_value(true);
+    return cached_result.get_future().share();
+  }
+
+  // Queued before any load that could wait on it, so the FIFO job queue
+  // always runs this ahead of loads blocked on the result
+  auto verify = [this, lump_index, lump_file, hash_method, checksum, stamp,
+                 has_stamp]() {
+    if (cancel_verification) return false;
+
+    if (pack_file != nullptr) {
+      const BundlePackLump& pack_lump = pack_lumps[lump_index];
+      pack_file->advise(pack_lump.offset, pack_lump.size,
+                        MappedFile::Access::Sequential);
+    }
+
+    bool hash_passed;
+    {
+      AssetTraceZone trace_zone(AssetTraceStage::Hash,
+                                lump_file.c_str());
+      AssetLump* lump = _openLump(lump_index);
+      hash_passed = lump->assertHash(hash_method, checksum);
+      delete lump;
+    }
+
+    // Packed lumps are paged back in on demand once they're loaded
+    if (pack_file != nullptr) {
+      const BundlePackLump& pack_lump = pack_lumps[lump_index];
+      pack_file->advise(pack_lump.offset, pack_lump.size,
+                        MappedFile::Access::DontNeed);
+    }
+
+    if (!hash_passed) return false;
+
+    if (verification_cache != nullptr && has_stamp) {
+      verification_cache->markVerified(lump_file, stamp, checksum);
+    }
+
+    return true;
+  };
+
+  return jobs->submit(verify).share();
+}
+
 void AssetBundle::getChecksums(types::vector<LumpHash>& checksums) {
   checksums.resize(lump_cache.size());
 
   for (uint32_t i = 0; i < lump_cache.size(); i++) {
-    checksums[i] = lump_cache[i].checksum;
+    checksums[i] = lump_cache[i]->checksum;
   }
 }
 
@@ -209,36 +590,191 @@ void AssetBundle::getInitialPrefabs(types::vector<AssetId>& prefabs) {
   prefabs = initial_prefabs;
 }
 
+void AssetBundle::getIndexedAssets(
+    types::vector<IndexedAsset>* indexed_assets) {
+  if (registry_index != nullptr) {
+    for (uint32_t i = 0; i < registry_index_size; i++) {
+      const AssetIndexEntry& index_entry = registry_index[i];
+
+      IndexedAsset indexed_asset;
+      indexed_asset.id = index_entry.id();
+      indexed_asset.entry.lump_index = index_entry.lump_index();
+      indexed_asset.entry.offset = index_entry.offset();
+      indexed_asset.entry.size = index_entry.size();
+      indexed_asset.entry.compressed_offset = index_entry.compressed_offset();
+      indexed_asset.entry.compressed_size = index_entry.compressed_size();
+      indexed_assets->push_back(indexed_asset);
+    }
+
+    return;
+  }
+
+  size_t first_new = indexed_assets->size();
+
+  for (const auto& lookup : asset_lookup) {
+    indexed_assets->push_back({lookup.first, lookup.second});
+  }
+
+  std::sort(indexed_assets->begin() + first_new, indexed_assets->end(),
+            [](const IndexedAsset& a, const IndexedAsset& b) {
+              return a.id < b.id;
+            });
+}
+
+bool AssetBundle::getPrefabDependencies(AssetId prefab,
+                                        types::vector<AssetId>* dependencies) {
+  auto iter = prefab_dependencies.find(prefab);
+  if (iter == prefab_dependencies.end()) return false;
+
+  *dependencies = iter->second;
+  return true;
+}
+
 bool AssetBundle::isAssetRegistered(AssetId id) {
-  return asset_lookup.find(id) != asset_lookup.end();
+  AssetLookupEntry lookup_entry;
+  return _lookUpAsset(id, &lookup_entry);
 }
 
 bool AssetBundle::loadAsset(const SerializedAsset** asset, AssetId id) {
+  AssetLookupEntry lookup_entry;
+  if (!_lookUpAsset(id, &lookup_entry)) {
+    log_err_fmt("Asset 0x%0x is not registered in this bundle", id);
+    return false;
+  }
+
+  return loadAsset(asset, lookup_entry);
+}
+
+void AssetBundle::releaseAsset(AssetId id) {
+  AssetLookupEntry lookup_entry;
+  if (_lookUpAsset(id, &lookup_entry)) releaseAsset(lookup_entry);
+}
+
+bool AssetBundle::loadAsset(const SerializedAsset** asset,
+                            const AssetLookupEntry& stored_asset) {
   // TODO(marceline-cramer) Better error checking and logging
 
-  auto stored_asset = asset_lookup.find(id)->second;
   auto lump_index = stored_asset.lump_index;
 
-  auto& cached_lump = lump_cache[lump_index];
+  // This may be called from I/O worker threads
+  auto cached_lump = lump_cache[lump_index];
+  std::unique_lock<std::mutex> lock(cached_lump->mutex);
 
-  if (cached_lump.lump == nullptr) {
-    cached_lump.lump =
-        new AssetLump(bundle_root / generateLumpName(lump_index));
+  // Evicted lumps are transparently faulted back in here
+  if (cached_lump->lump == nullptr) {
+    AssetTraceZone fault_zone(AssetTraceStage::LumpFault);
 
-    if (!cached_lump.lump->assertFileSize(cached_lump.file_size)) {
+    // Lumps were already hashed when the bundle was opened, but background
+    // verification may still be in progress
+    if (!cached_lump->verified.get()) {
+      log_err_fmt("Lump %u failed verification", lump_index);
       return false;
     }
 
-    if (!cached_lump.lump->assertHash(cached_lump.hash_method,
-                                      cached_lump.checksum)) {
-      return false;
+    if (pack_file != nullptr) {
+      const BundlePackLump& pack_lump = pack_lumps[lump_index];
+      pack_file->advise(pack_lump.offset, pack_lump.size,
+                        MappedFile::Access::WillNeed);
+    }
+
+    AssetLump* lump = _openLump(lump_index);
+    lump->decompress(cached_lump->compression_method, cached_lump->dictionary);
+    cached_lump->lump = lump;
+
+    // Fully decompressed lumps don't read from the pack anymore
+    bool fully_decompressed =
+        cached_lump->compression_method != LumpCompressionMethod::None &&
+        !isSeekableCompression(cached_lump->compression_method);
+    if (pack_file != nullptr && fully_decompressed) {
+      const BundlePackLump& pack_lump = pack_lumps[lump_index];
+      pack_file->advise(pack_lump.offset, pack_lump.size,
+                        MappedFile::Access::DontNeed);
     }
+  }
+
+  bool loaded_successfully;
+
+  if (isSeekableCompression(cached_lump->compression_method)) {
+    loaded_successfully = cached_lump->lump->loadCompressedAsset(
+        asset, stored_asset.offset, stored_asset.size,
+        stored_asset.compressed_offset, stored_asset.compressed_size);
+  } else {
+    loaded_successfully = cached_lump->lump->loadAsset(
+        asset, stored_asset.offset, stored_asset.size);
+  }
+
+  cached_lump->resident_size = cached_lump->lump->getResidentSize();
+  cached_lump->last_used =
+      std::chrono::steady_clock::now().time_since_epoch().count();
+
+  if (loaded_successfully) cached_lump->pin_count++;
+  return loaded_successfully;
+}
+
+void AssetBundle::releaseAsset(const AssetLookupEntry& stored_asset) {
+  auto cached_lump = lump_cache[stored_asset.lump_index];
+  if (cached_lump->pin_count == 0) {
+    log_err_fmt("Released lump %u more times than it was loaded",
+                stored_asset.lump_index);
+    return;
+  }
+
+  cached_lump->pin_count--;
+}
+
+size_t AssetBundle::getResidentSize() {
+  size_t resident_size = 0;
+
+  for (auto cached_lump : lump_cache) {
+    resident_size += cached_lump->resident_size;
+  }
+
+  return resident_size;
+}
+
+bool AssetBundle::findEvictableLump(uint32_t* lump_index, int64_t* last_used) {
+  bool found = false;
+
+  for (uint32_t i = 0; i < lump_cache.size(); i++) {
+    auto cached_lump = lump_cache[i];
+
+    if (cached_lump->resident_size == 0) continue;
+    if (cached_lump->pin_count > 0) continue;
+
+    int64_t lump_last_used = cached_lump->last_used;
+    if (found && lump_last_used >= *last_used) continue;
+
+    *lump_index = i;
+    *last_used = lump_last_used;
+    found = true;
+  }
+
+  return found;
+}
+
+size_t AssetBundle::evictLump(uint32_t lump_index) {
+  auto cached_lump = lump_cache[lump_index];
+  std::unique_lock<std::mutex> lock(cached_lump->mutex);
+
+  // The lump may have been pinned since it was picked
+  if (cached_lump->lump == nullptr || cached_lump->pin_count > 0) return 0;
+
+  log_dbg_fmt("Evicting lump %u from %s", lump_index,
+              bundle_root.string().c_str());
+
+  size_t evicted_size = cached_lump->lump->getResidentSize();
+  delete cached_lump->lump;
+  cached_lump->lump = nullptr;
+  cached_lump->resident_size = 0;
 
-    cached_lump.lump->decompress(cached_lump.compression_method);
+  // Packed lumps share one mapping, so drop their pages explicitly
+  if (pack_file != nullptr) {
+    const BundlePackLump& pack_lump = pack_lumps[lump_index];
+    pack_file->advise(pack_lump.offset, pack_lump.size,
+                      MappedFile::Access::DontNeed);
   }
 
-  return cached_lump.lump->loadAsset(asset, stored_asset.offset,
-                                     stored_asset.size);
+  return evicted_size;
 }
 
 }  // namespace core
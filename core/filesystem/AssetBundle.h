@@ -3,54 +3,154 @@
 
 #pragma once
 
+#include <atomic>
 #include <filesystem>
+#include <future>
+#include <mutex>
 
 #include "core/filesystem/AssetLump.h"
 #include "types/assets/AssetTypes.h"
+#include "types/assets/BundlePack.h"
 #include "types/containers/string.h"
 #include "types/containers/unordered_map.h"
 #include "types/containers/vector.h"
 
 namespace mondradiko {
+
+// Forward declarations
+namespace assets {
+struct AssetIndexEntry;
+}  // namespace assets
+
 namespace core {
 
+// Forward declarations
+class JobQueue;
+class LumpVerificationCache;
+class MappedFile;
+
 class AssetBundle {
  public:
-  explicit AssetBundle(const std::filesystem::path&);
+  struct VerificationOptions {
+    // Don't block loadRegistry() on hashing; loads wait per-lump instead
+    bool background = false;
+
+    // Skip lumps recorded as verified in the bundle's sidecar cache
+    bool use_cache = true;
+  };
+
+  struct AssetLookupEntry {
+    uint32_t lump_index;
+    uint32_t offset;
+    uint32_t size;
+
+    // Only used by seekable compression methods
+    uint32_t compressed_offset;
+    uint32_t compressed_size;
+  };
+
+  struct IndexedAsset {
+    assets::AssetId id;
+    AssetLookupEntry entry;
+  };
+
+  AssetBundle(const std::filesystem::path&, JobQueue*,
+              const VerificationOptions&);
   ~AssetBundle();
 
   assets::AssetResult loadRegistry(const char*);
 
+  // Opens a single-file bundle pack instead of a registry and lump files
+  assets::AssetResult loadPack(const char*);
+
   void getChecksums(types::vector<assets::LumpHash>&);
   void getBundleExports(types::unordered_map<types::string, assets::AssetId>*);
   void getInitialPrefabs(types::vector<assets::AssetId>&);
+
+  // Returns false if the bundle doesn't record the prefab's dependencies
+  bool getPrefabDependencies(assets::AssetId, types::vector<assets::AssetId>*);
   bool isAssetRegistered(assets::AssetId);
+
+  // Appends every asset in this bundle, sorted by ID
+  void getIndexedAssets(types::vector<IndexedAsset>*);
+
+  // Pins the asset's lump in memory until releaseAsset() is called
   bool loadAsset(const assets::SerializedAsset**, assets::AssetId);
+  void releaseAsset(assets::AssetId);
+
+  // Skips the lookup for callers that already have the asset's entry
+  bool loadAsset(const assets::SerializedAsset**, const AssetLookupEntry&);
+  void releaseAsset(const AssetLookupEntry&);
+
+  // Lump eviction, driven by the Filesystem's memory budget
+  size_t getResidentSize();
+  bool findEvictableLump(uint32_t*, int64_t*);
+  size_t evictLump(uint32_t);
 
  private:
   std::filesystem::path bundle_root;
+  JobQueue* jobs;
+  VerificationOptions verification_options;
+  LumpVerificationCache* verification_cache = nullptr;
+
+  // Lets queued verification jobs bail out when the bundle is destroyed
+  std::atomic<bool> cancel_verification{false};
 
   types::unordered_map<types::string, assets::AssetId> bundle_exports;
 
   types::vector<assets::AssetId> initial_prefabs;
+  types::unordered_map<assets::AssetId, types::vector<assets::AssetId>>
+      prefab_dependencies;
 
-  struct AssetLookupEntry {
-    uint32_t lump_index;
-    uint32_t offset;
-    uint32_t size;
-  };
+  // Only set for bundle packs
+  std::filesystem::path pack_path;
+  MappedFile* pack_file = nullptr;
+  types::vector<assets::BundlePackLump> pack_lumps;
 
+  // Only filled for loose registries; packs point into the mapping instead
+  types::vector<char> registry_data;
+
+  // Kept readable so that the asset index can be queried in place
+  const char* registry_bytes = nullptr;
+  size_t registry_size = 0;
+  const assets::AssetIndexEntry* registry_index = nullptr;
+  uint32_t registry_index_size = 0;
+
+  // Built from the lump entries for registries without an asset index
   types::unordered_map<assets::AssetId, AssetLookupEntry> asset_lookup;
 
+  bool _lookUpAsset(assets::AssetId, AssetLookupEntry*);
+
+  // Compression dictionaries, indexed by dictionary ID
+  types::unordered_map<uint32_t, types::vector<char>> dictionaries;
+
+  // Entries are locked individually so that worker threads can fault in
+  // different lumps at the same time
   struct LumpCacheEntry {
+    std::mutex mutex;
+
     AssetLump* lump;
     size_t file_size;
     assets::LumpCompressionMethod compression_method;
+    const types::vector<char>* dictionary;
     assets::LumpHashMethod hash_method;
     assets::LumpHash checksum;
+
+    // Resolves to whether the lump passed its checksum
+    std::shared_future<bool> verified;
+
+    // Readable without locking, for picking lumps to evict
+    std::atomic<uint32_t> pin_count{0};
+    std::atomic<int64_t> last_used{0};
+    std::atomic<size_t> resident_size{0};
   };
 
-  types::vector<LumpCacheEntry> lump_cache;
+  types::vector<LumpCacheEntry*> lump_cache;
+
+  assets::AssetResult _loadRegistry();
+  AssetLump* _openLump(uint32_t);
+  std::filesystem::path _getLumpPath(uint32_t);
+  std::shared_future<bool> _verifyLump(uint32_t);
 };
 
 }  // namespace core
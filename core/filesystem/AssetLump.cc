@@ -3,12 +3,17 @@
 
 #include "core/filesystem/AssetLump.h"
 
+#include <cstring>
 #include <fstream>
 
+#include "core/assets/AssetTrace.h"
+#include "core/filesystem/MappedFile.h"
 #include "log/log.h"
+#include "lz4.h"       // NOLINT
 #include "lz4frame.h"  // NOLINT
 #include "types/containers/vector.h"
 #include "xxhash.h"  // NOLINT
+#include "zstd.h"    // NOLINT
 
 namespace mondradiko {
 namespace core {
@@ -16,27 +21,43 @@ namespace core {
 // using is ok here because it'd be inconvenient not to use it
 using namespace assets;  // NOLINT
 
-const uint32_t ASSET_LOAD_CHUNK_SIZE = 4 * 1024;  // 4 KiB
-static_assert(ASSET_LOAD_CHUNK_SIZE >= LZ4F_HEADER_SIZE_MAX);
+const uint32_t ASSET_HASH_CHUNK_SIZE = 1024 * 1024;  // 1 MiB
 
 AssetLump::AssetLump(const std::filesystem::path& lump_path)
     : lump_path(lump_path) {
   log_zone;
-  log_dbg_fmt("Loading lump %s", lump_path.c_str());
+  log_dbg_fmt("Loading lump %s", lump_path.string().c_str());
+}
+
+AssetLump::AssetLump(const std::filesystem::path& lump_path,
+                     const char* packed_data, size_t packed_size)
+    : lump_path(lump_path), packed_data(packed_data), packed_size(packed_size) {
+  log_zone;
+  log_dbg_fmt("Loading packed lump %s", lump_path.string().c_str());
 }
 
 AssetLump::~AssetLump() {
   log_zone;
-  log_dbg_fmt("Unloading lump %s", lump_path.c_str());
+  log_dbg_fmt("Unloading lump %s", lump_path.string().c_str());
+
+  if (decompressed_data) delete[] decompressed_data;
+  if (mapped_file) delete mapped_file;
+
+  for (auto& decompressed_asset : decompressed_assets) {
+    delete[] decompressed_asset.second;
+  }
 
-  if (loaded_data) delete[] loaded_data;
+  if (zstd_context) ZSTD_freeDCtx(zstd_context);
+  if (zstd_dictionary) ZSTD_freeDDict(zstd_dictionary);
 }
 
 bool AssetLump::assertFileSize(size_t check_size) {
   log_zone;
-  log_inf_fmt("Asserting size of lump file %s", lump_path.c_str());
+  log_inf_fmt("Asserting size of lump file %s", lump_path.string().c_str());
 
-  size_t lump_length = std::filesystem::file_size(lump_path);
+  size_t lump_length = packed_data != nullptr
+                           ? packed_size
+                           : std::filesystem::file_size(lump_path);
 
   if (lump_length != check_size) {
     log_err_fmt(
@@ -50,46 +71,58 @@ bool AssetLump::assertFileSize(size_t check_size) {
 
 bool AssetLump::assertHash(LumpHashMethod hash_method, LumpHash checksum) {
   log_zone;
-  log_inf_fmt("Asserting hash from lump %s", lump_path.c_str());
+  log_inf_fmt("Asserting hash from lump %s", lump_path.string().c_str());
 
   LumpHash computed_hash;
 
-  std::ifstream lump_file(lump_path.c_str(), std::ifstream::binary);
-
   switch (hash_method) {
     case LumpHashMethod::xxHash: {
       log_inf("Hashing lump with xxHash");
 
-      char buffer[ASSET_LOAD_CHUNK_SIZE];
+      if (packed_data != nullptr) {
+        computed_hash =
+            static_cast<LumpHash>(XXH3_64bits(packed_data, packed_size));
+        break;
+      }
+
+      // Hash the whole lump in one pass straight out of the page cache
+      MappedFile mapped_lump(lump_path);
+      if (mapped_lump.isMapped()) {
+        computed_hash = static_cast<LumpHash>(
+            XXH3_64bits(mapped_lump.getData(), mapped_lump.getSize()));
+        break;
+      }
+
+      std::ifstream lump_file(lump_path.c_str(), std::ifstream::binary);
+      types::vector<char> buffer(ASSET_HASH_CHUNK_SIZE);
       XXH3_state_t* hash_state = XXH3_createState();
       XXH3_64bits_reset(hash_state);
 
       while (!lump_file.eof()) {
-        lump_file.read(buffer, sizeof(buffer));
+        lump_file.read(buffer.data(), buffer.size());
         auto bytes_read = lump_file.gcount();
-        if (bytes_read) XXH3_64bits_update(hash_state, buffer, bytes_read);
+        if (bytes_read) {
+          XXH3_64bits_update(hash_state, buffer.data(), bytes_read);
+        }
       }
 
       computed_hash = static_cast<LumpHash>(XXH3_64bits_digest(hash_state));
       XXH3_freeState(hash_state);
+      lump_file.close();
       break;
     }
 
     case LumpHashMethod::None: {
       log_inf("Lump has no hash method; approving");
-      lump_file.close();
       return true;
     }
 
     default: {
       log_err("Unrecognized lump hash method");
-      lump_file.close();
       return false;
     }
   }  // switch (hash_method)
 
-  lump_file.close();
-
   if (computed_hash == checksum) {
     log_inf_fmt("Checksum passed with value 0x%016lx", checksum);
     return true;
@@ -100,85 +133,129 @@ bool AssetLump::assertHash(LumpHashMethod hash_method, LumpHash checksum) {
   }
 }
 
-void AssetLump::decompress(LumpCompressionMethod compression_method) {
+void AssetLump::decompress(LumpCompressionMethod compression_method,
+                           const types::vector<char>* dictionary) {
   if (loaded_data) return;
   log_zone;
 
-  std::ifstream lump_file(lump_path.c_str(), std::ifstream::binary);
-  lump_file.seekg(0, std::ifstream::end);
-  size_t file_size = lump_file.tellg();
-  lump_file.seekg(0);
+  AssetTraceZone trace_zone(AssetTraceStage::Decompress,
+                            lump_path.filename().string().c_str());
+
+  this->compression_method = compression_method;
+
+  bool uses_zstd = compression_method == LumpCompressionMethod::Zstd ||
+                   compression_method == LumpCompressionMethod::ZstdSeekable;
+
+  if (uses_zstd) {
+    zstd_context = ZSTD_createDCtx();
+
+    if (dictionary != nullptr) {
+      zstd_dictionary =
+          ZSTD_createDDict(dictionary->data(), dictionary->size());
+      ZSTD_DCtx_refDDict(zstd_context, zstd_dictionary);
+    }
+  }
+
+  // Lumps are decompressed (or used as-is) straight out of memory: either
+  // their range of a bundle pack, or a mapping of their own file
+  const char* source_data = packed_data;
+  size_t source_size = packed_size;
+  types::vector<char> source_buffer;
+
+  if (source_data == nullptr) {
+    mapped_file = new MappedFile(lump_path);
+
+    if (mapped_file->isMapped()) {
+      source_data = mapped_file->getData();
+      source_size = mapped_file->getSize();
+    } else {
+      log_wrn_fmt("Failed to map lump %s; reading it instead",
+                  lump_path.string().c_str());
+      delete mapped_file;
+      mapped_file = nullptr;
+
+      std::ifstream lump_file(lump_path.c_str(), std::ifstream::binary);
+      lump_file.seekg(0, std::ifstream::end);
+      source_buffer.resize(lump_file.tellg());
+      lump_file.seekg(0);
+      lump_file.read(source_buffer.data(), source_buffer.size());
+      lump_file.close();
+
+      source_data = source_buffer.data();
+      source_size = source_buffer.size();
+    }
+  }
 
   switch (compression_method) {
     case LumpCompressionMethod::LZ4: {
-      log_inf_fmt("Decompressing lump %s with LZ4", lump_path.c_str());
+      log_inf_fmt("Decompressing lump %s with LZ4", lump_path.string().c_str());
 
       LZ4F_dctx* context;
       LZ4F_createDecompressionContext(&context, LZ4F_VERSION);
 
-      types::vector<char> buffer(ASSET_LOAD_CHUNK_SIZE);
+      LZ4F_frameInfo_t frame_info;
+      size_t header_size = source_size;
+      size_t result =
+          LZ4F_getFrameInfo(context, &frame_info, source_data, &header_size);
 
-      {
-        lump_file.read(buffer.data(), buffer.size());
-        size_t bytes_read = lump_file.gcount();
+      if (LZ4F_isError(result)) {
+        log_ftl_fmt("Failed to read LZ4 frame info: %s",
+                    LZ4F_getErrorName(result));
+      }
 
-        LZ4F_frameInfo_t frame_info;
-        size_t result =
-            LZ4F_getFrameInfo(context, &frame_info, buffer.data(), &bytes_read);
+      loaded_size = frame_info.contentSize;
 
-        if (LZ4F_isError(result)) {
-          log_ftl_fmt("Failed to read LZ4 frame info: %s",
-                      LZ4F_getErrorName(result));
-        }
+      if (loaded_size == 0) {
+        log_ftl("LZ4 compressed lump must contain content size");
+      }
 
-        loaded_size = frame_info.contentSize;
+      decompressed_data = new char[loaded_size];
+      loaded_data = decompressed_data;
 
-        if (loaded_size == 0) {
-          log_ftl("LZ4 compressed lump must contain content size");
-        }
+      size_t decompressed_size = loaded_size;
+      size_t bytes_consumed = source_size - header_size;
+      result = LZ4F_decompress(context, decompressed_data, &decompressed_size,
+                               source_data + header_size, &bytes_consumed,
+                               nullptr);
 
-        loaded_data = new char[loaded_size];
-        buffer.resize(result);
-        lump_file.seekg(bytes_read);
+      if (LZ4F_isError(result)) {
+        log_err_fmt("LZ4 decompression failed: %s", LZ4F_getErrorName(result));
+      } else if (decompressed_size != loaded_size) {
+        log_err("LZ4 decompression underflow");
       }
 
-      int remaining_size = loaded_size;
-      char* decompressed_data = loaded_data;
+      LZ4F_freeDecompressionContext(context);
+      break;
+    }
 
-      while (!lump_file.eof()) {
-        lump_file.read(buffer.data(), buffer.size());
-        size_t bytes_read = lump_file.gcount();
-
-        size_t decompressed_size = remaining_size;
-        size_t bytes_consumed = bytes_read;
-        size_t buf_hint =
-            LZ4F_decompress(context, decompressed_data, &decompressed_size,
-                            buffer.data(), &bytes_consumed, nullptr);
-
-        if (LZ4F_isError(buf_hint)) {
-          log_err_fmt("LZ4 decompression failed: %s",
-                      LZ4F_getErrorName(buf_hint));
-          break;
-        }
+    case LumpCompressionMethod::Zstd: {
+      log_inf_fmt("Decompressing lump %s with Zstd",
+                  lump_path.string().c_str());
 
-        decompressed_data += decompressed_size;
-        remaining_size -= decompressed_size;
+      unsigned long long content_size =  // NOLINT
+          ZSTD_getFrameContentSize(source_data, source_size);
 
-        if (remaining_size < 0) {
-          log_err("LZ4 decompression overflow");
-          break;
-        }
+      if (content_size == ZSTD_CONTENTSIZE_ERROR ||
+          content_size == ZSTD_CONTENTSIZE_UNKNOWN) {
+        log_ftl("Zstd compressed lump must contain content size");
+      }
 
-        if (bytes_consumed < bytes_read) {
-          log_err("LZ4 decompression underflow");
-        }
+      loaded_size = content_size;
+      decompressed_data = new char[loaded_size];
+      loaded_data = decompressed_data;
 
-        if (buf_hint <= ASSET_LOAD_CHUNK_SIZE) {
-          buffer.resize(buf_hint);
-        }
+      // The context already references this lump's dictionary, if any
+      size_t result =
+          ZSTD_decompressDCtx(zstd_context, decompressed_data, loaded_size,
+                              source_data, source_size);
+
+      if (ZSTD_isError(result)) {
+        log_err_fmt("Zstd decompression failed: %s", ZSTD_getErrorName(result));
+      } else if (result != loaded_size) {
+        log_err("Zstd decompression underflow");
+        loaded_size = result;
       }
 
-      LZ4F_freeDecompressionContext(context);
       break;
     }
 
@@ -186,17 +263,32 @@ void AssetLump::decompress(LumpCompressionMethod compression_method) {
       log_wrn("Unrecognized lump compression method");
     }
 
+    // Seekable lumps are decompressed per-asset in loadCompressedAsset()
+    case LumpCompressionMethod::LZ4Seekable:
+    case LumpCompressionMethod::ZstdSeekable:
     case LumpCompressionMethod::None: {
-      log_dbg_fmt("Loading lump %s directly from disk", lump_path.c_str());
+      loaded_size = source_size;
+
+      // Mapped lumps are read in place, so that assets are paged in on demand
+      // and the page cache is shared between processes
+      if (source_buffer.empty()) {
+        log_dbg_fmt("Reading lump %s in place", lump_path.string().c_str());
+        loaded_data = source_data;
+        return;
+      }
 
-      loaded_size = file_size;
-      loaded_data = new char[loaded_size];
-      lump_file.read(loaded_data, loaded_size);
-      break;
+      decompressed_data = new char[loaded_size];
+      loaded_data = decompressed_data;
+      memcpy(decompressed_data, source_data, loaded_size);
+      return;
     }
   }
 
-  lump_file.close();
+  // The compressed source isn't needed anymore
+  if (mapped_file != nullptr) {
+    delete mapped_file;
+    mapped_file = nullptr;
+  }
 }
 
 bool AssetLump::loadAsset(const SerializedAsset** asset, size_t offset,
@@ -206,8 +298,74 @@ bool AssetLump::loadAsset(const SerializedAsset** asset, size_t offset,
     return false;
   }
 
-  const uint8_t* asset_data =
-      reinterpret_cast<const uint8_t*>(loaded_data + offset);
+  return verifyAsset(asset, loaded_data + offset, size);
+}
+
+bool AssetLump::loadCompressedAsset(const SerializedAsset** asset,
+                                    size_t offset, size_t size,
+                                    size_t compressed_offset,
+                                    size_t compressed_size) {
+  auto iter = decompressed_assets.find(offset);
+  if (iter != decompressed_assets.end()) {
+    return verifyAsset(asset, iter->second, size);
+  }
+
+  if (compressed_offset + compressed_size > loaded_size) {
+    log_err_fmt("Compressed asset range exceeds lump size of 0x%0lx",
+                loaded_size);
+    return false;
+  }
+
+  log_zone;
+
+  const char* compressed_data = loaded_data + compressed_offset;
+  char* asset_data = new char[size];
+  bool decompressed = false;
+
+  {
+    AssetTraceZone trace_zone(AssetTraceStage::Decompress);
+
+    switch (compression_method) {
+      case LumpCompressionMethod::LZ4Seekable: {
+        int decompressed_size = LZ4_decompress_safe(
+            compressed_data, asset_data, compressed_size, size);
+        decompressed = decompressed_size >= 0 &&
+                       static_cast<size_t>(decompressed_size) == size;
+        break;
+      }
+
+      case LumpCompressionMethod::ZstdSeekable: {
+        // The context already references this lump's dictionary, if any
+        size_t decompressed_size = ZSTD_decompressDCtx(
+            zstd_context, asset_data, size, compressed_data, compressed_size);
+        decompressed = !ZSTD_isError(decompressed_size) &&
+                       decompressed_size == size;
+        break;
+      }
+
+      default: {
+        log_err("Lump compression method is not seekable");
+        break;
+      }
+    }
+  }
+
+  if (!decompressed) {
+    log_err_fmt("Decompression of asset at 0x%0lx failed", offset);
+    delete[] asset_data;
+    return false;
+  }
+
+  decompressed_assets.emplace(offset, asset_data);
+  decompressed_assets_size += size;
+  return verifyAsset(asset, asset_data, size);
+}
+
+bool AssetLump::verifyAsset(const SerializedAsset** asset, const char* data,
+                            size_t size) {
+  AssetTraceZone trace_zone(AssetTraceStage::Verify);
+
+  const uint8_t* asset_data = reinterpret_cast<const uint8_t*>(data);
 
   flatbuffers::Verifier verifier(asset_data, size);
   if (!VerifySerializedAssetBuffer(verifier)) {
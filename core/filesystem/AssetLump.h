@@ -8,27 +8,74 @@
 #include "types/assets/AssetTypes.h"
 #include "types/assets/SerializedAsset_generated.h"
 #include "types/assets/types_generated.h"
+#include "types/containers/unordered_map.h"
+#include "types/containers/vector.h"
+
+// Forward declarations
+struct ZSTD_DCtx_s;
+struct ZSTD_DDict_s;
 
 namespace mondradiko {
 namespace core {
 
+// Forward declarations
+class MappedFile;
+
 class AssetLump {
  public:
   explicit AssetLump(const std::filesystem::path&);
+
+  // Reads the lump from memory owned by the caller, i.e. a mapped bundle pack
+  // (the path is only used for logging)
+  AssetLump(const std::filesystem::path&, const char*, size_t);
+
   ~AssetLump();
 
   bool assertFileSize(size_t);
   bool assertHash(assets::LumpHashMethod, assets::LumpHash);
 
-  void decompress(assets::LumpCompressionMethod);
+  void decompress(assets::LumpCompressionMethod,
+                  const types::vector<char>* dictionary = nullptr);
 
   bool loadAsset(const assets::SerializedAsset**, size_t, size_t);
 
+  // Bytes of lump data currently held in memory
+  size_t getResidentSize() const {
+    return loaded_size + decompressed_assets_size;
+  }
+
+  // Decompresses a single asset out of a seekable lump
+  bool loadCompressedAsset(const assets::SerializedAsset**, size_t, size_t,
+                           size_t, size_t);
+
  private:
   std::filesystem::path lump_path;
+  assets::LumpCompressionMethod compression_method =
+      assets::LumpCompressionMethod::None;
+
+  // Only set for packed lumps
+  const char* packed_data = nullptr;
+  size_t packed_size = 0;
+
+  size_t loaded_size = 0;
+  const char* loaded_data = nullptr;
+
+  // Backing storage for loaded_data, unless the lump is packed; only one of
+  // these is ever used
+  char* decompressed_data = nullptr;
+  MappedFile* mapped_file = nullptr;
+
+  // Seekable lumps keep loaded_data compressed, and decompress each asset
+  // into its own buffer (keyed by uncompressed offset) the first time it's
+  // loaded, so the SerializedAsset stays valid for the lump's lifetime
+  types::unordered_map<size_t, char*> decompressed_assets;
+  size_t decompressed_assets_size = 0;
+
+  // Zstandard state is kept for seekable lumps' per-asset decompression
+  ZSTD_DCtx_s* zstd_context = nullptr;
+  ZSTD_DDict_s* zstd_dictionary = nullptr;
 
-  size_t loaded_size;
-  char* loaded_data = nullptr;
+  bool verifyAsset(const assets::SerializedAsset**, const char*, size_t);
 };
 
 }  // namespace core
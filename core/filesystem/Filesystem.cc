@@ -3,14 +3,31 @@
 
 #include "core/filesystem/Filesystem.h"
 
+#include <algorithm>
+#include <future>
 #include <sstream>
+#include <string>
+#include <utility>
 
 #include "core/assets/AssetPool.h"
+#include "core/assets/AssetTrace.h"
+#include "core/cvars/BoolCVar.h"
+#include "core/cvars/CVarScope.h"
+#include "core/cvars/FloatCVar.h"
 #include "log/log.h"
+#include "types/containers/map.h"
 
 namespace mondradiko {
 namespace core {
 
+void Filesystem::initCVars(CVarScope* cvars) {
+  CVarScope* filesystem = cvars->addChild("filesystem");
+
+  filesystem->addValue<BoolCVar>("background_verification");
+  filesystem->addValue<BoolCVar>("verification_cache");
+  filesystem->addValue<FloatCVar>("lump_budget_mb", 16.0, 65536.0);
+}
+
 Filesystem::Filesystem() { log_zone; }
 
 Filesystem::~Filesystem() {
@@ -19,9 +36,46 @@ Filesystem::~Filesystem() {
   }
 }
 
-bool Filesystem::loadAssetBundle(const std::filesystem::path& bundle_root) {
-  AssetBundle* asset_bundle = new AssetBundle(bundle_root);
-  auto result = asset_bundle->loadRegistry("registry.bin");
+void Filesystem::setCVars(const CVarScope* parent_scope) {
+  cvars = parent_scope->getChild("filesystem");
+
+  double lump_budget_mb = cvars->get<FloatCVar>("lump_budget_mb");
+  lump_budget = static_cast<size_t>(lump_budget_mb * 1024.0 * 1024.0);
+}
+
+bool Filesystem::loadAssetBundle(const std::filesystem::path& bundle_path) {
+  AssetBundle::VerificationOptions verification_options;
+
+  if (cvars != nullptr) {
+    verification_options.background =
+        cvars->get<BoolCVar>("background_verification");
+    verification_options.use_cache =
+        cvars->get<BoolCVar>("verification_cache");
+  }
+
+  // Bundles are either a directory with a registry and lump files, or a
+  // single-file pack, which may also be inside of a directory
+  std::filesystem::path bundle_root = bundle_path;
+  std::string pack_name;
+
+  if (std::filesystem::is_regular_file(bundle_path)) {
+    bundle_root = bundle_path.parent_path();
+    pack_name = bundle_path.filename().string();
+  } else if (!std::filesystem::exists(bundle_path / "registry.bin") &&
+             std::filesystem::exists(bundle_path / assets::BUNDLE_PACK_NAME)) {
+    pack_name = assets::BUNDLE_PACK_NAME;
+  }
+
+  AssetBundle* asset_bundle =
+      new AssetBundle(bundle_root, &io_jobs, verification_options);
+
+  assets::AssetResult result;
+  if (pack_name.empty()) {
+    result = asset_bundle->loadRegistry("registry.bin");
+  } else {
+    result = asset_bundle->loadPack(pack_name.c_str());
+  }
+
   if (result != assets::AssetResult::Success) {
     const char* error_string = assets::getAssetResultString(result);
     log_err_fmt("Failed to load asset bundle registry: %s", error_string);
@@ -30,6 +84,7 @@ bool Filesystem::loadAssetBundle(const std::filesystem::path& bundle_root) {
   }
 
   asset_bundles.push_back(asset_bundle);
+  indexBundleAssets(asset_bundles.size() - 1);
   return true;
 }
 
@@ -67,27 +122,189 @@ void Filesystem::getInitialPrefabs(types::vector<assets::AssetId>& prefabs) {
   }
 }
 
+void Filesystem::prefetchPrefabs(
+    const types::vector<assets::AssetId>& prefabs) {
+  log_zone;
+
+  // Group assets by their bundle and lump, so each lump is only faulted in
+  // once and different lumps are decompressed in parallel
+  using LumpKey = std::pair<uint32_t, uint32_t>;
+  types::map<LumpKey, types::vector<AssetBundle::AssetLookupEntry>> lumps;
+  size_t asset_num = 0;
+
+  for (auto prefab : prefabs) {
+    const AssetLocation* prefab_location = findAssetLocation(prefab);
+    if (prefab_location == nullptr) continue;
+
+    types::vector<AssetId> dependencies;
+    AssetBundle* prefab_bundle = asset_bundles[prefab_location->bundle_index];
+    if (!prefab_bundle->getPrefabDependencies(prefab, &dependencies)) {
+      dependencies = {prefab};
+    }
+
+    for (auto dependency : dependencies) {
+      const AssetLocation* location = findAssetLocation(dependency);
+      if (location == nullptr) continue;
+
+      LumpKey lump_key(location->bundle_index, location->entry.lump_index);
+      lumps[lump_key].push_back(location->entry);
+      asset_num++;
+    }
+  }
+
+  types::vector<std::future<void>> prefetches;
+
+  for (const auto& lump : lumps) {
+    AssetBundle* asset_bundle = asset_bundles[lump.first.first];
+    const auto* entries = &lump.second;
+
+    prefetches.push_back(io_jobs.submit([asset_bundle, entries]() {
+      for (const auto& entry : *entries) {
+        // Seekable lumps also cache each decompressed asset
+        const assets::SerializedAsset* asset;
+        if (asset_bundle->loadAsset(&asset, entry)) {
+          asset_bundle->releaseAsset(entry);
+        }
+      }
+    }));
+  }
+
+  for (auto& prefetch : prefetches) prefetch.wait();
+
+  log_inf_fmt("Prefetched %zu assets from %zu lumps", asset_num, lumps.size());
+
+  enforceLumpBudget();
+}
+
 bool Filesystem::loadAsset(const assets::SerializedAsset** asset, AssetId id) {
-  // TODO(marceline-cramer) The index of each asset's bundle could be cached
+  AssetTraceZone trace_zone(AssetTraceStage::Retrieve, id);
+
+  const AssetLocation* location;
+  {
+    AssetTraceZone lookup_zone(AssetTraceStage::Lookup);
+    location = findAssetLocation(id);
+  }
+
+  if (location == nullptr) {
+    log_err_fmt("Asset 0x%0dx does not exist", id);
+    return false;
+  }
+
+  AssetBundle* asset_bundle = asset_bundles[location->bundle_index];
+  bool loaded_successfully = asset_bundle->loadAsset(asset, location->entry);
+
+  // The new asset is pinned, so its lump is safe from eviction
+  enforceLumpBudget();
+
+  return loaded_successfully;
+}
+
+void Filesystem::releaseAsset(AssetId id) {
+  const AssetLocation* location = findAssetLocation(id);
+  if (location == nullptr) return;
+
+  asset_bundles[location->bundle_index]->releaseAsset(location->entry);
+}
+
+void Filesystem::indexBundleAssets(uint32_t bundle_index) {
+  log_zone;
+
+  types::vector<AssetBundle::IndexedAsset> indexed_assets;
+  asset_bundles[bundle_index]->getIndexedAssets(&indexed_assets);
+
+  size_t old_location_num = asset_locations.size();
+  asset_locations.reserve(old_location_num + indexed_assets.size());
+
+  // Bundles list their assets already sorted by ID
+  for (const auto& indexed_asset : indexed_assets) {
+    asset_locations.push_back(
+        {indexed_asset.id, bundle_index, indexed_asset.entry});
+  }
+
+  auto by_id = [](const AssetLocation& a, const AssetLocation& b) {
+    return a.id < b.id;
+  };
+
+  auto new_locations = asset_locations.begin() + old_location_num;
+
+  // The merge is stable, so earlier-mounted bundles come first among duplicates
+  std::inplace_merge(asset_locations.begin(), new_locations,
+                     asset_locations.end(), by_id);
+
+  // Assets in earlier-mounted bundles override those in later ones
+  auto same_id = [](const AssetLocation& a, const AssetLocation& b) {
+    return a.id == b.id;
+  };
+
+  auto unique_end =
+      std::unique(asset_locations.begin(), asset_locations.end(), same_id);
+  size_t overridden_num = asset_locations.end() - unique_end;
+  asset_locations.erase(unique_end, asset_locations.end());
+
+  if (overridden_num > 0) {
+    log_inf_fmt("%zu assets in bundle %u are overridden by earlier bundles",
+                overridden_num, bundle_index);
+  }
+}
+
+const Filesystem::AssetLocation* Filesystem::findAssetLocation(AssetId id) {
+  auto before_id = [](const AssetLocation& location, AssetId id) {
+    return location.id < id;
+  };
+
+  auto iter = std::lower_bound(asset_locations.begin(), asset_locations.end(),
+                               id, before_id);
+
+  if (iter == asset_locations.end() || iter->id != id) return nullptr;
+  return &(*iter);
+}
+
+void Filesystem::enforceLumpBudget() {
+  // Only one thread needs to evict at a time
+  std::unique_lock<std::mutex> lock(eviction_mutex, std::try_to_lock);
+  if (!lock.owns_lock()) return;
+
+  size_t resident_size = 0;
   for (auto asset_bundle : asset_bundles) {
-    if (asset_bundle->isAssetRegistered(id)) {
-      return asset_bundle->loadAsset(asset, id);
-    }
+    resident_size += asset_bundle->getResidentSize();
   }
 
-  log_err_fmt("Asset 0x%0dx does not exist", id);
-  return false;
+  while (resident_size > lump_budget) {
+    AssetBundle* lru_bundle = nullptr;
+    uint32_t lru_lump;
+    int64_t lru_last_used;
+
+    for (auto asset_bundle : asset_bundles) {
+      uint32_t lump_index;
+      int64_t last_used;
+
+      if (!asset_bundle->findEvictableLump(&lump_index, &last_used)) continue;
+      if (lru_bundle != nullptr && last_used >= lru_last_used) continue;
+
+      lru_bundle = asset_bundle;
+      lru_lump = lump_index;
+      lru_last_used = last_used;
+    }
+
+    // Everything left is pinned
+    if (lru_bundle == nullptr) break;
+
+    size_t evicted_size = lru_bundle->evictLump(lru_lump);
+    if (evicted_size == 0) break;
+
+    resident_size -= std::min(evicted_size, resident_size);
+  }
 }
 
 toml::value Filesystem::loadToml(const std::filesystem::path& toml_path) {
-  log_dbg_fmt("Loading TOML file: %s", toml_path.c_str());
+  log_dbg_fmt("Loading TOML file: %s", toml_path.string().c_str());
   return toml::parse(toml_path);
 }
 
 bool Filesystem::loadTextFile(const std::filesystem::path& file_path,
                               types::string* file_data) {
   if (!std::filesystem::exists(file_path)) {
-    log_err_fmt("File %s does not exist", file_path.c_str());
+    log_err_fmt("File %s does not exist", file_path.string().c_str());
     return false;
   }
 
@@ -107,7 +324,7 @@ bool Filesystem::loadTextFile(const std::filesystem::path& file_path,
 bool Filesystem::loadBinaryFile(const std::filesystem::path& file_path,
                                 types::vector<char>* file_data) {
   if (!std::filesystem::exists(file_path)) {
-    log_err_fmt("File %s does not exist", file_path.c_str());
+    log_err_fmt("File %s does not exist", file_path.string().c_str());
     return false;
   }
 
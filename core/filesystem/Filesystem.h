@@ -4,9 +4,11 @@
 #pragma once
 
 #include <filesystem>
+#include <mutex>
 
 #include "core/assets/Asset.h"
 #include "core/filesystem/AssetBundle.h"
+#include "core/jobs/JobQueue.h"
 #include "lib/include/toml_headers.h"
 #include "types/containers/string.h"
 #include "types/containers/vector.h"
@@ -16,24 +18,62 @@ namespace core {
 
 // Forward declarations
 class AssetPool;
+class CVarScope;
 
 class Filesystem {
  public:
+  static void initCVars(CVarScope*);
+
   Filesystem();
   ~Filesystem();
 
+  // The Filesystem is needed to load the config file, so CVars come after
+  void setCVars(const CVarScope*);
+
   bool loadAssetBundle(const std::filesystem::path&);
   void getChecksums(types::vector<assets::LumpHash>&);
   void indexExports(AssetPool*);
   void getInitialPrefabs(types::vector<assets::AssetId>&);
+
+  // Faults in every lump the prefabs depend on in parallel, and blocks until
+  // they're ready
+  void prefetchPrefabs(const types::vector<assets::AssetId>&);
   bool loadAsset(const assets::SerializedAsset**, AssetId);
 
+  // Unpins an asset's lump once its SerializedAsset is no longer needed
+  void releaseAsset(AssetId);
+
   toml::value loadToml(const std::filesystem::path&);
   bool loadTextFile(const std::filesystem::path&, types::string*);
   bool loadBinaryFile(const std::filesystem::path&, types::vector<char>*);
 
+  // Worker pool for blocking file I/O and decompression
+  JobQueue* getJobQueue() { return &io_jobs; }
+
  private:
+  const CVarScope* cvars = nullptr;
+
   types::vector<AssetBundle*> asset_bundles;
+
+  // Every mounted asset's location, merged from all bundles and sorted by ID
+  struct AssetLocation {
+    AssetId id;
+    uint32_t bundle_index;
+    AssetBundle::AssetLookupEntry entry;
+  };
+
+  types::vector<AssetLocation> asset_locations;
+
+  // Unpinned lumps are evicted, least recently used first, while the total
+  // size of resident lumps is over budget
+  size_t lump_budget = 512 * 1024 * 1024;
+  std::mutex eviction_mutex;
+
+  void indexBundleAssets(uint32_t);
+  const AssetLocation* findAssetLocation(AssetId);
+  void enforceLumpBudget();
+
+  JobQueue io_jobs;
 };
 
 }  // namespace core
@@ -0,0 +1,121 @@
+// Copyright (c) 2020-2021 the Mondradiko contributors.
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include "core/filesystem/LumpVerificationCache.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+
+#include "lib/include/toml_headers.h"
+#include "log/log.h"
+
+namespace mondradiko {
+namespace core {
+
+bool LumpVerificationCache::getFileStamp(const std::filesystem::path& path,
+                                         FileStamp* stamp) {
+  std::error_code ec;
+
+  stamp->size = std::filesystem::file_size(path, ec);
+  if (ec) return false;
+
+  auto write_time = std::filesystem::last_write_time(path, ec);
+  if (ec) return false;
+
+  stamp->modification_time = write_time.time_since_epoch().count();
+  return true;
+}
+
+LumpVerificationCache::LumpVerificationCache(
+    const std::filesystem::path& cache_path)
+    : cache_path(cache_path) {
+  log_zone;
+
+  if (!std::filesystem::exists(cache_path)) return;
+
+  try {
+    toml::value cache = toml::parse(cache_path);
+    if (!cache.contains("lumps")) return;
+
+    for (const auto& lump : toml::find<toml::array>(cache, "lumps")) {
+      auto file = toml::find<types::string>(lump, "file");
+      auto checksum = toml::find<types::string>(lump, "checksum");
+
+      CacheEntry entry;
+      entry.stamp.size = toml::find<uint64_t>(lump, "size");
+      entry.stamp.modification_time = toml::find<int64_t>(lump, "mtime");
+      entry.checksum =
+          static_cast<assets::LumpHash>(std::stoull(checksum, nullptr, 16));
+
+      entries.emplace(file, entry);
+    }
+  } catch (const std::exception& e) {
+    // A bad cache only costs a rehash, so don't treat it as fatal
+    log_wrn_fmt("Discarding lump verification cache %s: %s",
+                cache_path.c_str(), e.what());
+    entries.clear();
+  }
+}
+
+bool LumpVerificationCache::isVerified(const types::string& lump_file,
+                                       const FileStamp& stamp,
+                                       assets::LumpHash checksum) {
+  std::unique_lock<std::mutex> lock(mutex);
+
+  auto iter = entries.find(lump_file);
+  if (iter == entries.end()) return false;
+
+  const CacheEntry& entry = iter->second;
+  return entry.stamp.size == stamp.size &&
+         entry.stamp.modification_time == stamp.modification_time &&
+         entry.checksum == checksum;
+}
+
+void LumpVerificationCache::markVerified(const types::string& lump_file,
+                                         const FileStamp& stamp,
+                                         assets::LumpHash checksum) {
+  std::unique_lock<std::mutex> lock(mutex);
+
+  CacheEntry entry;
+  entry.stamp = stamp;
+  entry.checksum = checksum;
+  entries[lump_file] = entry;
+  dirty = true;
+}
+
+void LumpVerificationCache::save() {
+  log_zone;
+
+  std::unique_lock<std::mutex> lock(mutex);
+  if (!dirty) return;
+
+  std::ofstream cache_file(cache_path.c_str());
+  if (!cache_file.is_open()) {
+    // Bundles may be installed read-only; verification still works
+    log_wrn_fmt("Failed to write lump verification cache %s",
+                cache_path.string().c_str());
+    return;
+  }
+
+  cache_file << "# Generated by Mondradiko. Safe to delete." << std::endl;
+
+  for (const auto& iter : entries) {
+    // Checksums are unsigned 64-bit, which TOML integers can't hold
+    char checksum[17];
+    snprintf(checksum, sizeof(checksum), "%016" PRIx64,
+             static_cast<uint64_t>(iter.second.checksum));
+
+    cache_file << std::endl << "[[lumps]]" << std::endl;
+    cache_file << "file = \"" << iter.first << "\"" << std::endl;
+    cache_file << "size = " << iter.second.stamp.size << std::endl;
+    cache_file << "mtime = " << iter.second.stamp.modification_time
+               << std::endl;
+    cache_file << "checksum = \"" << checksum << "\"" << std::endl;
+  }
+
+  dirty = false;
+}
+
+}  // namespace core
+}  // namespace mondradiko
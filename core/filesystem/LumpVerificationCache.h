@@ -0,0 +1,55 @@
+// Copyright (c) 2020-2021 the Mondradiko contributors.
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+
+#include "types/assets/AssetTypes.h"
+#include "types/containers/string.h"
+#include "types/containers/unordered_map.h"
+
+namespace mondradiko {
+namespace core {
+
+/**
+ * @brief Sidecar record of lumps that have already passed verification.
+ *
+ * A lump is only trusted without rehashing when its file name, size,
+ * modification time, and registry checksum all match the cached entry.
+ */
+class LumpVerificationCache {
+ public:
+  struct FileStamp {
+    uint64_t size;
+    int64_t modification_time;
+  };
+
+  static bool getFileStamp(const std::filesystem::path&, FileStamp*);
+
+  explicit LumpVerificationCache(const std::filesystem::path&);
+
+  // Both of these are safe to call from worker threads
+  bool isVerified(const types::string&, const FileStamp&, assets::LumpHash);
+  void markVerified(const types::string&, const FileStamp&, assets::LumpHash);
+
+  // Writes the cache back to disk if it has changed
+  void save();
+
+ private:
+  std::filesystem::path cache_path;
+
+  struct CacheEntry {
+    FileStamp stamp;
+    assets::LumpHash checksum;
+  };
+
+  std::mutex mutex;
+  types::unordered_map<types::string, CacheEntry> entries;
+  bool dirty = false;
+};
+
+}  // namespace core
+}  // namespace mondradiko
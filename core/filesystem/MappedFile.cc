@@ -0,0 +1,174 @@
+// Copyright (c) 2020-2021 the Mondradiko contributors.
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include "core/filesystem/MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+// PrefetchVirtualMemory() needs Windows 8
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0602
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "log/log.h"
+
+namespace mondradiko {
+namespace core {
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::filesystem::path& file_path) {
+  log_zone;
+
+  HANDLE file = CreateFileW(file_path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    log_err_fmt("Failed to open %s for mapping", file_path.string().c_str());
+    return;
+  }
+
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+    CloseHandle(file);
+    return;
+  }
+
+  HANDLE mapping =
+      CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping == nullptr) {
+    log_err_fmt("Failed to map %s", file_path.string().c_str());
+    CloseHandle(file);
+    return;
+  }
+
+  void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (view == nullptr) {
+    log_err_fmt("Failed to map view of %s", file_path.string().c_str());
+    CloseHandle(mapping);
+    CloseHandle(file);
+    return;
+  }
+
+  file_handle = file;
+  mapping_handle = mapping;
+  data = static_cast<const char*>(view);
+  size = static_cast<size_t>(file_size.QuadPart);
+}
+
+MappedFile::~MappedFile() {
+  if (data != nullptr) UnmapViewOfFile(data);
+  if (mapping_handle != nullptr) CloseHandle(mapping_handle);
+  if (file_handle != nullptr) CloseHandle(file_handle);
+}
+
+void MappedFile::advise(size_t offset, size_t length, Access access) {
+  if (data == nullptr || offset >= size) return;
+  if (length > size - offset) length = size - offset;
+
+  // Windows can't change the read-ahead of an existing view, so Random and
+  // Sequential are no-ops
+  if (access != Access::WillNeed && access != Access::DontNeed) return;
+
+  static const size_t page_size = []() {
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+    return static_cast<size_t>(system_info.dwPageSize);
+  }();
+
+  size_t aligned_offset = offset - offset % page_size;
+  length += offset - aligned_offset;
+
+  char* range_start = const_cast<char*>(data) + aligned_offset;
+
+  if (access == Access::WillNeed) {
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = range_start;
+    range.NumberOfBytes = length;
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+  } else {
+    // DiscardVirtualMemory() and OfferVirtualMemory() only accept private
+    // pages. Unlocking pages that aren't locked instead trims them from the
+    // working set, and is expected to "fail" with ERROR_NOT_LOCKED.
+    VirtualUnlock(range_start, length);
+  }
+}
+
+#else
+
+MappedFile::MappedFile(const std::filesystem::path& file_path) {
+  log_zone;
+
+  int fd = open(file_path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    log_err_fmt("Failed to open %s for mapping", file_path.string().c_str());
+    return;
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+    close(fd);
+    return;
+  }
+
+  size_t file_size = static_cast<size_t>(file_stat.st_size);
+  void* mapping = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+
+  // The mapping keeps its own reference to the file
+  close(fd);
+
+  if (mapping == MAP_FAILED) {
+    log_err_fmt("Failed to map %s", file_path.string().c_str());
+    return;
+  }
+
+  data = static_cast<const char*>(mapping);
+  size = file_size;
+}
+
+MappedFile::~MappedFile() {
+  if (data != nullptr) munmap(const_cast<char*>(data), size);
+}
+
+void MappedFile::advise(size_t offset, size_t length, Access access) {
+  if (data == nullptr || offset >= size) return;
+  if (length > size - offset) length = size - offset;
+
+  int advice;
+  switch (access) {
+    case Access::Random:
+      advice = MADV_RANDOM;
+      break;
+    case Access::Sequential:
+      advice = MADV_SEQUENTIAL;
+      break;
+    case Access::WillNeed:
+      advice = MADV_WILLNEED;
+      break;
+    case Access::DontNeed:
+    default:
+      advice = MADV_DONTNEED;
+      break;
+  }
+
+  // madvise() needs a page-aligned address
+  static const size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t aligned_offset = offset - offset % page_size;
+  length += offset - aligned_offset;
+
+  char* range_start = const_cast<char*>(data) + aligned_offset;
+  madvise(range_start, length, advice);
+}
+
+#endif
+
+}  // namespace core
+}  // namespace mondradiko
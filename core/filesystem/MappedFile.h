@@ -0,0 +1,51 @@
+// Copyright (c) 2020-2021 the Mondradiko contributors.
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+
+namespace mondradiko {
+namespace core {
+
+/**
+ * @brief Read-only memory mapping of a whole file.
+ *
+ * The mapping is shared with the OS page cache, so several processes mapping
+ * the same file (i.e. a server and a client on one host) share its pages.
+ */
+class MappedFile {
+ public:
+  explicit MappedFile(const std::filesystem::path&);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool isMapped() const { return data != nullptr; }
+  const char* getData() const { return data; }
+  size_t getSize() const { return size; }
+
+  enum class Access {
+    Random,      // Don't read ahead
+    Sequential,  // Read ahead aggressively, and drop pages once read
+    WillNeed,    // Start paging in now
+    DontNeed     // Pages can be dropped
+  };
+
+  // Hints how a range of the file will be accessed; this is only advisory
+  void advise(size_t, size_t, Access);
+
+ private:
+  const char* data = nullptr;
+  size_t size = 0;
+
+#ifdef _WIN32
+  void* file_handle = nullptr;
+  void* mapping_handle = nullptr;
+#endif
+};
+
+}  // namespace core
+}  // namespace mondradiko
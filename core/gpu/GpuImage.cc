@@ -12,13 +12,13 @@ namespace core {
 
 GpuImage::GpuImage(GpuInstance* gpu, VkFormat format, uint32_t width,
                    uint32_t height, VkImageUsageFlags image_usage_flags,
-                   VmaMemoryUsage memory_usage)
+                   VmaMemoryUsage memory_usage, uint32_t level_num)
     : gpu(gpu),
       format(format),
       layout(VK_IMAGE_LAYOUT_UNDEFINED),
       width(width),
       height(height),
-      level_num(1) {
+      level_num(level_num) {
   VkImageCreateInfo image_ci{};
   image_ci.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
   image_ci.imageType = VK_IMAGE_TYPE_2D;
@@ -16,7 +16,7 @@ class GpuInstance;
 class GpuImage {
  public:
   GpuImage(GpuInstance*, VkFormat, uint32_t, uint32_t, VkImageUsageFlags,
-           VmaMemoryUsage);
+           VmaMemoryUsage, uint32_t level_num = 1);
   GpuImage(GpuInstance*, VkFormat, uint32_t, uint32_t,
            GraphicsState::SampleCount, VkImageUsageFlags, VmaMemoryUsage);
   ~GpuImage();
@@ -29,6 +29,7 @@ class GpuImage {
   VkImageView getView() const { return view; }
   uint32_t getWidth() const { return width; }
   uint32_t getHeight() const { return height; }
+  uint32_t getLevelNum() const { return level_num; }
   size_t getSize() const { return allocation_info.size; }
 
  private:
@@ -299,10 +299,21 @@ void GpuInstance::createLogicalDevice(VulkanRequirements* requirements,
     queueCreateInfos.push_back(queueCreateInfo);
   }
 
+  VkPhysicalDeviceFeatures supported_features;
+  vkGetPhysicalDeviceFeatures(physical_device, &supported_features);
+
   VkPhysicalDeviceFeatures deviceFeatures{};
   deviceFeatures.multiViewport = VK_TRUE;
   deviceFeatures.samplerAnisotropy = VK_TRUE;
 
+  // Bundled textures are block-compressed
+  deviceFeatures.textureCompressionBC = supported_features.textureCompressionBC;
+  if (!deviceFeatures.textureCompressionBC) {
+    log_wrn("GPU does not support BC texture compression");
+  }
+
+  enabled_features = deviceFeatures;
+
   VkDeviceCreateInfo createInfo{};
   createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
   createInfo.queueCreateInfoCount = (uint32_t)queueCreateInfos.size();
@@ -38,6 +38,9 @@ class GpuInstance {
 
   VkPhysicalDeviceProperties physical_device_properties;
 
+  // Optional features are only enabled if the device supports them
+  VkPhysicalDeviceFeatures enabled_features{};
+
   uint32_t graphics_queue_family;
   VkQueue graphics_queue;
 
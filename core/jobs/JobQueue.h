@@ -0,0 +1,113 @@
+// Copyright (c) 2020-2021 the Mondradiko contributors.
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "types/containers/vector.h"
+
+namespace mondradiko {
+namespace core {
+
+/**
+ * @brief Fixed-size pool of worker threads consuming a FIFO of jobs.
+ *
+ * This is header-only so that tools outside of core (i.e. the bundler) can
+ * share it without linking against the engine.
+ */
+class JobQueue {
+ public:
+  using Job = std::function<void()>;
+
+  // A worker count of zero picks one based on the hardware
+  explicit JobQueue(uint32_t worker_num = 0) {
+    if (worker_num == 0) {
+      uint32_t hardware_threads = std::thread::hardware_concurrency();
+      worker_num = std::max(hardware_threads, 2u) - 1;
+    }
+
+    for (uint32_t i = 0; i < worker_num; i++) {
+      workers.emplace_back(&JobQueue::workerLoop, this);
+    }
+  }
+
+  ~JobQueue() {
+    {
+      std::unique_lock<std::mutex> lock(jobs_mutex);
+      stopping = true;
+    }
+
+    jobs_available.notify_all();
+
+    for (auto& worker : workers) {
+      if (worker.joinable()) worker.join();
+    }
+  }
+
+  JobQueue(const JobQueue&) = delete;
+  JobQueue& operator=(const JobQueue&) = delete;
+
+  uint32_t getWorkerNum() const { return workers.size(); }
+
+  void addJob(Job job) {
+    {
+      std::unique_lock<std::mutex> lock(jobs_mutex);
+      jobs.push_back(std::move(job));
+    }
+
+    jobs_available.notify_one();
+  }
+
+  // Adds a job and returns a future for its result
+  template <typename Function>
+  auto submit(Function&& function) -> std::future<decltype(function())> {
+    using ResultType = decltype(function());
+
+    // std::function requires copyable callables, so share the task
+    auto task = std::make_shared<std::packaged_task<ResultType()>>(
+        std::forward<Function>(function));
+    std::future<ResultType> result = task->get_future();
+    addJob([task]() { (*task)(); });
+    return result;
+  }
+
+ private:
+  std::mutex jobs_mutex;
+  std::condition_variable jobs_available;
+  std::deque<Job> jobs;
+  bool stopping = false;
+
+  types::vector<std::thread> workers;
+
+  void workerLoop() {
+    while (true) {
+      Job job;
+
+      {
+        std::unique_lock<std::mutex> lock(jobs_mutex);
+        jobs_available.wait(lock,
+                            [this]() { return stopping || !jobs.empty(); });
+
+        // Drain remaining jobs before stopping so no future is left broken
+        if (jobs.empty()) return;
+
+        job = std::move(jobs.front());
+        jobs.pop_front();
+      }
+
+      job();
+    }
+  }
+};
+
+}  // namespace core
+}  // namespace mondradiko
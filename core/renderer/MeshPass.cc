@@ -3,11 +3,14 @@
 
 #include "core/renderer/MeshPass.h"
 
+#include <algorithm>
+
 #include "core/assets/MeshAsset.h"
 #include "core/components/internal/WorldTransform.h"
 #include "core/components/scriptable/PointLightComponent.h"
 #include "core/components/synchronized/MeshRendererComponent.h"
 #include "core/cvars/CVarScope.h"
+#include "core/cvars/FloatCVar.h"
 #include "core/displays/Viewport.h"
 #include "core/gpu/GpuBuffer.h"
 #include "core/gpu/GpuDescriptorPool.h"
@@ -29,7 +32,11 @@
 namespace mondradiko {
 namespace core {
 
-void MeshPass::initCVars(CVarScope* cvars) {}
+void MeshPass::initCVars(CVarScope* cvars) {
+  CVarScope* meshes = cvars->addChild("meshes");
+
+  meshes->addValue<FloatCVar>("lod_error_pixels", 0.0, 64.0);
+}
 
 void MeshPass::initDummyAssets(AssetPool* asset_pool) {
   asset_pool->initializeAssetType<MaterialAsset>();
@@ -37,8 +44,11 @@ void MeshPass::initDummyAssets(AssetPool* asset_pool) {
   asset_pool->initializeAssetType<TextureAsset>();
 }
 
-MeshPass::MeshPass(Renderer* renderer, World* world)
-    : gpu(renderer->getGpu()), renderer(renderer), world(world) {
+MeshPass::MeshPass(const CVarScope* cvars, Renderer* renderer, World* world)
+    : cvars(cvars->getChild("meshes")),
+      gpu(renderer->getGpu()),
+      renderer(renderer),
+      world(world) {
   log_zone;
 
   {
@@ -57,7 +67,7 @@ MeshPass::MeshPass(Renderer* renderer, World* world)
     sampler_info.anisotropyEnable = VK_FALSE;
     sampler_info.compareEnable = VK_FALSE;
     sampler_info.minLod = 0.0f;
-    sampler_info.maxLod = 0.0f;
+    sampler_info.maxLod = VK_LOD_CLAMP_NONE;
     sampler_info.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
     sampler_info.unnormalizedCoordinates = VK_FALSE;
 
@@ -155,8 +165,17 @@ MeshPass::MeshPass(Renderer* renderer, World* world)
   {
     log_zone_named("Create mesh data pools");
 
-    size_t vertex_pool_size = 1024 * 1024 * sizeof(MeshVertex);
-    size_t index_pool_size = 1024 * 1024 * sizeof(MeshIndex);
+    size_t vertex_pool_num = 1024 * 1024;
+    size_t index_pool_num = 1024 * 1024;
+    size_t short_index_pool_num = 1024 * 1024;
+    size_t vertex_pool_size = vertex_pool_num * sizeof(MeshVertex);
+    size_t index_pool_size = index_pool_num * sizeof(MeshIndex);
+    size_t short_index_pool_size =
+        short_index_pool_num * sizeof(MeshShortIndex);
+
+    free_vertices.push_back({0, vertex_pool_num});
+    free_indices.push_back({0, index_pool_num});
+    free_short_indices.push_back({0, short_index_pool_num});
 
     vertex_pool = new GpuBuffer(
         gpu, vertex_pool_size,
@@ -164,6 +183,9 @@ MeshPass::MeshPass(Renderer* renderer, World* world)
     index_pool = new GpuBuffer(
         gpu, index_pool_size,
         VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+    short_index_pool = new GpuBuffer(
+        gpu, short_index_pool_size,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
   }
 }
 
@@ -174,6 +196,7 @@ MeshPass::~MeshPass() {
     vkDestroySampler(gpu->device, texture_sampler, nullptr);
   if (vertex_pool != nullptr) delete vertex_pool;
   if (index_pool != nullptr) delete index_pool;
+  if (short_index_pool != nullptr) delete short_index_pool;
   if (transparent_pipeline != nullptr) delete transparent_pipeline;
   if (forward_pipeline != nullptr) delete forward_pipeline;
   if (depth_pipeline != nullptr) delete depth_pipeline;
@@ -189,19 +212,90 @@ MeshPass::~MeshPass() {
 }
 
 size_t MeshPass::allocateVertices(size_t vertex_num) {
-  // TODO(marceline-cramer) Proper pool allocation
-  size_t vertex_offset = first_available_vertex;
-  first_available_vertex += vertex_num;
+  size_t vertex_offset = _allocateRange(&free_vertices, vertex_num);
+
+  if (vertex_offset == AllocationFailed) {
+    log_err_fmt("Vertex pool cannot fit %zu more vertices", vertex_num);
+  }
+
   return vertex_offset;
 }
 
 size_t MeshPass::allocateIndices(size_t index_num) {
-  // TODO(marceline-cramer) Proper pool allocation
-  size_t index_offset = first_available_index;
-  first_available_index += index_num;
+  size_t index_offset = _allocateRange(&free_indices, index_num);
+
+  if (index_offset == AllocationFailed) {
+    log_err_fmt("Index pool cannot fit %zu more indices", index_num);
+  }
+
   return index_offset;
 }
 
+size_t MeshPass::allocateShortIndices(size_t index_num) {
+  size_t index_offset = _allocateRange(&free_short_indices, index_num);
+
+  if (index_offset == AllocationFailed) {
+    log_err_fmt("Short index pool cannot fit %zu more indices", index_num);
+  }
+
+  return index_offset;
+}
+
+void MeshPass::freeVertices(size_t vertex_offset, size_t vertex_num) {
+  _freeRange(&free_vertices, vertex_offset, vertex_num);
+}
+
+void MeshPass::freeIndices(size_t index_offset, size_t index_num) {
+  _freeRange(&free_indices, index_offset, index_num);
+}
+
+void MeshPass::freeShortIndices(size_t index_offset, size_t index_num) {
+  _freeRange(&free_short_indices, index_offset, index_num);
+}
+
+size_t MeshPass::_allocateRange(types::vector<PoolRange>* free_ranges,
+                                size_t num) {
+  // First fit; the pools only hold a few thousand meshes at most
+  for (auto iter = free_ranges->begin(); iter != free_ranges->end(); iter++) {
+    if (iter->size < num) continue;
+
+    size_t offset = iter->offset;
+    iter->offset += num;
+    iter->size -= num;
+
+    if (iter->size == 0) free_ranges->erase(iter);
+    return offset;
+  }
+
+  return AllocationFailed;
+}
+
+void MeshPass::_freeRange(types::vector<PoolRange>* free_ranges,
+                          size_t offset, size_t num) {
+  if (num == 0) return;
+
+  auto next = free_ranges->begin();
+  while (next != free_ranges->end() && next->offset < offset) next++;
+
+  // Merge with the following range if they touch
+  if (next != free_ranges->end() && offset + num == next->offset) {
+    next->offset = offset;
+    next->size += num;
+  } else {
+    next = free_ranges->insert(next, {offset, num});
+  }
+
+  // Merge with the preceding range if they touch
+  if (next != free_ranges->begin()) {
+    auto previous = next - 1;
+
+    if (previous->offset + previous->size == next->offset) {
+      previous->size += next->size;
+      free_ranges->erase(next);
+    }
+  }
+}
+
 void MeshPass::createFrameData(uint32_t frame_count) {
   log_zone;
 
@@ -262,6 +356,20 @@ void MeshPass::beginFrame(uint32_t frame_index, uint32_t viewport_count,
 
   frame.point_lights->writeData(0, point_light_uniforms);
 
+  types::vector<LodViewpoint> lod_viewpoints(viewport_count);
+
+  for (uint32_t i = 0; i < viewport_count; i++) {
+    Viewport* viewport = renderer->getCurrentViewport(i);
+
+    ViewportUniform uniform;
+    viewport->writeUniform(&uniform);
+
+    // Projection flips Y for Vulkan, so only use its magnitude
+    lod_viewpoints[i].position = uniform.position;
+    lod_viewpoints[i].pixel_scale = 0.5f * viewport->getImageHeight() *
+                                    glm::abs(uniform.projection[1][1]);
+  }
+
   types::unordered_map<AssetId, uint32_t> material_assets;
   types::vector<MaterialUniform> frame_materials;
   types::vector<GpuDescriptorSet*> frame_textures;
@@ -318,9 +426,9 @@ void MeshPass::beginFrame(uint32_t frame_index, uint32_t viewport_count,
       }
     }
 
-    {  // Write mesh uniform
-      auto& transform = mesh_renderers.get<WorldTransform>(e);
+    auto& transform = mesh_renderers.get<WorldTransform>(e);
 
+    {  // Write mesh uniform
       MeshUniform mesh_uniform;
       mesh_uniform.model = transform.getTransform();
       mesh_uniform.light_count = point_light_uniforms.size();
@@ -333,14 +441,24 @@ void MeshPass::beginFrame(uint32_t frame_index, uint32_t viewport_count,
     {  // Write mesh asset
       const auto& mesh_asset = mesh_renderer.getMeshAsset();
 
+      size_t lod_index = _selectLod(mesh_asset, transform.getTransform(),
+                                    lod_viewpoints);
+      const auto& lod = mesh_asset->getLod(lod_index);
+
       cmd.vertex_offset = mesh_asset->getVertexOffset();
-      cmd.index_offset = mesh_asset->getIndexOffset();
-      cmd.index_num = mesh_asset->getIndexNum();
+      cmd.index_offset = lod.index_offset;
+      cmd.index_num = lod.index_num;
+      cmd.short_indices = mesh_asset->hasShortIndices();
     }
 
     target_commands->push_back(cmd);
   }
 
+  sortMeshCommands(&frame.forward_commands.single_sided);
+  sortMeshCommands(&frame.forward_commands.double_sided);
+  sortMeshCommands(&frame.transparent_commands.single_sided);
+  sortMeshCommands(&frame.transparent_commands.double_sided);
+
   frame.material_buffer->writeData(0, frame_materials);
   frame.material_descriptor = descriptor_pool->allocate(material_layout);
   frame.material_descriptor->updateStorageBuffer(0, frame.material_buffer);
@@ -391,8 +509,8 @@ void MeshPass::renderViewport(VkCommandBuffer command_buffer,
   VkBuffer vertex_buffers[] = {vertex_pool->getBuffer()};
   VkDeviceSize offsets[] = {0};
   vkCmdBindVertexBuffers(command_buffer, 0, 1, vertex_buffers, offsets);
-  vkCmdBindIndexBuffer(command_buffer, index_pool->getBuffer(), 0,
-                       VK_INDEX_TYPE_UINT32);
+
+  // executeMeshCommands() binds the index pool matching each mesh
 
   current_pipeline->cmdBind(command_buffer, gs);
   executeMeshCommands(command_buffer, pass_commands->single_sided);
@@ -402,12 +520,73 @@ void MeshPass::renderViewport(VkCommandBuffer command_buffer,
   executeMeshCommands(command_buffer, pass_commands->double_sided);
 }
 
+size_t MeshPass::_selectLod(
+    const AssetHandle<MeshAsset>& mesh, const glm::mat4& model,
+    const types::vector<LodViewpoint>& viewpoints) const {
+  double max_error_pixels = cvars->get<FloatCVar>("lod_error_pixels");
+  if (mesh->getLodNum() <= 1 || max_error_pixels <= 0.0) return 0;
+
+  // Errors and bounds scale with the largest axis of the transform
+  float model_scale = glm::max(glm::length(glm::vec3(model[0])),
+                               glm::max(glm::length(glm::vec3(model[1])),
+                                        glm::length(glm::vec3(model[2]))));
+  glm::vec3 center =
+      glm::vec3(model * glm::vec4(mesh->getBoundsCenter(), 1.0f));
+  float radius = mesh->getBoundsRadius() * model_scale;
+
+  // The viewport that sees this mesh the largest decides its LOD
+  float pixels_per_unit = 0.0f;
+
+  for (const auto& viewpoint : viewpoints) {
+    float distance = glm::distance(center, viewpoint.position) - radius;
+
+    // Viewports inside of the bounds always get full detail
+    if (distance <= 0.0f) return 0;
+
+    pixels_per_unit =
+        glm::max(pixels_per_unit, viewpoint.pixel_scale / distance);
+  }
+
+  size_t lod_index = 0;
+
+  while (lod_index + 1 < mesh->getLodNum()) {
+    float error = mesh->getLod(lod_index + 1).error * model_scale;
+    if (error * pixels_per_unit > max_error_pixels) break;
+    lod_index++;
+  }
+
+  return lod_index;
+}
+
+// Groups commands by index width, so that each pool is only bound once
+void MeshPass::sortMeshCommands(MeshRenderCommandList* commands) {
+  std::stable_partition(
+      commands->begin(), commands->end(),
+      [](const MeshRenderCommand& cmd) { return cmd.short_indices; });
+}
+
 // Helper function to actually render meshes
 void MeshPass::executeMeshCommands(VkCommandBuffer command_buffer,
                                    const MeshRenderCommandList& commands) {
+  bool first_command = true;
+  bool short_indices_bound = false;
+
   for (const auto& cmd : commands) {
     log_zone_named("Render mesh");
 
+    if (first_command || cmd.short_indices != short_indices_bound) {
+      if (cmd.short_indices) {
+        vkCmdBindIndexBuffer(command_buffer, short_index_pool->getBuffer(), 0,
+                             VK_INDEX_TYPE_UINT16);
+      } else {
+        vkCmdBindIndexBuffer(command_buffer, index_pool->getBuffer(), 0,
+                             VK_INDEX_TYPE_UINT32);
+      }
+
+      first_command = false;
+      short_indices_bound = cmd.short_indices;
+    }
+
     cmd.textures_descriptor->cmdBind(command_buffer, pipeline_layout, 3);
 
     vkCmdDrawIndexed(command_buffer, cmd.index_num, 1, cmd.index_offset,
@@ -3,6 +3,8 @@
 
 #pragma once
 
+#include <cstdint>
+
 #include "core/assets/AssetHandle.h"
 #include "core/assets/AssetPool.h"
 #include "core/assets/MeshAsset.h"
@@ -41,16 +43,24 @@ class MeshPass : public RenderPass {
   static void initCVars(CVarScope*);
   static void initDummyAssets(AssetPool*);
 
-  MeshPass(Renderer*, World*);
+  MeshPass(const CVarScope*, Renderer*, World*);
   ~MeshPass();
 
   Renderer* getRenderer() { return renderer; }
 
+  // Returned by the allocation methods when a pool is full
+  static constexpr size_t AllocationFailed = SIZE_MAX;
+
   size_t allocateVertices(size_t);
   size_t allocateIndices(size_t);
+  size_t allocateShortIndices(size_t);
+  void freeVertices(size_t, size_t);
+  void freeIndices(size_t, size_t);
+  void freeShortIndices(size_t, size_t);
 
   GpuBuffer* getVertexPool() { return vertex_pool; }
   GpuBuffer* getIndexPool() { return index_pool; }
+  GpuBuffer* getShortIndexPool() { return short_index_pool; }
 
   // RenderPass implementation
   void createFrameData(uint32_t) final;
@@ -63,6 +73,7 @@ class MeshPass : public RenderPass {
   void endFrame() final {}
 
  private:
+  const CVarScope* cvars;
   GpuInstance* gpu;
   Renderer* renderer;
   World* world;
@@ -85,8 +96,29 @@ class MeshPass : public RenderPass {
 
   GpuBuffer* vertex_pool = nullptr;
   GpuBuffer* index_pool = nullptr;
-  size_t first_available_vertex = 0;
-  size_t first_available_index = 0;
+  GpuBuffer* short_index_pool = nullptr;
+
+  // Unused ranges of each pool, sorted by offset
+  struct PoolRange {
+    size_t offset;
+    size_t size;
+  };
+
+  types::vector<PoolRange> free_vertices;
+  types::vector<PoolRange> free_indices;
+  types::vector<PoolRange> free_short_indices;
+
+  static size_t _allocateRange(types::vector<PoolRange>*, size_t);
+  static void _freeRange(types::vector<PoolRange>*, size_t, size_t);
+
+  // Where a viewport is, and how many pixels tall one unit is one unit away
+  struct LodViewpoint {
+    glm::vec3 position;
+    float pixel_scale;
+  };
+
+  size_t _selectLod(const AssetHandle<MeshAsset>&, const glm::mat4&,
+                    const types::vector<LodViewpoint>&) const;
 
   struct MeshRenderCommand {
     uint32_t mesh_idx;
@@ -95,11 +127,13 @@ class MeshPass : public RenderPass {
     uint32_t vertex_offset;
     uint32_t index_offset;
     uint32_t index_num;
+    bool short_indices;
   };
 
   // Helper function to render meshes
   using MeshRenderCommandList = types::vector<MeshRenderCommand>;
   void executeMeshCommands(VkCommandBuffer, const MeshRenderCommandList&);
+  void sortMeshCommands(MeshRenderCommandList*);
 
   struct MeshPassCommandList {
     MeshRenderCommandList single_sided;
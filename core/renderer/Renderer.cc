@@ -3,6 +3,8 @@
 
 #include "core/renderer/Renderer.h"
 
+#include <algorithm>
+
 #include "core/cvars/BoolCVar.h"
 #include "core/cvars/CVarScope.h"
 #include "core/displays/Display.h"
@@ -14,6 +16,7 @@
 #include "core/gpu/GpuInstance.h"
 #include "core/gpu/GpuVector.h"
 #include "core/renderer/CompositePass.h"
+#include "core/renderer/MeshPass.h"
 #include "core/renderer/OverlayPass.h"
 #include "core/renderer/RenderPass.h"
 #include "log/log.h"
@@ -23,6 +26,7 @@ namespace core {
 
 void Renderer::initCVars(CVarScope* cvars) {
   CVarScope* renderer = cvars->addChild("renderer");
+  MeshPass::initCVars(renderer);
   OverlayPass::initCVars(renderer);
 
   renderer->addValue<BoolCVar>("queue_stall");
@@ -564,12 +568,16 @@ void Renderer::transferDataToBuffer(GpuBuffer* dst, size_t offset,
 }
 
 void Renderer::transferDataToImage(GpuImage* dst, const void* src) {
+  transferDataToImage(dst, src, dst->getSize(), {0});
+}
+
+void Renderer::transferDataToImage(
+    GpuImage* dst, const void* src, size_t size,
+    const types::vector<size_t>& level_offsets) {
   log_zone;
 
   // TODO(marceline-cramer) Yikes
 
-  size_t size = dst->getSize();
-
   VkBufferCreateInfo bufferInfo{};
   bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
   bufferInfo.size = size;
@@ -593,32 +601,37 @@ void Renderer::transferDataToImage(GpuImage* dst, const void* src) {
 
   VkCommandBuffer commandBuffer = gpu->beginSingleTimeCommands();
 
-  VkBufferImageCopy region{};
-  region.bufferOffset = 0;
-  region.bufferRowLength = 0;
-  region.bufferImageHeight = 0;
-
-  VkImageSubresourceLayers imageSubresource{};
-  imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  imageSubresource.mipLevel = 0;
-  imageSubresource.baseArrayLayer = 0;
-  imageSubresource.layerCount = 1;
-  region.imageSubresource = imageSubresource;
-
-  VkOffset3D image_offset{};
-  image_offset.x = 0;
-  image_offset.y = 0;
-  image_offset.z = 0;
-  region.imageOffset = image_offset;
-
-  VkExtent3D image_extent{};
-  image_extent.width = dst->getWidth();
-  image_extent.height = dst->getHeight();
-  image_extent.depth = 1;
-  region.imageExtent = image_extent;
+  types::vector<VkBufferImageCopy> regions;
+  for (uint32_t level = 0; level < level_offsets.size(); level++) {
+    VkBufferImageCopy region{};
+    region.bufferOffset = level_offsets[level];
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+
+    VkImageSubresourceLayers imageSubresource{};
+    imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageSubresource.mipLevel = level;
+    imageSubresource.baseArrayLayer = 0;
+    imageSubresource.layerCount = 1;
+    region.imageSubresource = imageSubresource;
+
+    VkOffset3D image_offset{};
+    image_offset.x = 0;
+    image_offset.y = 0;
+    image_offset.z = 0;
+    region.imageOffset = image_offset;
+
+    VkExtent3D image_extent{};
+    image_extent.width = std::max(dst->getWidth() >> level, 1u);
+    image_extent.height = std::max(dst->getHeight() >> level, 1u);
+    image_extent.depth = 1;
+    region.imageExtent = image_extent;
+
+    regions.push_back(region);
+  }
 
   vkCmdCopyBufferToImage(commandBuffer, buffer, dst->getImage(),
-                         dst->getLayout(), 1, &region);
+                         dst->getLayout(), regions.size(), regions.data());
 
   gpu->endSingleTimeCommands(commandBuffer);
 
@@ -37,6 +37,10 @@ class Renderer {
   void transferDataToBuffer(GpuBuffer*, size_t, const void*, size_t);
   void transferDataToImage(GpuImage*, const void*);
 
+  // Uploads every mip level at once, starting at the given offsets in src
+  void transferDataToImage(GpuImage*, const void*, size_t,
+                           const types::vector<size_t>&);
+
   GpuInstance* getGpu() { return gpu; }
   GpuDescriptorSetLayout* getViewportLayout() { return viewport_layout; }
 
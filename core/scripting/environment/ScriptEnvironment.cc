@@ -3,10 +3,12 @@
 
 #include "core/scripting/environment/ScriptEnvironment.h"
 
+#include <atomic>
 #include <sstream>
 
 #include "core/scripting/instance/ScriptInstance.h"
 #include "log/log.h"
+#include "types/assets/ScriptEngine.h"
 
 namespace mondradiko {
 namespace core {
@@ -57,20 +59,29 @@ wasm_trap_t* ScriptEnvironment::seedCallback(const wasmtime_caller_t* caller,
   return nullptr;
 }
 
+static std::atomic<bool> trust_precompiled_scripts{false};
+
+void ScriptEnvironment::trustPrecompiledScripts() {
+  log_wrn("Trusting precompiled scripts; only load trusted bundles");
+  trust_precompiled_scripts = true;
+}
+
+bool ScriptEnvironment::isTrustingPrecompiledScripts() {
+  return trust_precompiled_scripts;
+}
+
 // Dummy finalizer needed for wasmtime_func_new_with_env()
 static void interruptCallbackFinalizer(void*) {}
 
 ScriptEnvironment::ScriptEnvironment() : _mersenne_twister(_random_device()) {
   log_zone;
 
-  // Create a config to allow interrupts
-  wasm_config_t* config = wasm_config_new();
+  // Shared with the bundler, which precompiles scripts
+  wasm_config_t* config = assets::createScriptEngineConfig();
   if (config == nullptr) {
     log_ftl("Failed to create Wasm config");
   }
 
-  wasmtime_config_interruptable_set(config, true);
-
   // Create the engine
   // Frees the config
   engine = wasm_engine_new_with_config(config);
@@ -199,6 +210,25 @@ wasm_module_t* ScriptEnvironment::loadTextModule(
   return loadTextModule(module_data.data(), module_data.size());
 }
 
+wasm_module_t* ScriptEnvironment::loadPrecompiledModule(
+    const char* module_data, size_t data_size) {
+  wasm_byte_vec_t serialized;
+  wasm_byte_vec_new(&serialized, data_size, module_data);
+
+  wasmtime_error_t* module_error;
+  wasm_module_t* new_module = nullptr;
+  module_error =
+      wasmtime_module_deserialize(getEngine(), &serialized, &new_module);
+  wasm_byte_vec_delete(&serialized);
+
+  if (handleError(module_error, nullptr)) {
+    log_err("Failed to deserialize precompiled Wasm module");
+    return nullptr;
+  }
+
+  return new_module;
+}
+
 uint32_t ScriptEnvironment::storeInRegistry(void* object_ptr) {
   // TODO(marceline-cramer) Hashmap for object registry
   uint32_t object_id = 0;
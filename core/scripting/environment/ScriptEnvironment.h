@@ -25,6 +25,16 @@ class ScriptEnvironment {
 
   void linkAssemblyScriptEnv();
 
+  /**
+   * @brief Allows ScriptAssets to load modules precompiled by the bundler.
+   *
+   * Precompiled modules are native code, which skips Wasm validation and
+   * sandboxing, so scripts are compiled from their bytecode unless bundles
+   * are explicitly trusted.
+   */
+  static void trustPrecompiledScripts();
+  static bool isTrustingPrecompiledScripts();
+
   wasm_engine_t* getEngine() { return engine; }
   wasm_store_t* getStore() { return store; }
   wasmtime_interrupt_handle_t* getInterruptHandle() { return interrupt_handle; }
@@ -86,6 +96,16 @@ class ScriptEnvironment {
    */
   wasm_module_t* loadTextModule(const types::vector<char>&);
 
+  /**
+   * @brief Loads a module that was precompiled by the bundler.
+   * The caller must check that the module was compiled by a compatible
+   * engine (see assets::getScriptEngineKey()).
+   * @param module_data The serialized native module.
+   * @param data_size The size of the serialized module.
+   * @return A new wasm_module_t handle, or nullptr on failure.
+   */
+  wasm_module_t* loadPrecompiledModule(const char*, size_t);
+
   /**
    * @brief Stores a new script object in the script-accessible object registry.
    * @param object_ptr A raw pointer to the object to be stored.
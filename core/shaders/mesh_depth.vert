@@ -41,9 +41,10 @@ layout(set = 2, binding = 0) buffer readonly MeshDescriptor {
 } meshes;
 
 layout(location = 0) in vec3 vertPosition;
-layout(location = 1) in vec3 vertNormal;
-layout(location = 2) in vec3 vertTangent;
-layout(location = 3) in vec3 vertColor;
+// Normals and tangents are octahedral-encoded
+layout(location = 1) in vec2 vertNormal;
+layout(location = 2) in vec2 vertTangent;
+layout(location = 3) in vec4 vertColor;
 layout(location = 4) in vec2 vertTexCoord;
 
 layout(location = 0) out float fragMask;
@@ -132,8 +132,10 @@ vec3 BRDF(vec3 l,         // Normalized light direction
 
 vec3 getNormal(in MaterialUniform material) {
   if (material.normal_map_scale > 0.0) {
-    vec3 sampled_normal = texture(normal_map_texture, fragTexCoord).rgb * 2 - 1;
-    sampled_normal *= vec3(vec2(material.normal_map_scale), 1.0);
+    // Normal maps only store X and Y, so reconstruct Z
+    vec2 sampled_xy = texture(normal_map_texture, fragTexCoord).rg * 2 - 1;
+    float sampled_z = sqrt(max(0.0, 1.0 - dot(sampled_xy, sampled_xy)));
+    vec3 sampled_normal = vec3(sampled_xy * material.normal_map_scale, sampled_z);
     sampled_normal = normalize(sampled_normal);
 
     vec3 N = normalize(fragNormal);
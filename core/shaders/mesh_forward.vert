@@ -21,9 +21,10 @@ layout(set = 2, binding = 0) buffer readonly MeshDescriptor {
 } meshes;
 
 layout(location = 0) in vec3 vertPosition;
-layout(location = 1) in vec3 vertNormal;
-layout(location = 2) in vec3 vertTangent;
-layout(location = 3) in vec3 vertColor;
+// Normals and tangents are octahedral-encoded
+layout(location = 1) in vec2 vertNormal;
+layout(location = 2) in vec2 vertTangent;
+layout(location = 3) in vec4 vertColor;
 layout(location = 4) in vec2 vertTexCoord;
 
 layout(location = 0) out uint fragMesh;
@@ -33,15 +34,27 @@ layout(location = 3) out vec3 fragNormal;
 layout(location = 4) out vec3 fragTangent;
 layout(location = 5) out vec3 fragPosition;
 
+vec3 decodeOctahedral(vec2 encoded) {
+  vec3 v = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+
+  // Unfold the lower hemisphere
+  if (v.z < 0.0) {
+    vec2 signs = vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+    v.xy = (1.0 - abs(v.yx)) * signs;
+  }
+
+  return normalize(v);
+}
+
 void main() {
   MeshUniform mesh = meshes.meshes[gl_InstanceIndex];
 
   gl_Position = camera.projection * camera.view * mesh.model * vec4(vertPosition, 1.0);
 
   fragMesh = gl_InstanceIndex;
-  fragColor = vertColor;
+  fragColor = vertColor.rgb;
   fragTexCoord = vertTexCoord;
-  fragNormal = (mesh.model * vec4(vertNormal, 0.0)).xyz;
-  fragTangent = (mesh.model * vec4(vertTangent, 0.0)).xyz;
+  fragNormal = (mesh.model * vec4(decodeOctahedral(vertNormal), 0.0)).xyz;
+  fragTangent = (mesh.model * vec4(decodeOctahedral(vertTangent), 0.0)).xyz;
   fragPosition = (mesh.model * vec4(vertPosition, 1.0)).xyz;
 }
@@ -219,7 +219,7 @@ void UserInterface::loadUiScript() {
 
     auto script_path = cvars->get<FileCVar>("script_path").getPath();
 
-    log_msg_fmt("Loading UI script from: %s", script_path.c_str());
+    log_msg_fmt("Loading UI script from: %s", script_path.string().c_str());
 
     types::vector<char> script_data;
     if (!fs->loadBinaryFile(script_path, &script_data)) {
@@ -48,12 +48,53 @@ void World::initializePrefabs() {
   types::vector<AssetId> prefabs;
   fs->getInitialPrefabs(prefabs);
 
+  // Fault in every lump the prefabs need before loading them one by one
+  fs->prefetchPrefabs(prefabs);
+
+  types::vector<AssetHandle<PrefabAsset>> prefab_handles;
   for (auto prefab_id : prefabs) {
-    auto prefab = asset_pool->load<PrefabAsset>(prefab_id);
+    prefab_handles.push_back(asset_pool->loadAsync<PrefabAsset>(prefab_id));
+  }
+
+  // Retrieve every initial prefab (and its dependencies) in parallel
+  asset_pool->flush();
+
+  for (auto& prefab : prefab_handles) {
+    if (!prefab) {
+      log_err("Failed to load initial prefab");
+      continue;
+    }
+
     prefab->instantiate(this);
   }
 }
 
+void World::clear() {
+  log_zone;
+
+  pending_prefabs.clear();
+  registry.clear();
+}
+
+void World::instantiatePendingPrefabs() {
+  auto iter = pending_prefabs.begin();
+
+  while (iter != pending_prefabs.end()) {
+    if (iter->prefab.isPending()) {
+      iter++;
+      continue;
+    }
+
+    if (!iter->prefab) {
+      log_err("Failed to load spawned prefab");
+    } else if (registry.valid(iter->entity)) {
+      iter->prefab->instantiate(this, iter->entity);
+    }
+
+    iter = pending_prefabs.erase(iter);
+  }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Entity operations
 ///////////////////////////////////////////////////////////////////////////////
@@ -162,6 +203,20 @@ void World::onUpdateScripts(const protocol::UpdateScripts* update_scripts) {}
 bool World::update(double dt) {
   log_zone;
 
+  {
+    log_zone_named("Finish asset loads");
+
+    asset_pool->update();
+    instantiatePendingPrefabs();
+  }
+
+  {
+    log_zone_named("Collect unused assets");
+
+    // Keep this well under a frame
+    asset_pool->collect(0.001);
+  }
+
   {
     log_zone_named("Destroy old WorldTransforms");
 
@@ -347,13 +402,24 @@ wasm_trap_t* World::spawnPrefab(ScriptInstance* instance,
   }
 
   AssetId prefab_id = asset_pool->lookUpAlias(prefab_alias);
-  auto prefab_asset = asset_pool->load<PrefabAsset>(prefab_id);
-
-  if (!prefab_asset) {
+  if (prefab_id == NullAsset) {
     return scripts.createTrap("Failed to load script_alias");
   }
 
-  EntityId new_entity = prefab_asset->instantiate(this);
+  auto prefab_asset = asset_pool->loadAsync<PrefabAsset>(prefab_id);
+  EntityId new_entity = registry.create();
+
+  // Hand out the entity right away and fill it in once the prefab is loaded
+  if (prefab_asset.isPending()) {
+    pending_prefabs.emplace_back();
+    pending_prefabs.back().entity = new_entity;
+    pending_prefabs.back().prefab = prefab_asset;
+  } else if (prefab_asset) {
+    prefab_asset->instantiate(this, new_entity);
+  } else {
+    registry.destroy(new_entity);
+    return scripts.createTrap("Failed to load script_alias");
+  }
 
   results[0].kind = WASM_I32;
   results[0].of.i32 = new_entity;
@@ -25,6 +25,7 @@ namespace core {
 
 // Forward declarations
 class Filesystem;
+class PrefabAsset;
 
 class World : public StaticScriptObject<World> {
  public:
@@ -33,6 +34,9 @@ class World : public StaticScriptObject<World> {
 
   void initializePrefabs();
 
+  // Destroys every entity, releasing their assets
+  void clear();
+
   AssetPool* getAssetPool() { return asset_pool; }
 
   //
@@ -81,6 +85,17 @@ class World : public StaticScriptObject<World> {
   EntityRegistry registry;
   ComponentScriptEnvironment scripts;
   Physics physics;
+
+ private:
+  // Entities spawned before their prefab finished loading
+  struct PendingPrefab {
+    EntityId entity;
+    AssetHandle<PrefabAsset> prefab;
+  };
+
+  types::vector<PendingPrefab> pending_prefabs;
+
+  void instantiatePendingPrefabs();
 };
 
 }  // namespace core
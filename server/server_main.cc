@@ -11,6 +11,7 @@
 #include "CLI/Config.hpp"
 #include "CLI/Formatter.hpp"
 #include "core/assets/AssetPool.h"
+#include "core/assets/AssetTrace.h"
 #include "core/cvars/CVarScope.h"
 #include "core/cvars/FloatCVar.h"
 #include "core/displays/SdlDisplay.h"
@@ -18,6 +19,7 @@
 #include "core/gpu/GpuInstance.h"
 #include "core/network/NetworkServer.h"
 #include "core/renderer/MeshPass.h"
+#include "core/scripting/environment/ScriptEnvironment.h"
 #include "core/scripting/environment/WorldScriptEnvironment.h"
 #include "core/world/World.h"
 #include "core/world/WorldEventSorter.h"
@@ -40,6 +42,10 @@ struct ServerArgs {
 
   std::string config_path = "./config.toml";
 
+  std::string asset_trace_path;
+
+  bool trust_precompiled_scripts = false;
+
   int parse(int, const char* const[]);
 };
 
@@ -62,6 +68,12 @@ int ServerArgs::parse(int argc, const char* const argv[]) {
       app.add_option("-c,--config", config_path, "Path to config file", true);
   config_op->check(CLI::ExistingFile);
 
+  app.add_option("--asset-trace", asset_trace_path,
+                 "Write a Chrome trace of asset loading to this path");
+
+  app.add_flag("--trust-precompiled-scripts", trust_precompiled_scripts,
+               "Run scripts' bundled native code instead of compiling them");
+
   CLI11_PARSE(app, argc, argv);
   return -1;
 }
@@ -69,14 +81,24 @@ int ServerArgs::parse(int argc, const char* const argv[]) {
 bool g_interrupted = false;
 
 void run(const ServerArgs& args) {
+  // Enabled first so that bundle verification is traced too
+  if (!args.asset_trace_path.empty()) AssetTrace::enable();
+
+  if (args.trust_precompiled_scripts) {
+    ScriptEnvironment::trustPrecompiledScripts();
+  }
+
   Filesystem fs;
   CVarScope cvars;
 
+  Filesystem::initCVars(&cvars);
+
   CVarScope* server_cvars = cvars.addChild("server");
   server_cvars->addValue<FloatCVar>("max_tps", 1.0, 100.0);
   server_cvars->addValue<FloatCVar>("update_rate", 0.1, 20.0);
 
   cvars.loadConfigFromFile(&fs, args.config_path);
+  fs.setCVars(&cvars);
 
   for (auto bundle : args.bundle_paths) {
     fs.loadAssetBundle(bundle);
@@ -135,6 +157,11 @@ void run(const ServerArgs& args) {
     if (scripts) scripts->update(dt);
     if (!world.update(dt)) break;
   }
+
+  if (AssetTrace::isEnabled()) {
+    AssetTrace::logSummary(20);
+    AssetTrace::writeChromeTrace(args.asset_trace_path);
+  }
 }
 
 void signalHandler(int signum) {
@@ -33,6 +33,16 @@ const char* getAssetResultString(AssetResult result) {
   }
 }
 
+bool isSeekableCompression(LumpCompressionMethod compression_method) {
+  switch (compression_method) {
+    case LumpCompressionMethod::LZ4Seekable:
+    case LumpCompressionMethod::ZstdSeekable:
+      return true;
+    default:
+      return false;
+  }
+}
+
 std::string generateLumpName(uint32_t lump_index) {
   char buf[32];
   snprintf(buf, sizeof(buf), "lump_%04u.bin", lump_index);
@@ -67,5 +77,21 @@ void GlmToQuat(Quaternion* dst, const glm::quat& src) {
   v->Mutate(3, src.w);
 }
 
+uint32_t PackOctahedral(const glm::vec3& src) {
+  float l1_norm = glm::abs(src.x) + glm::abs(src.y) + glm::abs(src.z);
+  if (l1_norm == 0.0f) return glm::packSnorm2x16(glm::vec2(0.0f, 0.0f));
+
+  glm::vec3 n = src / l1_norm;
+
+  // Fold the lower hemisphere over the diagonals
+  glm::vec2 encoded(n.x, n.y);
+  if (n.z < 0.0f) {
+    glm::vec2 sign(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+    encoded = (1.0f - glm::abs(glm::vec2(n.y, n.x))) * sign;
+  }
+
+  return glm::packSnorm2x16(encoded);
+}
+
 }  // namespace assets
 }  // namespace mondradiko
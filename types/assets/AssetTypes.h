@@ -37,11 +37,15 @@ enum class AssetResult {
 // Global helper functions
 std::string generateLumpName(uint32_t);
 const char* getAssetResultString(AssetResult);
+bool isSeekableCompression(LumpCompressionMethod);
 
 void GlmToVec2(Vec2*, const glm::vec2&);
 void GlmToVec3(Vec3*, const glm::vec3&);
 void GlmToVec4(Vec4*, const glm::vec4&);
 void GlmToQuat(Quaternion*, const glm::quat&);
 
+// Packs a unit vector into two snorm16 components (see MeshCompactVertex)
+uint32_t PackOctahedral(const glm::vec3&);
+
 }  // namespace assets
 }  // namespace mondradiko
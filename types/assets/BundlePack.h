@@ -0,0 +1,46 @@
+// Copyright (c) 2020-2021 the Mondradiko contributors.
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <stdint.h>
+
+namespace mondradiko {
+namespace assets {
+
+/**
+ * Single-file bundle layout, with every field stored little-endian:
+ *
+ *   BundlePackHeader
+ *   BundlePackLump[lump_count]
+ *   Registry flatbuffer, at registry_offset
+ *   Lump files, each starting on a BUNDLE_PACK_ALIGNMENT boundary
+ *
+ * Lumps are stored exactly as they would be on disk in a bundle directory,
+ * so the registry's sizes and checksums apply to them unchanged.
+ */
+
+static const char BUNDLE_PACK_NAME[] = "bundle.pack";
+static const uint32_t BUNDLE_PACK_MAGIC = 0x4b50444d;  // "MDPK"
+static const uint32_t BUNDLE_PACK_VERSION = 1;
+static const uint64_t BUNDLE_PACK_ALIGNMENT = 4096;
+
+struct BundlePackHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t lump_count;
+  uint32_t reserved;
+  uint64_t registry_offset;
+  uint64_t registry_size;
+};
+
+struct BundlePackLump {
+  uint64_t offset;
+  uint64_t size;
+};
+
+static_assert(sizeof(BundlePackHeader) == 32);
+static_assert(sizeof(BundlePackLump) == 16);
+
+}  // namespace assets
+}  // namespace mondradiko
@@ -0,0 +1,143 @@
+// Copyright (c) 2020-2021 the Mondradiko contributors.
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include "types/assets/ScriptEngine.h"
+
+#include <cstdint>
+
+#include "types/build_config.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace mondradiko {
+namespace assets {
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define MONDRADIKO_SCRIPT_ARCH "x86_64"
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define MONDRADIKO_SCRIPT_ARCH "aarch64"
+#else
+#define MONDRADIKO_SCRIPT_ARCH "unknown"
+#endif
+
+#if defined(_WIN32)
+#define MONDRADIKO_SCRIPT_OS "windows"
+#elif defined(__APPLE__)
+#define MONDRADIKO_SCRIPT_OS "macos"
+#elif defined(__linux__)
+#define MONDRADIKO_SCRIPT_OS "linux"
+#else
+#define MONDRADIKO_SCRIPT_OS "unknown"
+#endif
+
+wasm_config_t* createScriptEngineConfig() {
+  wasm_config_t* config = wasm_config_new();
+  if (config == nullptr) return nullptr;
+
+  // Allow runaway scripts to be interrupted
+  wasmtime_config_interruptable_set(config, true);
+
+  return config;
+}
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+static void cpuid(uint32_t leaf, uint32_t regs[4]) {
+#if defined(_MSC_VER)
+  int msvc_regs[4];
+  __cpuidex(msvc_regs, static_cast<int>(leaf), 0);
+  for (int i = 0; i < 4; i++) regs[i] = static_cast<uint32_t>(msvc_regs[i]);
+#else
+  __cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// Whether the OS saves AVX registers on context switches
+static bool isAvxEnabled() {
+#if defined(_MSC_VER)
+  return (_xgetbv(0) & 0x6) == 0x6;
+#else
+  uint32_t xcr0_low;
+  uint32_t xcr0_high;
+  __asm__("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+  return (xcr0_low & 0x6) == 0x6;
+#endif
+}
+
+// The x86 features that Cranelift detects on the host and compiles for
+static types::string getCpuFeatures() {
+  uint32_t regs[4];  // EAX, EBX, ECX, EDX
+  cpuid(0, regs);
+  uint32_t max_leaf = regs[0];
+
+  cpuid(0x80000000, regs);
+  uint32_t max_extended_leaf = regs[0];
+
+  cpuid(1, regs);
+  uint32_t leaf1_ecx = regs[2];
+
+  uint32_t leaf7_ebx = 0;
+  if (max_leaf >= 7) {
+    cpuid(7, regs);
+    leaf7_ebx = regs[1];
+  }
+
+  uint32_t extended_ecx = 0;
+  if (max_extended_leaf >= 0x80000001) {
+    cpuid(0x80000001, regs);
+    extended_ecx = regs[2];
+  }
+
+  bool has_avx = (leaf1_ecx >> 28 & 1) && (leaf1_ecx >> 27 & 1) &&
+                 isAvxEnabled();
+
+  struct {
+    const char* name;
+    bool present;
+  } features[] = {
+      {"sse3", (leaf1_ecx >> 0 & 1) != 0},
+      {"ssse3", (leaf1_ecx >> 9 & 1) != 0},
+      {"sse41", (leaf1_ecx >> 19 & 1) != 0},
+      {"sse42", (leaf1_ecx >> 20 & 1) != 0},
+      {"popcnt", (leaf1_ecx >> 23 & 1) != 0},
+      {"avx", has_avx},
+      {"avx2", has_avx && (leaf7_ebx >> 5 & 1) != 0},
+      {"bmi1", (leaf7_ebx >> 3 & 1) != 0},
+      {"bmi2", (leaf7_ebx >> 8 & 1) != 0},
+      {"lzcnt", (extended_ecx >> 5 & 1) != 0},
+  };
+
+  types::string feature_list;
+  for (const auto& feature : features) {
+    if (!feature.present) continue;
+    if (!feature_list.empty()) feature_list += ",";
+    feature_list += feature.name;
+  }
+
+  return feature_list;
+}
+
+#else
+
+// Cranelift doesn't detect optional features on other targets
+static types::string getCpuFeatures() { return "baseline"; }
+
+#endif
+
+const types::string& getScriptEngineKey() {
+  // Update the settings along with createScriptEngineConfig()
+  static const types::string engine_key =
+      "wasmtime-" MONDRADIKO_WASMTIME_VERSION "-" MONDRADIKO_SCRIPT_ARCH
+      "-" MONDRADIKO_SCRIPT_OS "-interruptable-" + getCpuFeatures();
+
+  return engine_key;
+}
+
+}  // namespace assets
+}  // namespace mondradiko
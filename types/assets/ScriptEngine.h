@@ -0,0 +1,31 @@
+// Copyright (c) 2020-2021 the Mondradiko contributors.
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include "lib/include/wasm_headers.h"
+#include "types/containers/string.h"
+
+namespace mondradiko {
+namespace assets {
+
+/**
+ * @brief Creates the Wasm engine configuration for scripts.
+ *
+ * The bundler precompiles scripts with the same configuration that the
+ * runtime uses, so that the native code is interchangeable. The config is
+ * freed by wasm_engine_new_with_config().
+ */
+wasm_config_t* createScriptEngineConfig();
+
+/**
+ * @brief Identifies the native code produced by this machine's script engine.
+ *
+ * Combines the wasmtime version, the target, the engine settings, and the
+ * CPU features that Cranelift compiles for, which it detects from the host.
+ * Precompiled scripts are only loaded by engines with an identical key.
+ */
+const types::string& getScriptEngineKey();
+
+}  // namespace assets
+}  // namespace mondradiko